@@ -0,0 +1,183 @@
+export module hosted.main;
+
+import libpara.basic_types;
+import libpara.bench;
+import libpara.bitset;
+import libpara.err;
+import libpara.formatting.tests;
+import libpara.hash_table;
+import libpara.intrusive;
+import libpara.loop;
+import libpara.random;
+import libpara.ring;
+import libpara.span;
+import libpara.static_vector;
+import libpara.sync;
+import libpara.testing;
+import libpara.time;
+import libpara.xxh3;
+import libpara.xxh64;
+import kernel.pmm;
+import kernel.torture;
+import kernel.devices.serial;
+import hosted.platform;
+
+using namespace libpara::basic_types;
+
+export namespace hosted {
+
+/**
+ * Writes test results and benchmark lines to standard output, in the
+ * format the kernel writes them to the serial console
+ */
+class StdoutSink : public libpara::testing::TestCaseSink {
+
+  StdoutPort &port;
+  const char *in_test = nullptr;
+  bool errored = false;
+
+  int errors = 0;
+
+public:
+  StdoutSink(StdoutPort &port) : port(port) {}
+
+  virtual void test(const char *name) {
+    testComplete();
+    in_test = name;
+    errored = false;
+  }
+
+  virtual void testComplete() {
+    if (in_test != nullptr) {
+      if (!errored)
+        port.write(".");
+      in_test = nullptr;
+      errored = false;
+    }
+  }
+
+  virtual void report(bool success, const char *message = "",
+                      const char *file = nullptr, const char *line = nullptr) {
+    if (!success) {
+      errors++;
+      errored = true;
+      port.write("\n[!] Failure: ");
+      port.write(in_test);
+      port.write(": ");
+      port.write(message);
+      port.write(" at ");
+      if (file != nullptr) {
+        port.write(file);
+        if (line != nullptr) {
+          port.write(":");
+          port.write(line);
+        }
+      }
+      port.write("\n");
+    }
+  }
+
+  virtual void write(const char *s) { port.write(s); }
+
+  bool hadAnyErrors() const { return errors > 0; }
+};
+
+/**
+ * Number of threads SMP scenarios run on
+ */
+const u16 SMPThreads = 4;
+
+/**
+ * Runs `scenarios` on `SMPThreads` threads, as a team led by the calling one
+ */
+inline void together(libpara::testing::TestCaseSink &sink, u64 seed,
+                     void (*scenarios)(kernel::torture::Team &, u16)) {
+  static constinit kernel::torture::Team team;
+  CPUs::run(SMPThreads, [&](u16 cpu) {
+    scenarios(team, cpu == 0 ? team.lead(SMPThreads, sink, seed)
+                             : team.join());
+  });
+}
+
+/**
+ * Runs the tests that don't need the booted kernel, returning whether all
+ * of them passed
+ */
+inline bool test(StdoutPort &port, u64 seed) {
+  auto sink = StdoutSink(port);
+  libpara::bench::tests::TestCase(sink).start();
+  libpara::bitset::tests::TestCase(sink).start();
+  libpara::err::tests::TestCase(sink).start();
+  libpara::formatting::tests::TestCase(sink).start();
+  libpara::hash_table::tests::TestCase(sink).start();
+  libpara::intrusive::tests::TestCase(sink).start();
+  libpara::loop::tests::TestCase(sink).start();
+  libpara::random::tests::TestCase(sink).start();
+  libpara::ring::tests::TestCase(sink).start();
+  libpara::span::tests::TestCase(sink).start();
+  libpara::static_vector::tests::TestCase(sink).start();
+  libpara::sync::tests::TestCase(sink).start();
+  libpara::time::tests::TestCase(sink).start();
+  libpara::xxh64_tests::TestCase(sink).start();
+  libpara::xxh3::tests::TestCase(sink).start();
+  kernel::pmm::tests::TestCase(sink).start();
+  together(sink, seed, kernel::torture::test);
+  port.write("\n");
+  return !sink.hadAnyErrors();
+}
+
+/**
+ * Runs the benchmarks, between `bench: begin` and `bench: end` lines like
+ * `make bench` does
+ */
+inline void bench(StdoutPort &port, u64 seed) {
+  auto sink = StdoutSink(port);
+  sink.write("bench: begin\n");
+  libpara::err::benchmarks::Benchmark(sink).start();
+  libpara::formatting::benchmarks::Benchmark(sink).start();
+  libpara::hash_table::benchmarks::Benchmark(sink).start();
+  libpara::sync::benchmarks::Benchmark(sink).start();
+  libpara::xxh64_benchmarks::Benchmark(sink).start();
+  libpara::xxh3::benchmarks::Benchmark(sink).start();
+  kernel::pmm::benchmarks::Benchmark(sink).start();
+  together(sink, seed, kernel::torture::benchmark);
+  sink.write("bench: end\n");
+}
+
+inline bool equal(const char *a, const char *b) {
+  for (; *a != 0 && *a == *b; a++, b++)
+    ;
+  return *a == *b;
+}
+
+/**
+ * Decimal number in `s`, ignoring anything that isn't a digit
+ */
+inline u64 parse(const char *s) {
+  u64 value = 0;
+  for (; *s != 0; s++)
+    if (*s >= '0' && *s <= '9')
+      value = value * 10 + (*s - '0');
+  return value;
+}
+
+} // namespace hosted
+
+/**
+ * Entry point of the hosted build: `paraos [test|bench] [seed]`, the seed
+ * being the one SMP scenarios report on failure
+ */
+export extern "C" int main(int argc, char **argv) {
+  hosted::StdoutPort port;
+  port.initialize();
+  auto seed = argc > 2 ? hosted::parse(argv[2]) : kernel::torture::DefaultSeed;
+  if (argc > 1 && hosted::equal(argv[1], "bench")) {
+    hosted::bench(port, seed);
+    return 0;
+  }
+  if (argc > 1 && !hosted::equal(argv[1], "test")) {
+    port.write("usage: paraos [test|bench] [seed]\n");
+    return 2;
+  }
+  return hosted::test(port, seed) ? 0 : 1;
+}
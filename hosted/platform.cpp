@@ -0,0 +1,128 @@
+export module hosted.platform;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.time;
+import kernel.devices.serial;
+import kernel.platform;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+// the C library, declared here as the build doesn't use system headers
+extern "C" {
+long write(int fd, const void *buffer, unsigned long size);
+[[noreturn]] void exit(int status);
+int sched_yield();
+int pthread_create(unsigned long *thread, const void *attributes,
+                   void *(*start)(void *), void *argument);
+int pthread_join(unsigned long thread, void **result);
+[[noreturn]] void pthread_exit(void *result);
+}
+
+export namespace hosted {
+
+/**
+ * Standard output, standing in for the serial console
+ */
+class StdoutPort : public kernel::devices::SerialPort {
+
+public:
+  using kernel::devices::SerialPort::write;
+
+  virtual Result<nullptr_t> initialize() { return nullptr; }
+
+  virtual void write(const u8 b) { write(&b, 1); }
+
+  virtual void write(const u8 *bytes, usize size) {
+    while (size > 0) {
+      auto written = ::write(1, bytes, size);
+      if (written <= 0)
+        return;
+      bytes += written;
+      size -= written;
+    }
+  }
+};
+
+/**
+ * Index of the thread standing in for the current CPU
+ */
+inline thread_local u16 current_cpu = 0;
+
+/**
+ * Threads standing in for CPUs
+ */
+class CPUs {
+
+  template <typename P> struct Start {
+    P function;
+    u16 index;
+  };
+
+  template <typename P> static void *start(void *argument) {
+    auto start = static_cast<Start<P> *>(argument);
+    current_cpu = start->index;
+    (*start->function)(start->index);
+    return nullptr;
+  }
+
+public:
+  static const u16 Max = 64;
+
+  /**
+   * Calls `function(index)` on `count` CPUs at once, the calling thread being
+   * CPU 0, and returns once all calls have
+   */
+  template <typename F> static Result<nothing> run(u16 count, F &&function) {
+    if (count == 0 || count > Max)
+      return "InvalidCPUCount"_error;
+    using pointer_t = decltype(&function);
+    Start<pointer_t> starts[Max];
+    unsigned long threads[Max];
+    u16 started = 1;
+    for (; started < count; started++) {
+      starts[started] = {.function = &function, .index = started};
+      if (pthread_create(&threads[started], nullptr, start<pointer_t>,
+                         &starts[started]) != 0)
+        break;
+    }
+    function(static_cast<u16>(0));
+    for (u16 i = 1; i < started; i++)
+      pthread_join(threads[i], nullptr);
+    if (started < count)
+      return "ThreadCreationFailed"_error;
+    return nothing{};
+  }
+};
+
+} // namespace hosted
+
+export namespace kernel::platform {
+
+template <> struct impl<kernel::devices::SerialPort, Hosted> {
+  using type = hosted::StdoutPort;
+};
+
+template <> struct impl<cpuid, Hosted> {
+  static u16 function() { return hosted::current_cpu; }
+};
+
+template <> struct impl<timestamp, Hosted> {
+  static u64 function() { return libpara::time::rdtsc(); }
+};
+
+template <> struct impl<idle, Hosted> {
+  static void function() { sched_yield(); }
+};
+
+template <> struct impl<halt, Hosted> {
+  // ends the thread, or the process once no other thread is left
+  static void function() { pthread_exit(nullptr); }
+};
+
+template <> struct impl<exit_emulator, Hosted> {
+  [[noreturn]] static void function(u16 exit_code) { exit(exit_code); }
+};
+
+} // namespace kernel::platform
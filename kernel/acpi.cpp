@@ -0,0 +1,171 @@
+export module kernel.acpi;
+
+import libpara.basic_types;
+import libpara.err;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::acpi {
+
+const auto NoACPIError = "NoACPI"_error;
+const auto TableNotFoundError = "ACPITableNotFound"_error;
+const auto InvalidTableError = "InvalidACPITable"_error;
+
+/**
+ * Header shared by all system description tables
+ */
+struct SDTHeader {
+  char signature[4];
+  u32 length;
+  u8 revision;
+  u8 checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  u32 oem_revision;
+  u32 creator_id;
+  u32 creator_revision;
+
+  bool hasSignature(const char *s) const {
+    return signature[0] == s[0] && signature[1] == s[1] &&
+           signature[2] == s[2] && signature[3] == s[3];
+  }
+
+  bool isValid() const {
+    u8 sum = 0;
+    for (u32 i = 0; i < length; i++)
+      sum += reinterpret_cast<const u8 *>(this)[i];
+    return sum == 0;
+  }
+} __attribute__((packed));
+
+/**
+ * Generic Address Structure
+ */
+struct GenericAddress {
+  enum AddressSpace : u8 { SystemMemory = 0, SystemIO = 1 };
+
+  AddressSpace space;
+  u8 bit_width;
+  u8 bit_offset;
+  u8 access_size;
+  u64 address;
+} __attribute__((packed));
+
+/**
+ * Fixed ACPI Description Table (only the fields we use)
+ */
+struct FADT {
+  SDTHeader header;
+  u8 fields[76 - sizeof(SDTHeader)];
+  u32 pm_timer_block;
+  u8 fields2[112 - 80];
+  u32 flags;
+  u8 fields3[208 - 116];
+  GenericAddress x_pm_timer_block;
+
+  // PM timer is 32 bits wide rather than 24
+  static const u32 TimerValueExtended = 1 << 8;
+} __attribute__((packed));
+
+/**
+ * High Precision Event Timer table
+ */
+struct HPET {
+  SDTHeader header;
+  u32 event_timer_block_id;
+  GenericAddress address;
+  u8 number;
+  u16 minimum_tick;
+  u8 page_protection;
+} __attribute__((packed));
+
+/**
+ * Root of the system description tables
+ */
+class Tables {
+  const SDTHeader *root = nullptr;
+  // whether the root (XSDT) has 64-bit table pointers
+  bool extended = false;
+
+public:
+  /**
+   * Tables of a system without ACPI
+   */
+  constexpr Tables() {}
+
+  /**
+   * Locates the tables from a pointer to either the RSDP, the XSDT or the RSDT
+   */
+  static Result<Tables> from(const void *ptr) {
+    if (ptr == nullptr)
+      return NoACPIError;
+    auto bytes = reinterpret_cast<const u8 *>(ptr);
+    Tables tables;
+    if (isRSDP(bytes)) {
+      auto revision = bytes[15];
+      if (revision >= 2) {
+        tables.root = reinterpret_cast<const SDTHeader *>(
+            *reinterpret_cast<const u64 *>(bytes + 24));
+        tables.extended = true;
+      } else {
+        tables.root = reinterpret_cast<const SDTHeader *>(
+            static_cast<usize>(*reinterpret_cast<const u32 *>(bytes + 16)));
+      }
+    } else {
+      tables.root = reinterpret_cast<const SDTHeader *>(ptr);
+      tables.extended = tables.root->hasSignature("XSDT");
+    }
+    if (!(tables.root->hasSignature("XSDT") ||
+          tables.root->hasSignature("RSDT")) ||
+        !tables.root->isValid())
+      return InvalidTableError;
+    return tables;
+  }
+
+  /**
+   * Finds a table by its signature
+   */
+  Result<const SDTHeader *> find(const char *signature) const {
+    if (root == nullptr)
+      return NoACPIError;
+    auto entries = reinterpret_cast<const u8 *>(root) + sizeof(SDTHeader);
+    auto size = extended ? sizeof(u64) : sizeof(u32);
+    auto count = (root->length - sizeof(SDTHeader)) / size;
+    for (usize i = 0; i < count; i++) {
+      auto table = reinterpret_cast<const SDTHeader *>(
+          extended ? *reinterpret_cast<const u64 *>(entries + i * size)
+                   : *reinterpret_cast<const u32 *>(entries + i * size));
+      if (table->hasSignature(signature)) {
+        if (!table->isValid())
+          return InvalidTableError;
+        return table;
+      }
+    }
+    return TableNotFoundError;
+  }
+
+  template <typename T> Result<const T *> find(const char *signature) const {
+    return reinterpret_cast<const T *>(tryUnwrap(find(signature)));
+  }
+
+private:
+  static bool isRSDP(const u8 *bytes) {
+    const char *signature = "RSD PTR ";
+    for (auto i = 0; i < 8; i++)
+      if (bytes[i] != signature[i])
+        return false;
+    return true;
+  }
+};
+
+} // namespace kernel::acpi
+
+static_assert(sizeof(kernel::acpi::SDTHeader) == 36);
+static_assert(sizeof(kernel::acpi::GenericAddress) == 12);
+static_assert(__builtin_offsetof(kernel::acpi::FADT, pm_timer_block) == 76);
+static_assert(__builtin_offsetof(kernel::acpi::FADT, flags) == 112);
+static_assert(__builtin_offsetof(kernel::acpi::FADT, x_pm_timer_block) == 208);
+static_assert(sizeof(kernel::acpi::HPET) == 56);
@@ -0,0 +1,168 @@
+export module kernel.bench;
+
+import libpara.basic_types;
+import libpara.bench;
+import libpara.err;
+import libpara.formatting;
+import libpara.formatting.tests;
+import libpara.hash_table;
+import libpara.span;
+import libpara.sync;
+import libpara.testing;
+import libpara.time;
+import libpara.xxh3;
+import libpara.xxh64;
+import kernel.cpu;
+import kernel.pgo;
+import kernel.pmm;
+import kernel.profile;
+import kernel.torture;
+import kernel.devices.serial;
+import kernel.platform;
+import kernel.platform.x86_64;
+import kernel.platform.x86_64.interrupts;
+import kernel.platform.x86_64.memory;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::bench {
+
+/**
+ * Writes benchmark results to the serial console, flushing each of them
+ */
+class SerialConsoleSink : public libpara::testing::TestCaseSink {
+
+  using serial_port_t =
+      kernel::platform::impl<kernel::devices::SerialPort>::type;
+
+  serial_port_t &serial_port;
+
+public:
+  SerialConsoleSink(serial_port_t &serial_port) : serial_port(serial_port) {}
+
+  // benchmarks run with interrupts disabled, so output doesn't drain on its
+  // own
+  virtual void testComplete() { serial_port.flush(); }
+
+  virtual void write(const char *s) { serial_port.write(s); }
+};
+
+// all CPUs, once the bootstrap CPU is done with single-CPU benchmarks
+constinit kernel::torture::Team team;
+
+/**
+ * Runs the benchmarks that take a single CPU
+ */
+inline void runSingle(SerialConsoleSink &sink,
+                      libpara::span::Span<u8> scratch) {
+  libpara::err::benchmarks::Benchmark(sink).start();
+  libpara::formatting::benchmarks::Benchmark(sink).start();
+  libpara::hash_table::benchmarks::Benchmark(sink).start();
+  libpara::sync::benchmarks::Benchmark(sink).start();
+  libpara::xxh64_benchmarks::Benchmark(sink).start();
+  libpara::xxh3::benchmarks::Benchmark(sink).start();
+  kernel::pmm::benchmarks::Benchmark(sink).start();
+  kernel::platform::x86_64::interrupts::benchmarks::Benchmark(sink).start();
+  kernel::platform::x86_64::memory::benchmarks::Benchmark(sink, scratch)
+      .start();
+}
+
+/**
+ * Runs all benchmarks, between `bench: begin` and `bench: end` lines, and
+ * exits the emulator (after writing the profile when built with
+ * `PGO=instrument`). All `cpus` CPUs must call it: single-CPU benchmarks
+ * run on the bootstrap CPU while the others wait to join it for the SMP
+ * ones. Benchmarks that go through more memory than the caches hold get
+ * `scratch`, which nothing else may be using.
+ */
+inline void run(bool bootstrap, u16 cpus, libpara::span::Span<u8> scratch) {
+  if (!bootstrap) {
+    kernel::torture::benchmark(team, team.join());
+    return;
+  }
+  {
+    kernel::platform::impl<kernel::devices::SerialPort>::type serial;
+    serial.initialize();
+    auto sink = SerialConsoleSink(serial);
+
+    sink.write("bench: begin\n");
+    runSingle(sink, scratch);
+    kernel::torture::benchmark(
+        team, team.lead(cpus, sink, kernel::torture::DefaultSeed));
+    sink.write("bench: end\n");
+    // benchmarks are the workload profiles are collected from
+    kernel::pgo::dump(serial);
+    sink.testComplete();
+  }
+  kernel::platform::impl<kernel::platform::exit_emulator>::function(0);
+}
+
+/**
+ * Memory `profile()` gives benchmarks that go through more than the caches
+ * hold
+ */
+const usize ProfileScratchSize = (16 << 20) + 4096;
+
+/**
+ * Rounds of hashing 4 KiB that `profile()` times with sampling paused and
+ * on: long enough for a few hundred samples at 1 kHz
+ */
+const u32 OverheadRounds = 1 << 18;
+
+// Cycles taken by a fixed amount of work, the least of a few runs
+inline u64 timeWorkload() {
+  static u8 data[4096];
+  u64 least = ~0ULL;
+  for (u32 run = 0; run < 3; run++) {
+    libpara::time::Stopwatch stopwatch;
+    u64 hash = 0;
+    for (u32 i = 0; i < OverheadRounds; i++)
+      hash += libpara::xxh3::hash64(data, sizeof(data), hash);
+    libpara::bench::keep(hash);
+    auto elapsed = stopwatch.elapsed();
+    least = elapsed < least ? elapsed : least;
+  }
+  return least;
+}
+
+/**
+ * Runs the single-CPU benchmarks on the bootstrap CPU, once all CPUs are
+ * up, for the other CPUs to sample (see `kernel::profile`). Then writes the
+ * samples out and exits the emulator.
+ *
+ * What sampling costs is measured first: a `profile: overhead <paused>
+ * <sampling>` line gives the cycles a fixed workload took with sampling
+ * paused and on.
+ */
+inline void profile(const kernel::cpu::Table &cpus,
+                    kernel::pmm::Allocator &allocator) {
+  {
+    kernel::platform::impl<kernel::devices::SerialPort>::type serial;
+    serial.initialize();
+    auto sink = SerialConsoleSink(serial);
+    if (cpus.size() < 2)
+      sink.write("profile: sampling needs a second CPU\n");
+
+    kernel::profile::pause();
+    auto paused = timeWorkload();
+    kernel::profile::resume();
+    auto sampling = timeWorkload();
+    libpara::formatting::format(serial, "profile: overhead ", paused, " ",
+                                sampling, "\n");
+
+    void *scratch = tryCatch(allocator.allocate(ProfileScratchSize, 4096), err,
+                             nullptr);
+    sink.write("bench: begin\n");
+    runSingle(sink, {static_cast<u8 *>(scratch),
+                     scratch != nullptr ? ProfileScratchSize : 0});
+    sink.write("bench: end\n");
+    kernel::profile::dump(serial, cpus);
+    sink.testComplete();
+  }
+  kernel::platform::impl<kernel::platform::exit_emulator>::function(0);
+}
+
+} // namespace kernel::bench
@@ -3,10 +3,21 @@ export module kernel.bootboot;
 import libpara.basic_types;
 import libpara.err;
 import libpara.formatting;
+import libpara.span;
+import libpara.sync;
+import kernel.cpu;
 import kernel.main;
+import kernel.devices.framebuffer;
+import kernel.environment;
 import kernel.pmm;
+import kernel.profile;
+import kernel.timeline;
+#ifdef BENCHMARKS
+import kernel.bench;
+#endif
 #ifndef RELEASE
 import kernel.testing;
+import kernel.torture;
 #endif
 import kernel.devices.serial;
 import kernel.platform;
@@ -35,8 +46,12 @@ export struct Bootboot {
   };
 
   static const auto header_size = 0x04;
+  static const auto header_fb_width = 0x34;
+  static const auto header_fb_height = 0x38;
+  static const auto header_fb_scanline = 0x3c;
   static const auto header_numcores = 0x0a;
   static const auto header_bspid = 0x0c;
+  static const auto header_acpi = 0x40;
   static const auto header_mmap = 0x80;
 
   inline u16 numCores() {
@@ -53,6 +68,18 @@ export struct Bootboot {
     return *reinterpret_cast<u32 *>(reinterpret_cast<u8 *>(this) + header_size);
   }
 
+  /**
+   * Pointer to ACPI's RSDT or XSDT, if any
+   */
+  const void *acpiTables() {
+    return *reinterpret_cast<void **>(reinterpret_cast<u8 *>(this) +
+                                      header_acpi);
+  }
+
+  inline u32 headerField(usize offset) {
+    return *reinterpret_cast<u32 *>(reinterpret_cast<u8 *>(this) + offset);
+  }
+
   inline u32 mmapEntries() { return (size() - 128) / 16; }
 
   inline mmap_entry mmapEntry(u32 index) {
@@ -71,40 +98,104 @@ export struct Bootboot {
 
 export extern Bootboot bootboot;
 export extern unsigned char environment[4096];
+export extern u32 fb[];
+
+/**
+ * Linear framebuffer set up by the loader and mapped at `fb`
+ */
+kernel::devices::framebuffer::Framebuffer framebuffer() {
+  return {.pixels = fb,
+          .width = bootboot.headerField(Bootboot::header_fb_width),
+          .height = bootboot.headerField(Bootboot::header_fb_height),
+          .scanline = bootboot.headerField(Bootboot::header_fb_scanline)};
+}
+
+using Settings = kernel::environment::Settings<32>;
+
+constinit Settings settings;
+constinit libpara::sync::Once settingsParsed;
+
+/**
+ * Settings from the loader's environment, parsed by the first CPU to ask
+ */
+const Settings &environmentSettings() {
+  settingsParsed.call([] {
+    settings.parse(reinterpret_cast<const char *>(environment),
+                   sizeof(environment));
+  });
+  return settings;
+}
 
 #ifndef RELEASE
 bool isTesting() {
-  usize i = 0;
-  while (true) {
-    if (environment[i] == 0)
-      return false;
-    if (environment[i] == 't' && environment[i + 1] == 'e' &&
-        environment[i + 2] == 's' && environment[i + 3] == 't' &&
-        environment[i + 4] == '=' && environment[i + 5] == 'y' &&
-        environment[i + 6] == 'e' && environment[i + 7] == 's')
-      return true;
-    i++;
+  return tryCatch(environmentSettings().flag("test"), err, false);
+}
+#endif
+
+#ifdef BENCHMARKS
+bool isBenchmarking() {
+  return tryCatch(environmentSettings().flag("bench"), err, false);
+}
+
+/**
+ * Largest free region of memory, which benchmarks can use as they like, as
+ * they run before anything is allocated
+ */
+libpara::span::Span<u8> benchmarkScratch() {
+  libpara::span::Span<u8> largest;
+  for (u32 i = 0; i < bootboot.mmapEntries(); i++) {
+    auto entry = bootboot.mmapEntry(i);
+    if (entry.type() == Bootboot::mmap_entry::Free &&
+        entry.size() > largest.size())
+      largest = {static_cast<u8 *>(entry.ptr), entry.size()};
   }
+  return largest;
 }
 #endif
 
 export extern "C" void bootboot_main() {
+  auto entered =
+      kernel::platform::impl<kernel::platform::timestamp>::function();
+  kernel::timeline::record(
+      kernel::timeline::Milestone::Entered,
+      kernel::platform::impl<kernel::platform::cpuid>::function(), entered);
+
   static constinit kernel::pmm::ChainedAllocator<
       kernel::pmm::WatermarkAllocator, 32>
       defaultAllocator;
 
-  static constinit auto bsp = kernel::BootstrapProcessor(defaultAllocator);
+  static constinit kernel::cpu::Table cpus;
+
+  static constinit auto bsp =
+      kernel::BootstrapProcessor(defaultAllocator, cpus);
 
 #ifndef RELEASE
   if (isTesting()) {
-    if (bootboot.isBootstrapCPU()) {
-      kernel::testing::run();
-    }
+    kernel::testing::run(bootboot.isBootstrapCPU(), bootboot.numCores(),
+                         tryCatch(environmentSettings().integer("seed"), err,
+                                  kernel::torture::DefaultSeed));
+    kernel::platform::impl<kernel::platform::halt>::function();
+  }
+#endif
+#ifdef BENCHMARKS
+  // with the profiler built in, the benchmarks run once every CPU is up, so
+  // that the other CPUs can sample them
+  if (isBenchmarking() && !kernel::profile::Enabled) {
+    kernel::bench::run(bootboot.isBootstrapCPU(), bootboot.numCores(),
+                       benchmarkScratch());
     kernel::platform::impl<kernel::platform::halt>::function();
   }
 #endif
   if (bootboot.isBootstrapCPU()) {
-    bsp.setNumCPUs(bootboot.numCores());
+    // `cpus` limits how many CPUs are brought up
+    auto limit = tryCatch(environmentSettings().integer("cpus"), err,
+                          bootboot.numCores());
+    if (limit == 0 || limit > bootboot.numCores())
+      limit = bootboot.numCores();
+    bsp.setNumCPUs(static_cast<u16>(limit));
+    bsp.setBaud(static_cast<u32>(
+        tryCatch(environmentSettings().integer("serial.baud"), err,
+                 kernel::platform::x86_64::serial::DefaultBaud)));
 
     for (u32 i = 0; i < bootboot.mmapEntries(); i++) {
       auto entry = bootboot.mmapEntry(i);
@@ -115,14 +206,21 @@ export extern "C" void bootboot_main() {
             err, ({
               kernel::platform::impl<kernel::devices::SerialPort>::type serial;
               serial.initialize();
-              format(serial, "Uncaught error while preparing PMM: ", err.name,
+              format(serial, "Uncaught error while preparing PMM: ", err.name(),
                      "\n");
               0;
             }));
       }
     }
-    bsp.start();
+    kernel::timeline::record(kernel::timeline::Milestone::MemoryMapped,
+                             bootboot.bootstrapCPU());
+    bsp.setACPI(bootboot.acpiTables());
+    bsp.setFramebuffer(framebuffer());
+#ifdef BENCHMARKS
+    bsp.setProfiledBenchmarks(isBenchmarking());
+#endif
+    bsp.start(entered);
   } else {
-    kernel::ApplicationProcessor(defaultAllocator, bsp).start();
+    kernel::ApplicationProcessor(defaultAllocator, bsp).start(entered);
   }
 }
@@ -0,0 +1,168 @@
+export module kernel.cpu;
+
+import libpara.basic_types;
+import libpara.err;
+
+import kernel.pmm;
+import kernel.timer;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::cpu {
+
+const auto MaxCPUs = 256;
+
+/**
+ * Size of the memory slice reserved for every CPU
+ */
+const usize SliceSize = 64 * 1024;
+
+const auto TooManyCPUsError = "TooManyCPUs"_error;
+const auto GivenUpOnError = "GivenUpOn"_error;
+
+/**
+ * Per-CPU state. Every CPU claims one entry and is its only writer (until it
+ * settles), so entries are kept on separate cache lines.
+ */
+struct alignas(64) CPU {
+  enum State : u8 {
+    Absent = 0,
+    Starting = 1,
+    Online = 2,
+    Failed = 3,
+  };
+
+  // platform code may rely on the entry pointing to itself at offset zero
+  CPU *self = this;
+  // index in the CPU table (order in which CPUs claimed their entries)
+  u16 index = 0;
+  // platform CPU ID
+  u16 id = 0;
+  State state = Absent;
+  // timestamp at kernel entry
+  u64 entered = 0;
+  // timestamp at which the CPU finished its setup
+  u64 online = 0;
+  // CPU-local allocator over its pre-reserved memory slice
+  kernel::pmm::WatermarkAllocator allocator;
+  // CPU-local timers, allocated from the CPU's slice by the platform
+  kernel::timer::Wheel *timers = nullptr;
+
+  constexpr CPU() {}
+
+  /**
+   * Publishes the outcome of CPU's setup, unless the CPU was given up on
+   * in the meantime
+   */
+  bool settle(bool success, u64 timestamp) {
+    online = timestamp;
+    auto expected = Starting;
+    return __atomic_compare_exchange_n(&state, &expected,
+                                       success ? Online : Failed, false,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  }
+
+  /**
+   * Marks the CPU as `Failed` if it hasn't settled (or even claimed its
+   * entry) yet. Returns whether it did.
+   */
+  bool giveUp() {
+    auto expected = currentState();
+    while (expected == Absent || expected == Starting)
+      if (__atomic_compare_exchange_n(&state, &expected, Failed, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return true;
+    return false;
+  }
+
+  State currentState() const {
+    return __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+  }
+};
+
+/**
+ * Table of all CPUs participating in the boot
+ *
+ * The bootstrap CPU reserves one contiguous block of memory for all CPUs
+ * upfront, and every CPU then claims its own slice of it without
+ * contending on the shared allocator.
+ */
+class Table {
+  CPU cpus[MaxCPUs] = {};
+  u8 *slices = nullptr;
+  u16 ncpus = 0;
+  u16 claimed = 0;
+
+public:
+  constexpr Table() {}
+  Table(Table &) = delete;
+
+  /**
+   * Reserves memory slices for `n` CPUs
+   */
+  Result<nothing> reserve(kernel::pmm::Allocator &allocator, u16 n) {
+    if (n > MaxCPUs)
+      return TooManyCPUsError;
+    slices = reinterpret_cast<u8 *>(
+        tryUnwrap(allocator.allocate(n * SliceSize, 4096)));
+    ncpus = n;
+    return nothing{};
+  }
+
+  /**
+   * Claims the next free entry for the calling CPU. Only valid after
+   * `reserve()` has completed. Fails if there are none left, or if the
+   * bootstrap CPU has given up on waiting for this one.
+   */
+  Result<CPU *> claim(u16 id, u64 entered) {
+    auto index = __atomic_fetch_add(&claimed, 1, __ATOMIC_RELAXED);
+    if (index >= ncpus)
+      return TooManyCPUsError;
+    auto cpu = &cpus[index];
+    auto expected = CPU::Absent;
+    if (!__atomic_compare_exchange_n(&cpu->state, &expected, CPU::Starting,
+                                     false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED))
+      return GivenUpOnError;
+    cpu->index = index;
+    cpu->id = id;
+    cpu->entered = entered;
+    cpu->allocator =
+        kernel::pmm::WatermarkAllocator(slices + index * SliceSize, SliceSize);
+    return cpu;
+  }
+
+  /**
+   * Waits until every reserved CPU has either come online or failed. CPUs
+   * that haven't by `deadline` (as told by `now()`), such as ones the
+   * firmware reported but that never started, are marked as `Failed`.
+   * Returns how many were given up on.
+   */
+  template <typename Now> u16 waitUntilSettled(u64 deadline, Now &&now) {
+    u16 givenUp = 0;
+    for (u16 i = 0; i < ncpus; i++) {
+      while (true) {
+        auto state = cpus[i].currentState();
+        if (state == CPU::Online || state == CPU::Failed)
+          break;
+        if (now() >= deadline) {
+          // it may have settled after all, in which case this is re-read
+          if (cpus[i].giveUp())
+            givenUp++;
+          continue;
+        }
+        __builtin_ia32_pause();
+      }
+    }
+    return givenUp;
+  }
+
+  u16 size() const { return ncpus; }
+
+  const CPU &operator[](u16 index) const { return cpus[index]; }
+};
+
+} // namespace kernel::cpu
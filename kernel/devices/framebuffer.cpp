@@ -0,0 +1,353 @@
+export module kernel.devices.framebuffer;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.sync;
+
+import kernel.devices.font;
+import kernel.pmm;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::devices::framebuffer {
+
+/**
+ * Linear framebuffer with 32 bits per pixel
+ */
+struct Framebuffer {
+  u32 *pixels = nullptr;
+  u32 width = 0;
+  u32 height = 0;
+  // bytes per row
+  u32 scanline = 0;
+
+  u32 *row(u32 y) const {
+    return reinterpret_cast<u32 *>(reinterpret_cast<u8 *>(pixels) +
+                                   static_cast<usize>(y) * scanline);
+  }
+};
+
+/**
+ * Copies `size` bytes 64 at a time (and the remainder byte by byte) using
+ * SSE registers. Safe for overlapping regions as long as `to` precedes
+ * `from`.
+ */
+void copyForward(void *to, const void *from, usize size) {
+  typedef long long chunk __attribute__((vector_size(16)));
+  auto d = reinterpret_cast<u8 *>(to);
+  auto s = reinterpret_cast<const u8 *>(from);
+  for (; size >= 64; size -= 64, d += 64, s += 64) {
+    // constant-sized copies become unaligned SSE loads and stores
+    chunk a, b, c, e;
+    __builtin_memcpy(&a, s, 16);
+    __builtin_memcpy(&b, s + 16, 16);
+    __builtin_memcpy(&c, s + 32, 16);
+    __builtin_memcpy(&e, s + 48, 16);
+    __builtin_memcpy(d, &a, 16);
+    __builtin_memcpy(d + 16, &b, 16);
+    __builtin_memcpy(d + 32, &c, 16);
+    __builtin_memcpy(d + 48, &e, 16);
+  }
+  for (usize i = 0; i < size; i++)
+    d[i] = s[i];
+}
+
+/**
+ * Pixel rectangle [x0, x1) x [y0, y1)
+ */
+struct Rect {
+  u32 x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+  bool isEmpty() const { return x0 >= x1 || y0 >= y1; }
+
+  /**
+   * Smallest rectangle covering both `this` and `other`
+   */
+  Rect cover(const Rect &other) const {
+    if (isEmpty())
+      return other;
+    if (other.isEmpty())
+      return *this;
+    return Rect{.x0 = x0 < other.x0 ? x0 : other.x0,
+                .y0 = y0 < other.y0 ? y0 : other.y0,
+                .x1 = x1 > other.x1 ? x1 : other.x1,
+                .y1 = y1 > other.y1 ? y1 : other.y1};
+  }
+};
+
+/**
+ * Text console rendering into a framebuffer
+ *
+ * Text is drawn into a shadow copy of the framebuffer, and only the region
+ * that changed since the last flush is copied out: framebuffer memory is slow
+ * to write and even slower to read. Scrolling moves the shadow buffer's rows
+ * rather than redrawing the text.
+ *
+ * Writes from all CPUs are serialized. Whichever CPU finds the framebuffer
+ * idle flushes everything written so far, including other CPUs' writes.
+ */
+class Console {
+public:
+  // glyph rows are doubled to make 8x16 cells
+  static const u32 CellWidth = font::Width;
+  static const u32 CellHeight = font::Height * 2;
+
+  static const u32 Foreground = 0xAAAAAA;
+  static const u32 Background = 0x000000;
+
+  static const u8 TabWidth = 8;
+
+private:
+  Framebuffer target;
+  // same dimensions as `target`, but with tightly packed rows
+  u32 *shadow = nullptr;
+  u32 columns = 0, rows = 0;
+  u32 column = 0, row = 0;
+
+  // region of the shadow buffer that differs from the framebuffer
+  Rect dirty;
+
+  // protects the state above
+  libpara::sync::Lock lock;
+  // held while copying to the framebuffer
+  libpara::sync::Lock flushing;
+
+public:
+  /**
+   * Console without a framebuffer, discarding all output
+   */
+  constexpr Console() {}
+
+  /**
+   * Console drawing into `target` through `shadow`, which must hold
+   * `target.width * target.height` pixels
+   */
+  Console(Framebuffer target, u32 *shadow)
+      : target(target), shadow(shadow), columns(target.width / CellWidth),
+        rows(target.height / CellHeight) {
+    fill(0, target.height);
+    dirty = Rect{.x1 = target.width, .y1 = target.height};
+  }
+
+  /**
+   * Console drawing into `target` through a shadow buffer from `allocator`
+   */
+  static Result<Console> create(Framebuffer target,
+                                kernel::pmm::Allocator &allocator) {
+    if (target.pixels == nullptr || target.width < CellWidth ||
+        target.height < CellHeight || target.scanline < target.width * 4)
+      return "NoFramebuffer"_error;
+    auto shadow = reinterpret_cast<u32 *>(tryUnwrap(allocator.allocate(
+        static_cast<usize>(target.width) * target.height * sizeof(u32), 64)));
+    return Console(target, shadow);
+  }
+
+  bool isPresent() const { return shadow != nullptr; }
+
+  u32 width() const { return columns; }
+  u32 height() const { return rows; }
+
+  void write(const u8 *bytes, usize size) {
+    if (!isPresent())
+      return;
+    lock.lock();
+    for (usize i = 0; i < size; i++)
+      put(static_cast<char>(bytes[i]));
+    lock.unlock();
+    flush();
+  }
+
+  void write(const char *str) {
+    usize size = 0;
+    while (str[size] != 0)
+      size++;
+    write(reinterpret_cast<const u8 *>(str), size);
+  }
+
+  /**
+   * Copies the changed region to the framebuffer, unless another CPU is
+   * already doing so (it will pick up these changes too)
+   */
+  void flush() {
+    while (flushing.tryLock()) {
+      lock.lock();
+      auto region = dirty;
+      dirty = Rect{};
+      lock.unlock();
+      // pixels may change while being copied, but then they are dirty again
+      for (auto y = region.y0; y < region.y1; y++)
+        copyForward(target.row(y) + region.x0, shadowRow(y) + region.x0,
+                    (region.x1 - region.x0) * sizeof(u32));
+      flushing.unlock();
+      lock.lock();
+      auto clean = dirty.isEmpty();
+      lock.unlock();
+      if (clean)
+        return;
+    }
+  }
+
+private:
+  u32 *shadowRow(u32 y) const {
+    return shadow + static_cast<usize>(y) * target.width;
+  }
+
+  /**
+   * Fills pixel rows [from, to) with the background
+   */
+  void fill(u32 from, u32 to) {
+    for (auto y = from; y < to; y++) {
+      auto pixels = shadowRow(y);
+      for (u32 x = 0; x < target.width; x++)
+        pixels[x] = Background;
+    }
+  }
+
+  void put(char c) {
+    switch (c) {
+    case '\n':
+      newLine();
+      return;
+    case '\r':
+      column = 0;
+      return;
+    case '\t':
+      column = (column / TabWidth + 1) * TabWidth;
+      if (column >= columns)
+        newLine();
+      return;
+    }
+    if (column >= columns)
+      newLine();
+    draw(c, column, row);
+    column++;
+  }
+
+  void newLine() {
+    column = 0;
+    if (row + 1 < rows) {
+      row++;
+      return;
+    }
+    // scroll by one text row
+    auto text_height = rows * CellHeight;
+    copyForward(shadowRow(0), shadowRow(CellHeight),
+                static_cast<usize>(text_height - CellHeight) * target.width *
+                    sizeof(u32));
+    fill(text_height - CellHeight, text_height);
+    dirty = dirty.cover(Rect{.x1 = columns * CellWidth, .y1 = text_height});
+  }
+
+  void draw(char c, u32 column, u32 row) {
+    auto glyph = font::glyph(c);
+    for (u32 y = 0; y < CellHeight; y++) {
+      auto bits = glyph[y / 2];
+      auto pixels = shadowRow(row * CellHeight + y) + column * CellWidth;
+      for (u32 x = 0; x < CellWidth; x++)
+        pixels[x] = (bits >> x) & 1 ? Foreground : Background;
+    }
+    dirty = dirty.cover(Rect{.x0 = column * CellWidth,
+                             .y0 = row * CellHeight,
+                             .x1 = (column + 1) * CellWidth,
+                             .y1 = (row + 1) * CellHeight});
+  }
+};
+
+} // namespace kernel::devices::framebuffer
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace kernel::devices::framebuffer::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+  static const u32 Width = 3 * Console::CellWidth;
+  static const u32 Height = 2 * Console::CellHeight;
+  // rows are padded, as they may be in real framebuffers
+  static const u32 Stride = Width + 4;
+
+  // kept off the (small) stack
+  static inline u32 screen[Height * Stride];
+  static inline u32 shadow[Height * Width];
+
+  /**
+   * Whether the cell at `column`, `row` on screen shows `c`
+   */
+  static bool shows(char c, u32 column, u32 row) {
+    auto glyph = kernel::devices::font::glyph(c);
+    for (u32 y = 0; y < Console::CellHeight; y++)
+      for (u32 x = 0; x < Console::CellWidth; x++) {
+        auto pixel = screen[(row * Console::CellHeight + y) * Stride +
+                            column * Console::CellWidth + x];
+        auto lit = (glyph[y / 2] >> x) & 1;
+        if (pixel != (lit ? Console::Foreground : Console::Background))
+          return false;
+      }
+    return true;
+  }
+
+  static Console console() {
+    for (auto &pixel : screen)
+      pixel = 0xDEADBEEF;
+    return Console(Framebuffer{.pixels = screen,
+                               .width = Width,
+                               .height = Height,
+                               .scanline = Stride * sizeof(u32)},
+                   shadow);
+  }
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Console draws text");
+    {
+      auto c = console();
+      c.write("ab\ncd");
+      Expect(shows('a', 0, 0));
+      Expect(shows('b', 1, 0));
+      Expect(shows(' ', 2, 0));
+      Expect(shows('c', 0, 1));
+      Expect(shows('d', 1, 1));
+      // padding is left alone
+      Expect(screen[Width] == 0xDEADBEEF);
+    }
+
+    test("Console wraps and scrolls");
+    {
+      auto c = console();
+      c.write("abcdefg");
+      Expect(shows('d', 0, 0));
+      Expect(shows('e', 1, 0));
+      Expect(shows('f', 2, 0));
+      Expect(shows('g', 0, 1));
+      Expect(shows(' ', 1, 1));
+    }
+
+    test("Console without a framebuffer");
+    {
+      Console c;
+      Expect(!c.isPresent());
+      c.write("ignored");
+    }
+
+    test("copyForward");
+    {
+      u8 bytes[200];
+      for (u8 i = 0; i < 200; i++)
+        bytes[i] = i;
+      copyForward(bytes, bytes + 3, 197);
+      bool moved = true;
+      for (u8 i = 0; i < 197; i++)
+        moved = moved && bytes[i] == i + 3;
+      Expect(moved);
+    }
+  }
+};
+
+} // namespace kernel::devices::framebuffer::tests
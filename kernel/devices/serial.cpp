@@ -14,13 +14,30 @@ public:
   virtual Result<nullptr_t> initialize() = 0;
   virtual void write(const u8 b) = 0;
 
+  /**
+   * Writes `size` bytes at once
+   */
+  virtual void write(const u8 *bytes, usize size) {
+    for (usize i = 0; i < size; i++)
+      write(bytes[i]);
+  }
+
   virtual void write(const char *str) {
-    auto i = 0;
-    while (str[i] != 0) {
-      write((u8)str[i]);
-      i++;
-    }
+    usize size = 0;
+    while (str[size] != 0)
+      size++;
+    write(reinterpret_cast<const u8 *>(str), size);
   }
+
+  /**
+   * Synchronously transmits any buffered output
+   */
+  virtual void flush() {}
+
+  /**
+   * Number of bytes dropped instead of being transmitted
+   */
+  virtual u64 dropped() { return 0; }
 };
 
 } // namespace kernel::devices
@@ -0,0 +1,225 @@
+export module kernel.environment;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.span;
+import libpara.xxh64;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::environment {
+
+const auto SettingNotFoundError = "SettingNotFound"_error;
+const auto InvalidSettingError = "InvalidSetting"_error;
+
+/**
+ * Setting name, hashed at compile time so that lookups only compare hashes
+ */
+struct Key {
+  u64 hash;
+
+  consteval Key(const char *name) : hash(libpara::xxh64::hash(name, 0)) {}
+};
+
+/**
+ * Text of a setting, pointing into the environment it was parsed from (and
+ * not terminated)
+ */
+using Value = libpara::span::StringView;
+
+/**
+ * Settings from `key=value` lines, such as the loader's environment.
+ *
+ * Spaces and tabs around keys and values are trimmed. Empty lines, lines
+ * without `=` and comments (starting with `#` or `//`) are skipped. A key
+ * that comes again overrides its earlier value. Keys past `capacity` are
+ * counted and dropped.
+ */
+template <usize capacity> class Settings {
+  struct Entry {
+    u64 key;
+    Value value;
+  };
+
+  Entry entries[capacity] = {};
+  usize count = 0;
+  usize overflow = 0;
+
+  void add(Value key, Value value) {
+    auto hash = libpara::xxh64::hash(key.data(), key.size(), 0);
+    for (usize i = 0; i < count; i++)
+      if (entries[i].key == hash) {
+        entries[i].value = value;
+        return;
+      }
+    if (count == capacity) {
+      overflow++;
+      return;
+    }
+    entries[count++] = {.key = hash, .value = value};
+  }
+
+public:
+  constexpr Settings() {}
+  Settings(Settings &) = delete;
+
+  /**
+   * Adds settings from up to `size` bytes of `text`, which ends early at a
+   * zero byte
+   */
+  void parse(const char *text, usize size) {
+    usize end = 0;
+    while (end < size && text[end] != 0)
+      end++;
+    Value lines(text, end);
+    for (usize start = 0; start < end;) {
+      auto stop = lines.find('\n', start);
+      if (stop == libpara::span::NotFound)
+        stop = end;
+      auto line = lines.slice(start, stop - start).trim();
+      start = stop + 1;
+      if (line.isEmpty() || line.startsWith("#") || line.startsWith("//"))
+        continue;
+      auto equals = line.find('=');
+      if (equals == libpara::span::NotFound)
+        continue;
+      auto key = line.slice(0, equals).trim();
+      if (!key.isEmpty())
+        add(key, line.slice(equals + 1).trim());
+    }
+  }
+
+  Result<Value> text(Key key) const {
+    for (usize i = 0; i < count; i++)
+      if (entries[i].key == key.hash)
+        return entries[i].value;
+    return SettingNotFoundError;
+  }
+
+  /**
+   * Setting as a decimal, or hexadecimal with `0x`, number
+   */
+  Result<u64> integer(Key key) const {
+    auto value = tryUnwrap(text(key));
+    u64 base = 10;
+    usize i = 0;
+    if (value.size() > 2 &&
+        (value.startsWith("0x") || value.startsWith("0X"))) {
+      base = 16;
+      i = 2;
+    }
+    if (i == value.size())
+      return InvalidSettingError;
+    u64 result = 0;
+    for (; i < value.size(); i++) {
+      auto c = value[i];
+      u64 digit = c >= '0' && c <= '9'                ? c - '0'
+                  : base == 16 && c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : base == 16 && c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                                       : base;
+      if (digit >= base || result > (~0ULL - digit) / base)
+        return InvalidSettingError;
+      result = result * base + digit;
+    }
+    return result;
+  }
+
+  /**
+   * Setting as `yes`, `true`, `on` or `1`, or their opposites
+   */
+  Result<bool> flag(Key key) const {
+    auto value = tryUnwrap(text(key));
+    if (value == "yes" || value == "true" || value == "on" || value == "1")
+      return true;
+    if (value == "no" || value == "false" || value == "off" || value == "0")
+      return false;
+    return InvalidSettingError;
+  }
+
+  usize size() const { return count; }
+
+  usize dropped() const { return overflow; }
+};
+
+} // namespace kernel::environment
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace kernel::environment::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Settings are parsed from key=value lines");
+    {
+      const char text[] = "# comment\n"
+                          "// another one\n"
+                          "screen=800x600\r\n"
+                          "  cpus = 4 \n"
+                          "\n"
+                          "no equals sign\n"
+                          "test=yes\n"
+                          "test=no\n"
+                          "\0ignored=1\n";
+      Settings<8> settings;
+      settings.parse(text, sizeof(text));
+      Expect(settings.size() == 3);
+      Expect(*settings.text("screen") == "800x600");
+      Expect(*settings.integer("cpus") == 4);
+      Expect(*settings.flag("test") == false);
+      Expect(settings.text("ignored") == SettingNotFoundError);
+    }
+
+    test("Settings parse stops at the given size");
+    {
+      const char text[] = "a=1\nb=2\n";
+      Settings<8> settings;
+      settings.parse(text, 4);
+      Expect(settings.size() == 1);
+      Expect(settings.text("b") == SettingNotFoundError);
+    }
+
+    test("Integer settings");
+    {
+      const char text[] = "hex=0x1F\nbig=18446744073709551615\n"
+                          "over=18446744073709551616\nword=ten\nempty=\n";
+      Settings<8> settings;
+      settings.parse(text, sizeof(text));
+      Expect(*settings.integer("hex") == 0x1F);
+      Expect(*settings.integer("big") == ~0ULL);
+      Expect(settings.integer("over") == InvalidSettingError);
+      Expect(settings.integer("word") == InvalidSettingError);
+      Expect(settings.integer("empty") == InvalidSettingError);
+      Expect(settings.integer("missing") == SettingNotFoundError);
+    }
+
+    test("Flag settings");
+    {
+      const char text[] = "a=on\nb=0\nc=maybe\n";
+      Settings<8> settings;
+      settings.parse(text, sizeof(text));
+      Expect(*settings.flag("a") == true);
+      Expect(*settings.flag("b") == false);
+      Expect(settings.flag("c") == InvalidSettingError);
+    }
+
+    test("Settings past capacity are dropped");
+    {
+      const char text[] = "a=1\nb=2\nc=3\na=4\n";
+      Settings<2> settings;
+      settings.parse(text, sizeof(text));
+      Expect(settings.size() == 2 && settings.dropped() == 1);
+      Expect(*settings.integer("a") == 4);
+    }
+  }
+};
+
+} // namespace kernel::environment::tests
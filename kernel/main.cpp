@@ -4,12 +4,23 @@ import libpara.basic_types;
 import libpara.concepts;
 import libpara.formatting;
 import libpara.err;
+import libpara.time;
 
+import kernel.acpi;
+import kernel.cpu;
+import kernel.devices.framebuffer;
 import kernel.devices.serial;
 import kernel.pmm;
+import kernel.profile;
+import kernel.timeline;
+import kernel.timer;
+import kernel.trace;
 import kernel.platform;
 import kernel.platform.x86_64;
 import kernel.platform.x86_64.serial;
+#ifdef BENCHMARKS
+import kernel.bench;
+#endif
 
 using namespace libpara::basic_types;
 using namespace libpara::formatting;
@@ -20,62 +31,267 @@ using namespace libpara::err;
 export namespace kernel {
 
 class Processor {
+  using CPUInitialized = kernel::trace::Tracepoint<"cpu.initialized", u16>;
+
 protected:
   kernel::pmm::Allocator &allocator;
+  // timestamp at kernel entry
+  u64 entered = 0;
 
 public:
   constexpr Processor(kernel::pmm::Allocator &allocator)
       : allocator(allocator) {}
   virtual Result<nothing> run() = 0;
-  void start() {
+
+  /**
+   * Sets up the calling CPU once it has claimed its entry
+   */
+  Result<nothing> initialize(kernel::cpu::CPU &cpu) {
+    tryUnwrap(
+        kernel::platform::impl<kernel::platform::initialize>::function(cpu));
+    kernel::timeline::record(kernel::timeline::Milestone::PlatformInitialized,
+                             cpu.id);
+    tryUnwrap(kernel::trace::initialize(cpu));
+    tryUnwrap(kernel::profile::initialize(cpu, allocator));
+    CPUInitialized::record(cpu.index);
+    return nothing{};
+  }
+
+  /**
+   * Publishes the outcome of the calling CPU's setup
+   */
+  void settle(kernel::cpu::CPU &cpu, bool success) {
+    auto now = kernel::platform::impl<kernel::platform::timestamp>::function();
+    // the bootstrap CPU has already reported a CPU it gave up on
+    if (cpu.settle(success, now))
+      kernel::timeline::record(success ? kernel::timeline::Milestone::Online
+                                       : kernel::timeline::Milestone::Failed,
+                               cpu.id, now);
+  }
+
+  void start(u64 entered) {
+    this->entered = entered;
     tryCatch(run(), err, ({
                kernel::platform::impl<kernel::devices::SerialPort>::type serial;
                serial.initialize();
                format(
-                   serial, "Uncaught error: ", err.name, ", CPU #",
+                   serial, "Uncaught error: ", err.name(), ", CPU #",
                    kernel::platform::impl<kernel::platform::cpuid>::function(),
                    " terminated.\n");
+               serial.flush();
                kernel::platform::impl<kernel::platform::halt>::function();
                nothing{};
              }));
   }
 };
 
+/**
+ * Boot phases, in the order the bootstrap processor goes through them.
+ * Application processors only wait for the phases they depend on.
+ */
+enum class BootPhase : int {
+  Started = 0,
+  // per-CPU memory slices are reserved
+  MemoryReady = 1,
+  // serial console is initialized
+  ConsoleReady = 2,
+};
+
+/**
+ * How long the bootstrap CPU waits for others to come online, in timestamp
+ * units (about a second on current CPUs)
+ */
+const u64 SettleTimeout = 1ULL << 32;
+
+#ifndef RELEASE
+/**
+ * Periodic timer used to measure timer expiry jitter
+ */
+class TimerJitterProbe : public kernel::timer::Timer {
+  u32 remaining;
+
+public:
+  TimerJitterProbe(u64 period, u32 expirations)
+      : Timer(period), remaining(expirations) {}
+
+  virtual void expired() {
+    if (__atomic_sub_fetch(&remaining, 1, __ATOMIC_RELAXED) == 0)
+      kernel::platform::impl<kernel::platform::timer>::cancel(*this);
+  }
+
+  bool isDone() { return __atomic_load_n(&remaining, __ATOMIC_RELAXED) == 0; }
+};
+#endif
+
 class BootstrapProcessor : public Processor {
 
-  int initialized = false;
+  kernel::cpu::Table &cpus;
+  BootPhase phase = BootPhase::Started;
   u16 ncpus = 1;
+  u32 baud = kernel::platform::x86_64::serial::DefaultBaud;
+  const void *acpi = nullptr;
+  kernel::devices::framebuffer::Framebuffer framebuffer;
+  kernel::devices::framebuffer::Console screen;
+  // whether to run the benchmarks for the profiler once all CPUs are up
+  bool profiledBenchmarks = false;
 
 public:
-  constexpr BootstrapProcessor(kernel::pmm::Allocator &allocator)
-      : Processor(allocator) {}
+  constexpr BootstrapProcessor(kernel::pmm::Allocator &allocator,
+                               kernel::cpu::Table &cpus)
+      : Processor(allocator), cpus(cpus) {}
   BootstrapProcessor(BootstrapProcessor &) = delete;
 
-  void setNumCPUs(int n_cpus) { ncpus = n_cpus; }
+  void setNumCPUs(u16 n_cpus) { ncpus = n_cpus; }
+
+  void setBaud(u32 rate) { baud = rate; }
+
+  void setACPI(const void *tables) { acpi = tables; }
+
+  void setFramebuffer(kernel::devices::framebuffer::Framebuffer fb) {
+    framebuffer = fb;
+  }
+
+  void setProfiledBenchmarks(bool enabled) { profiledBenchmarks = enabled; }
 
   virtual Result<nothing> run() {
-    tryUnwrap(kernel::platform::impl<kernel::platform::initialize>::function(
-        this->allocator));
-    kernel::platform::impl<kernel::devices::SerialPort>::type serial;
+    tryUnwrap(cpus.reserve(this->allocator, ncpus));
+    advance(BootPhase::MemoryReady);
+
+    auto cpu = tryUnwrap(cpus.claim(
+        kernel::platform::impl<kernel::platform::cpuid>::function(), entered));
+    tryUnwrap(initialize(*cpu));
+    auto console_device =
+        kernel::platform::impl<kernel::platform::console>::select(
+            this->allocator);
+    kernel::platform::impl<kernel::devices::SerialPort>::type serial(baud);
     tryUnwrap(serial.initialize());
-    format(serial, "ParaOS\n");
-    format(serial, "Available memory: ",
+    kernel::timeline::record(kernel::timeline::Milestone::ConsoleReady,
+                             cpu->id);
+    advance(BootPhase::ConsoleReady);
+    settle(*cpu, true);
+
+    screen = tryCatch(kernel::devices::framebuffer::Console::create(
+                          framebuffer, this->allocator),
+                      err, kernel::devices::framebuffer::Console());
+    auto console = libpara::formatting::Tee(serial, screen);
+
+    format(console, "ParaOS\n");
+    format(console, "Available memory: ",
            this->allocator.availableMemory() / (1024 * 1024), "MB\n");
-    format(serial, "Number of CPUs: ", ncpus, "\n");
-    format(serial, "CPU #",
-           kernel::platform::impl<kernel::platform::cpuid>::function(),
-           " (BSP) ready\n");
+    format(console, "Number of CPUs: ", ncpus, "\n");
+    format(console, "Console: ", console_device, "\n");
+    if (screen.isPresent())
+      format(console, "Screen: ", screen.width(), "x", screen.height(),
+             " characters\n");
+    calibrateClock(console);
+
+    auto givenUp = cpus.waitUntilSettled(
+        kernel::platform::impl<kernel::platform::timestamp>::function() +
+            SettleTimeout,
+        kernel::platform::impl<kernel::platform::timestamp>::function);
+    report(console);
+    if (givenUp > 0)
+      format(console, "CPUs that never came online: ", givenUp, "\n");
+    if (serial.dropped() > 0)
+      format(console, "Serial output dropped: ", serial.dropped(), " bytes\n");
 
-    __atomic_store_n(&initialized, true, __ATOMIC_SEQ_CST);
-    kernel::platform::impl<kernel::platform::halt>::function();
+#ifndef RELEASE
+    probeTimerJitter(console, *cpu);
+#endif
+#ifdef BENCHMARKS
+    if constexpr (kernel::profile::Enabled)
+      if (profiledBenchmarks)
+        kernel::bench::profile(cpus, this->allocator);
+#endif
+
+    if constexpr (kernel::trace::Enabled)
+      kernel::trace::dump(serial, cpus);
+    if constexpr (kernel::profile::Enabled)
+      kernel::profile::dump(serial, cpus);
+
+    while (true)
+      kernel::platform::impl<kernel::platform::idle>::function();
     return nothing{};
   }
 
-  void waitUntilInitialized() {
-    while (!__atomic_load_n(&initialized, __ATOMIC_SEQ_CST)) {
+  kernel::cpu::Table &cpuTable() { return cpus; }
+
+  void waitFor(BootPhase awaited) {
+    while (static_cast<int>(__atomic_load_n(&phase, __ATOMIC_ACQUIRE)) <
+           static_cast<int>(awaited)) {
       __builtin_ia32_pause();
     }
   }
+
+private:
+  void advance(BootPhase next) {
+    __atomic_store_n(&phase, next, __ATOMIC_RELEASE);
+  }
+
+  template <libpara::formatting::writer W> void calibrateClock(W &serial) {
+    auto tables = tryCatch(kernel::acpi::Tables::from(acpi), err,
+                           kernel::acpi::Tables());
+    auto calibrated =
+        kernel::platform::impl<kernel::platform::clock>::calibrate(tables);
+    if (!calibrated.success()) {
+      format(serial, "Clock calibration failed: ", calibrated.error().name(),
+             "\n");
+      return;
+    }
+    auto &calibration = *calibrated;
+    libpara::time::clock.calibrate(calibration);
+    format(serial, "Clock: ", calibration.frequency / 1000000, " MHz (",
+           calibration.reference, "), ",
+           calibration.invariant ? "invariant" : "non-invariant", " TSC\n");
+  }
+
+  /**
+   * Formats a (possibly negative) cycle count, in microseconds if the clock
+   * is calibrated
+   */
+  template <libpara::formatting::writer W>
+  void formatCycles(W &serial, i64 cycles) {
+    if (!libpara::time::clock.isCalibrated()) {
+      format(serial, cycles, " cycles");
+      return;
+    }
+    auto magnitude = static_cast<u64>(cycles < 0 ? -cycles : cycles);
+    format(serial, cycles < 0 ? "-" : "",
+           libpara::time::clock.nanoseconds(magnitude) / 1000, " us");
+  }
+
+  /**
+   * Reports how the boot went on every CPU
+   */
+  template <libpara::formatting::writer W> void report(W &serial) {
+    kernel::timeline::dump(serial);
+#ifndef RELEASE
+    format(serial, "Maximum TSC warp between CPUs: ",
+           kernel::platform::impl<kernel::platform::clock>::observedWarp(),
+           " cycles\n");
+#endif
+  }
+
+#ifndef RELEASE
+  template <libpara::formatting::writer W>
+  void probeTimerJitter(W &serial, kernel::cpu::CPU &cpu) {
+    const u64 period = 1 << 20;
+    auto probe = TimerJitterProbe(period, 32);
+    kernel::platform::impl<kernel::platform::timer>::add(
+        probe,
+        kernel::platform::impl<kernel::platform::timestamp>::function() +
+            period);
+    while (!probe.isDone())
+      kernel::platform::impl<kernel::platform::idle>::function();
+
+    auto &stats = cpu.timers->stats();
+    format(serial, "Timer jitter: ", stats.expired, " expirations, mean ");
+    formatCycles(serial, stats.total_lateness / stats.expired);
+    format(serial, ", max ");
+    formatCycles(serial, stats.max_lateness);
+    format(serial, "\n");
+  }
+#endif
 };
 
 class ApplicationProcessor : public Processor {
@@ -88,16 +304,30 @@ public:
       : Processor(allocator), bsp(bsp) {}
 
   virtual Result<nothing> run() {
-    bsp.waitUntilInitialized();
-    kernel::platform::impl<kernel::devices::SerialPort>::type serial;
-    tryUnwrap(serial.initialize());
+    bsp.waitFor(BootPhase::MemoryReady);
+    auto claimed = bsp.cpuTable().claim(
+        kernel::platform::impl<kernel::platform::cpuid>::function(), entered);
+    // CPUs past the number the BSP brings up, or that came too late for it,
+    // stay halted
+    if (claimed == kernel::cpu::TooManyCPUsError ||
+        claimed == kernel::cpu::GivenUpOnError)
+      kernel::platform::impl<kernel::platform::halt>::function();
+    auto cpu = tryUnwrap(claimed);
+
+    auto initialized = initialize(*cpu);
+    settle(*cpu, initialized.success());
+    if (!initialized.success())
+      // let the BSP bring up the console before reporting the error
+      bsp.waitFor(BootPhase::ConsoleReady);
+    tryUnwrap(initialized);
+
+    // the first AP idles with interrupts enabled, so it drives sampling
+    if constexpr (kernel::profile::Enabled)
+      if (cpu->index == 1)
+        kernel::platform::impl<kernel::platform::profiler>::start();
 
-    tryUnwrap(kernel::platform::impl<kernel::platform::initialize>::function(
-        this->allocator));
-    format(serial, "CPU #",
-           kernel::platform::impl<kernel::platform::cpuid>::function(),
-           " ready\n");
-    kernel::platform::impl<kernel::platform::halt>::function();
+    while (true)
+      kernel::platform::impl<kernel::platform::idle>::function();
     return nothing{};
   }
 };
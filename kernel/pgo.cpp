@@ -0,0 +1,81 @@
+export module kernel.pgo;
+
+import libpara.basic_types;
+import libpara.formatting;
+
+using namespace libpara::basic_types;
+
+// Bounds of the sections instrumented code keeps its profile in, as placed
+// by bootboot.ld (empty unless instrumented)
+extern "C" const u8 __start___llvm_prf_data[];
+extern "C" const u8 __stop___llvm_prf_data[];
+extern "C" const u8 __start___llvm_prf_cnts[];
+extern "C" const u8 __stop___llvm_prf_cnts[];
+extern "C" const u8 __start___llvm_prf_bits[];
+extern "C" const u8 __stop___llvm_prf_bits[];
+extern "C" const u8 __start___llvm_prf_names[];
+extern "C" const u8 __stop___llvm_prf_names[];
+// version and variant of the profile format, emitted by the compiler
+extern "C" const u64 __llvm_profile_raw_version;
+
+#ifdef PGO_INSTRUMENT
+// Instrumented code pulls the profiling runtime in through these. The
+// kernel has none: section bounds come from the linker script, and the
+// profile is written out by `dump`.
+extern "C" {
+int __llvm_profile_runtime = 0;
+void __llvm_profile_register_function(void *) {}
+void __llvm_profile_register_names_function(void *, u64) {}
+}
+#endif
+
+export namespace kernel::pgo {
+
+/**
+ * Whether the kernel counts executions for profile-guided optimization, as
+ * built with `make PGO=instrument`
+ */
+#ifdef PGO_INSTRUMENT
+constexpr bool Enabled = true;
+#else
+constexpr bool Enabled = false;
+#endif
+
+/**
+ * Writes the profile for `tools/pgo-collect.py`, which turns it into a raw
+ * profile for `llvm-profdata`: a `pgo: begin` line with the format version,
+ * then every section's name, address and size followed by its contents in
+ * hexadecimal, and `pgo: end`
+ */
+template <libpara::formatting::writer W> void dump(W &writer) {
+  if constexpr (Enabled) {
+    using libpara::formatting::format;
+    using libpara::formatting::hex;
+    format(writer, "pgo: begin ", hex(__llvm_profile_raw_version), "\n");
+    struct {
+      const char *name;
+      const u8 *start;
+      const u8 *stop;
+    } sections[] = {
+        {"data", __start___llvm_prf_data, __stop___llvm_prf_data},
+        {"counters", __start___llvm_prf_cnts, __stop___llvm_prf_cnts},
+        {"bitmap", __start___llvm_prf_bits, __stop___llvm_prf_bits},
+        {"names", __start___llvm_prf_names, __stop___llvm_prf_names},
+    };
+    const usize BytesPerLine = 32;
+    for (auto &section : sections) {
+      auto size = static_cast<usize>(section.stop - section.start);
+      format(writer, "pgo: section ", section.name, " ",
+             hex(reinterpret_cast<usize>(section.start)), " ", size, "\n");
+      for (usize line = 0; line < size; line += BytesPerLine) {
+        format(writer, "pgo: ");
+        for (usize i = line; i < size && i < line + BytesPerLine; i++)
+          format(writer, hex(section.start[i], 2));
+        format(writer, "\n");
+      }
+    }
+    format(writer, "pgo: end\n");
+  }
+}
+
+} // namespace kernel::pgo
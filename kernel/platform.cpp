@@ -13,6 +13,11 @@ concept Platform = requires(T) {
 
 struct X86_64 {};
 
+/**
+ * A Linux process, with threads for CPUs (see `hosted.platform`)
+ */
+struct Hosted {};
+
 #ifndef PARAOS_TARGET
 #define PARAOS_TARGET X86_64
 #endif
@@ -31,6 +36,42 @@ struct initialize {};
  */
 struct cpuid {};
 
+/**
+ * Reads current CPU's cycle counter
+ */
+struct timestamp {};
+
+/**
+ * Calibrates the cycle counter used by timestamps
+ */
+struct clock {};
+
+/**
+ * Gets current CPU's entry in the CPU table (only after initialization)
+ */
+struct current_cpu {};
+
+/**
+ * Picks the device `impl<kernel::devices::SerialPort>` writes to
+ */
+struct console {};
+
+/**
+ * Per-CPU timers
+ */
+struct timer {};
+
+/**
+ * Periodically interrupts CPUs to sample what they are running (see
+ * `kernel.profile`)
+ */
+struct profiler {};
+
+/**
+ * Waits for the next interrupt
+ */
+struct idle {};
+
 /**
  * Halts the CPU
  */
@@ -2,11 +2,18 @@ export module kernel.platform.x86_64;
 
 import libpara.basic_types;
 import libpara.err;
+import libpara.time;
 
+import kernel.cpu;
 import kernel.platform;
-import kernel.pmm;
+import kernel.acpi;
+import kernel.timer;
+import kernel.platform.x86_64.clock;
+import kernel.platform.x86_64.cpu;
 import kernel.platform.x86_64.init;
 import kernel.platform.x86_64.panic;
+import kernel.platform.x86_64.profile;
+import kernel.platform.x86_64.timer;
 export import kernel.platform.x86_64.serial;
 
 using namespace libpara::basic_types;
@@ -17,8 +24,8 @@ using namespace libpara::err;
 export namespace kernel::platform {
 
 template <> struct impl<initialize, X86_64> {
-  static Result<nothing> function(kernel::pmm::Allocator &allocator) {
-    return tryUnwrap(x86_64::initialize(allocator));
+  static Result<nothing> function(kernel::cpu::CPU &cpu) {
+    return tryUnwrap(x86_64::initialize(cpu));
   }
 };
 
@@ -30,6 +37,61 @@ template <> struct impl<cpuid, X86_64> {
   }
 };
 
+template <> struct impl<timestamp, X86_64> {
+  static u64 function() { return libpara::time::rdtsc(); }
+};
+
+template <> struct impl<clock, X86_64> {
+  static Result<libpara::time::Calibration>
+  calibrate(const kernel::acpi::Tables &acpi) {
+    return x86_64::clock::calibrate(acpi);
+  }
+
+  /**
+   * Largest clock difference observed between CPUs
+   */
+  static u64 observedWarp() { return x86_64::clock::observedWarp(); }
+};
+
+template <> struct impl<current_cpu, X86_64> {
+  static kernel::cpu::CPU *function() { return x86_64::currentCPU(); }
+};
+
+template <> struct impl<timer, X86_64> {
+  /**
+   * Arms `timer` on current CPU to expire at `deadline` (in timestamp units)
+   */
+  static void add(kernel::timer::Timer &timer, u64 deadline) {
+    x86_64::timer::add(timer, deadline);
+  }
+
+  /**
+   * Cancels `timer`, which must have been armed on current CPU
+   */
+  static void cancel(kernel::timer::Timer &timer) {
+    x86_64::timer::cancel(timer);
+  }
+};
+
+template <> struct impl<profiler, X86_64> {
+  /**
+   * Starts sampling all other CPUs with NMIs, driven by current CPU's timer
+   */
+  static void start() { x86_64::profile::start(); }
+};
+
+template <> struct impl<idle, X86_64> {
+  // `sti` only takes effect after `hlt`, so no interrupt can be missed.
+  // Interrupts taken here go through the common entry, which leaves vector
+  // registers to the interrupted code to save.
+  static void function() {
+    asm volatile("sti ; hlt ; cli" ::
+                     : "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+                       "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11",
+                       "xmm12", "xmm13", "xmm14", "xmm15");
+  }
+};
+
 template <> struct impl<halt, X86_64> {
   static void function() { asm("cli ; hlt"); }
 };
@@ -0,0 +1,160 @@
+export module kernel.platform.x86_64.clock;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.sync;
+import libpara.time;
+
+import kernel.acpi;
+import kernel.platform.x86_64.cpu;
+import kernel.platform.x86_64.port;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+using namespace libpara::time;
+
+#include <err.hpp>
+
+using namespace kernel::platform::x86_64;
+
+// Calibration measures the TSC over this much of the reference clock's time
+const u64 CalibrationMicroseconds = 10000;
+
+const u64 PMTimerHz = 3579545;
+
+/**
+ * Measures the TSC frequency against a reference counter ticking at
+ * `reference_hz`, `mask` being the counter's width
+ */
+template <typename Read> u64 measure(Read read, u64 reference_hz, u64 mask) {
+  auto target = reference_hz * CalibrationMicroseconds / 1000000;
+  // start right at a reference counter edge
+  auto edge = read();
+  u64 start;
+  while ((start = read()) == edge) {
+  }
+  auto started = cyclesBegin();
+  u64 end;
+  while ((((end = read()) - start) & mask) < target) {
+    __builtin_ia32_pause();
+  }
+  auto elapsed = cyclesEnd() - started;
+  return Conversion::between((end - start) & mask, reference_hz)(elapsed);
+}
+
+// TSC synchronization check state, shared by all CPUs
+constinit libpara::sync::Lock warpLock;
+constinit u64 lastTimestamp = 0;
+constinit u64 maxWarp = 0;
+
+export namespace kernel::platform::x86_64::clock {
+
+const auto NoClockReferenceError = "NoClockReference"_error;
+const auto InvalidHPETError = "InvalidHPET"_error;
+
+Result<Calibration> againstHPET(const kernel::acpi::Tables &acpi) {
+  auto hpet = tryUnwrap(acpi.find<kernel::acpi::HPET>("HPET"));
+  if (hpet->address.space != kernel::acpi::GenericAddress::SystemMemory)
+    return InvalidHPETError;
+  auto registers = reinterpret_cast<volatile u64 *>(hpet->address.address);
+  const auto capabilities = 0x00 / sizeof(u64);
+  const auto configuration = 0x10 / sizeof(u64);
+  const auto counter = 0xF0 / sizeof(u64);
+
+  u64 period = registers[capabilities] >> 32; // in femtoseconds
+  if (period == 0 || period > 100000000)
+    return InvalidHPETError;
+  bool wide = (registers[capabilities] & (1 << 13)) != 0;
+  registers[configuration] = registers[configuration] | 1;
+
+  return Calibration{
+      .frequency = measure([&] { return registers[counter]; },
+                           1000000000000000ULL / period,
+                           wide ? ~0ULL : 0xFFFFFFFFULL),
+      .reference = "HPET",
+      .invariant = hasInvariantTSC()};
+}
+
+Result<Calibration> againstPMTimer(const kernel::acpi::Tables &acpi) {
+  auto fadt = tryUnwrap(acpi.find<kernel::acpi::FADT>("FACP"));
+  u64 address = fadt->pm_timer_block;
+  if (fadt->header.length >= sizeof(kernel::acpi::FADT) &&
+      fadt->x_pm_timer_block.space == kernel::acpi::GenericAddress::SystemIO &&
+      fadt->x_pm_timer_block.address != 0)
+    address = fadt->x_pm_timer_block.address;
+  if (address == 0)
+    return NoClockReferenceError;
+
+  auto port = Port(static_cast<u16>(address));
+  u64 mask = (fadt->flags & kernel::acpi::FADT::TimerValueExtended)
+                 ? 0xFFFFFFFF
+                 : 0xFFFFFF;
+  return Calibration{
+      .frequency = measure([&] { return port.in32(0) & mask; }, PMTimerHz,
+                           mask),
+      .reference = "ACPI PM timer",
+      .invariant = hasInvariantTSC()};
+}
+
+/**
+ * Takes the TSC frequency from what the CPU reports about itself
+ */
+Result<Calibration> fromCPUID() {
+  auto max = cpuid(0).eax;
+  if (max >= 0x15) {
+    auto tsc = cpuid(0x15);
+    if (tsc.eax != 0 && tsc.ebx != 0 && tsc.ecx != 0)
+      return Calibration{.frequency =
+                             static_cast<u64>(tsc.ecx) * tsc.ebx / tsc.eax,
+                         .reference = "CPUID crystal clock",
+                         .invariant = hasInvariantTSC()};
+  }
+  if (max >= 0x16) {
+    auto base = cpuid(0x16).eax & 0xFFFF;
+    if (base != 0)
+      return Calibration{.frequency = base * 1000000ULL,
+                         .reference = "CPUID base frequency",
+                         .invariant = hasInvariantTSC()};
+  }
+  return NoClockReferenceError;
+}
+
+/**
+ * Determines TSC frequency, preferring HPET, then ACPI PM timer and then
+ * the frequency reported by the CPU itself
+ */
+Result<Calibration> calibrate(const kernel::acpi::Tables &acpi) {
+  auto hpet = againstHPET(acpi);
+  if (hpet.success())
+    return hpet;
+  auto pm_timer = againstPMTimer(acpi);
+  if (pm_timer.success())
+    return pm_timer;
+  return fromCPUID();
+}
+
+/**
+ * Checks TSC synchronization against all other CPUs checking it at the same
+ * time: CPUs take turns recording timestamps, which must never go backwards
+ */
+void checkSync(u64 duration) {
+  auto end = rdtsc() + duration;
+  while (true) {
+    warpLock.lock();
+    auto previous = lastTimestamp;
+    auto now = cyclesBegin();
+    lastTimestamp = now;
+    if (previous > now && previous - now > maxWarp)
+      maxWarp = previous - now;
+    warpLock.unlock();
+    if (now > end)
+      break;
+  }
+}
+
+/**
+ * Largest backwards TSC jump observed between CPUs by `checkSync()`
+ */
+u64 observedWarp() { return __atomic_load_n(&maxWarp, __ATOMIC_ACQUIRE); }
+
+} // namespace kernel::platform::x86_64::clock
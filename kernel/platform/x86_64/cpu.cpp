@@ -0,0 +1,77 @@
+export module kernel.platform.x86_64.cpu;
+
+import libpara.basic_types;
+
+import kernel.cpu;
+
+using namespace libpara::basic_types;
+
+export namespace kernel::platform::x86_64 {
+
+struct CPUID {
+  u32 eax, ebx, ecx, edx;
+};
+
+inline CPUID cpuid(u32 leaf, u32 subleaf = 0) {
+  CPUID r;
+  asm volatile("cpuid"
+               : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx)
+               : "a"(leaf), "c"(subleaf));
+  return r;
+}
+
+enum MSR : u32 {
+  APICBase = 0x1B,
+  TSCDeadline = 0x6E0,
+  GSBase = 0xC0000101,
+};
+
+inline u64 readMSR(MSR msr) {
+  u32 lo, hi;
+  asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return static_cast<u64>(hi) << 32 | lo;
+}
+
+inline void writeMSR(MSR msr, u64 value) {
+  asm volatile("wrmsr" ::"a"(static_cast<u32>(value)),
+               "d"(static_cast<u32>(value >> 32)), "c"(msr));
+}
+
+/**
+ * Whether the local APIC timer supports TSC-deadline mode
+ */
+inline bool hasTSCDeadline() { return (cpuid(1).ecx & (1 << 24)) != 0; }
+
+/**
+ * Whether the TSC ticks at a constant rate in all ACPI P-, C- and T-states
+ */
+inline bool hasInvariantTSC() {
+  return cpuid(0x80000000).eax >= 0x80000007 &&
+         (cpuid(0x80000007).edx & (1 << 8)) != 0;
+}
+
+/**
+ * Gets current CPU's entry, which GS base points to
+ */
+inline kernel::cpu::CPU *currentCPU() {
+  kernel::cpu::CPU *cpu;
+  asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+  return cpu;
+}
+
+/**
+ * Disables interrupts for the lifetime of the guard, restoring the previous
+ * interrupt flag afterwards
+ */
+class InterruptGuard {
+  u64 flags;
+
+public:
+  InterruptGuard() { asm volatile("pushfq ; pop %0 ; cli" : "=r"(flags)); }
+  ~InterruptGuard() {
+    if (flags & (1 << 9))
+      asm volatile("sti");
+  }
+};
+
+} // namespace kernel::platform::x86_64
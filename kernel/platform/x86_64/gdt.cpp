@@ -12,7 +12,7 @@ enum Flag : u8 {
   LongMode = 1 << 1,
 };
 
-Flag operator|(Flag a, Flag b) {
+constexpr Flag operator|(Flag a, Flag b) {
   return static_cast<Flag>(static_cast<u8>(a) | static_cast<u8>(b));
 }
 
@@ -30,9 +30,10 @@ enum Access : u8 {
   CodeReadable = 1 << 1,
   DataWritable = 1 << 1,
   Accessed = 1,
+  AvailableTSS = 0x9,
 };
 
-Access operator|(Access a, Access b) {
+constexpr Access operator|(Access a, Access b) {
   return static_cast<Access>(static_cast<u8>(a) | static_cast<u8>(b));
 }
 
@@ -44,33 +45,71 @@ class Segment {
   u8 segment[8] = {0}; // 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
 public:
-  Segment() { setAccess(NotPresent); }
-  Segment(Access access) { setAccess(access | Present); }
-  Segment(Flag flags, Access access) {
+  constexpr Segment() { setAccess(NotPresent); }
+  constexpr Segment(Access access) { setAccess(access | Present); }
+  constexpr Segment(Flag flags, Access access) {
     setFlags(flags);
     setAccess(access | Present);
   }
 
-  void setFlags(Flag flags) {
-    *reinterpret_cast<u8 *>(segment + header_flags) = flags << 4;
-  }
+  constexpr void setFlags(Flag flags) { segment[header_flags] = flags << 4; }
+
+  constexpr void setAccess(Access access) { segment[header_access] = access; }
 
-  void setAccess(Access access) {
-    *reinterpret_cast<Access *>(segment + header_access) = access;
+  constexpr const Access getAccess() const {
+    return static_cast<Access>(segment[header_access]);
   }
+};
 
-  const Access getAccess() const {
-    return *reinterpret_cast<const Access *>(segment + header_access);
+/**
+ * 64-bit Task State Segment
+ */
+struct TaskStateSegment {
+  u32 reserved0 = 0;
+  // stack pointers for privilege levels 0-2
+  u64 rsp[3] = {0};
+  u64 reserved1 = 0;
+  // interrupt stack table, IST1 through IST7
+  u64 ist[7] = {0};
+  u64 reserved2 = 0;
+  u16 reserved3 = 0;
+  u16 iomap_base = sizeof(TaskStateSegment);
+} __attribute__((packed));
+
+/**
+ * 16-byte system segment descriptor (used for the TSS in long mode)
+ */
+class SystemSegment {
+  u8 segment[16] = {0};
+
+public:
+  constexpr SystemSegment() {}
+
+  void setTSS(const TaskStateSegment *tss) {
+    u64 base = reinterpret_cast<u64>(tss);
+    u32 limit = sizeof(TaskStateSegment) - 1;
+    segment[0] = static_cast<u8>(limit);
+    segment[1] = static_cast<u8>(limit >> 8);
+    segment[6] = static_cast<u8>((limit >> 16) & 0x0f);
+    segment[2] = static_cast<u8>(base);
+    segment[3] = static_cast<u8>(base >> 8);
+    segment[4] = static_cast<u8>(base >> 16);
+    segment[7] = static_cast<u8>(base >> 24);
+    *reinterpret_cast<u32 *>(segment + 8) = static_cast<u32>(base >> 32);
+    segment[5] = Present | AvailableTSS;
   }
 };
 
-template <u16 n_segments> struct Register {
-  u16 size = (1 + n_segments) * sizeof(Segment) - 1;
-  Segment *offset = &null_segment;
+/**
+ * Global Descriptor Table: a null segment, `n_segments` code/data segments
+ * followed by `n_system_segments` system segments
+ */
+template <u16 n_segments, u16 n_system_segments = 0> struct Register {
   Segment null_segment = Segment();
   Segment segments[n_segments];
+  SystemSegment system_segments[n_system_segments];
 
-  inline u16 kernelCodeSegment() const {
+  constexpr u16 kernelCodeSegment() const {
     for (u16 i = 0; i < n_segments; i++) {
       if ((segments[i].getAccess() & (Privilege0 | Code)) ==
           (Privilege0 | Code))
@@ -79,7 +118,7 @@ template <u16 n_segments> struct Register {
     return 0;
   }
 
-  inline u16 kernelDataSegment() const {
+  constexpr u16 kernelDataSegment() const {
     for (u16 i = 0; i < n_segments; i++) {
       if ((segments[i].getAccess() & (Privilege0 | Code)) ==
           (Privilege0 | Code))
@@ -92,8 +131,17 @@ template <u16 n_segments> struct Register {
     return 0;
   }
 
-  void load() {
-    asm volatile("lgdt %0" ::"m"(*this));
+  constexpr u16 systemSegment(u16 index) const {
+    return (1 + n_segments) * sizeof(Segment) + index * sizeof(SystemSegment);
+  }
+
+  void load() const {
+    struct {
+      u16 size;
+      const Register *offset;
+    } __attribute__((packed)) descriptor = {sizeof(Register) - 1, this};
+
+    asm volatile("lgdt %0" ::"m"(descriptor));
 
     const u64 ds = kernelDataSegment();
     const u64 cs = kernelCodeSegment();
@@ -108,8 +156,13 @@ template <u16 n_segments> struct Register {
                  : "rax");
   }
 
-} __attribute__((packed));
+  void loadTaskRegister(u16 index) const {
+    asm volatile("ltr %0" ::"r"(systemSegment(index)));
+  }
+};
 
 } // namespace kernel::platform::x86_64::gdt
 
 static_assert(sizeof(kernel::platform::x86_64::gdt::Segment) == 8);
+static_assert(sizeof(kernel::platform::x86_64::gdt::SystemSegment) == 16);
+static_assert(sizeof(kernel::platform::x86_64::gdt::TaskStateSegment) == 104);
@@ -8,6 +8,49 @@ export namespace kernel::platform::x86_64::idt {
 
 enum GateType : u8 { Interrupt = 0x0E, Trap = 0x0F };
 
+/**
+ * Frame pushed by the CPU on interrupt entry
+ */
+struct InterruptFrame {
+  usize ip;
+  usize cs;
+  usize flags;
+  usize sp;
+  usize ss;
+};
+
+/**
+ * Registers saved by the common interrupt entry, in stack order: the
+ * caller-saved registers, the vector number, the error code (zero for
+ * vectors the CPU pushes none for) and the CPU's frame. Handlers preserve
+ * all other registers, as ordinary functions do.
+ */
+struct Context {
+  usize r11, r10, r9, r8, rdi, rsi, rdx, rcx, rax;
+  usize vector;
+  usize error_code;
+  InterruptFrame frame;
+};
+
+/**
+ * Location of an IDT as loaded by `lidt`
+ */
+struct Location {
+  u16 size;
+  const void *offset;
+
+  /**
+   * Location of current CPU's IDT
+   */
+  static Location current() {
+    Location location;
+    asm volatile("sidt %0" : "=m"(location));
+    return location;
+  }
+
+  void load() const { asm volatile("lidt %0" ::"m"(*this)); }
+} __attribute__((packed));
+
 class Gate {
   static const auto header_offset_low = 0;
   static const auto header_offset_mid = 6;
@@ -19,16 +62,25 @@ class Gate {
   u8 descriptor[16] = {0};
 
 public:
-  Gate() { setPresent(false); }
+  constexpr Gate() { setPresent(false); }
 
-  Gate(void *ptr, u16 segment, GateType type, u8 dpl = 0, u8 ist = 0) {
-    setPointer(ptr);
+  /**
+   * Constructs a gate with everything but the handler pointer, which can't
+   * be split into the descriptor's offset fields at compile time
+   */
+  constexpr Gate(u16 segment, GateType type, u8 dpl = 0, u8 ist = 0) {
     setSegment(segment);
     setType(type);
     setDPL(dpl);
+    setIST(ist);
     setPresent(true);
   }
 
+  Gate(void *ptr, u16 segment, GateType type, u8 dpl = 0, u8 ist = 0)
+      : Gate(segment, type, dpl, ist) {
+    setPointer(ptr);
+  }
+
   void setPointer(void *ptr) {
     u64 offset = reinterpret_cast<u64>(ptr);
     *reinterpret_cast<u16 *>(descriptor + header_offset_low) =
@@ -39,34 +91,35 @@ public:
         static_cast<u32>(offset >> 32);
   }
 
-  void setSegment(u16 segment) {
-    *reinterpret_cast<u16 *>(descriptor + header_segment) = segment;
+  constexpr void setSegment(u16 segment) {
+    descriptor[header_segment] = static_cast<u8>(segment);
+    descriptor[header_segment + 1] = static_cast<u8>(segment >> 8);
   }
 
-  void setType(GateType type) {
-    auto attrs = reinterpret_cast<u8 *>(descriptor + header_attrs);
-    *attrs = *attrs | (type & 0x0f);
+  constexpr void setType(GateType type) {
+    descriptor[header_attrs] = descriptor[header_attrs] | (type & 0x0f);
   }
 
-  void setDPL(u8 dpl) {
-    auto attrs = reinterpret_cast<u8 *>(descriptor + header_attrs);
-    *attrs = *attrs | (dpl & 0x0f) << 4;
+  constexpr void setDPL(u8 dpl) {
+    descriptor[header_attrs] = descriptor[header_attrs] | (dpl & 0x03) << 5;
   }
 
-  void setPresent(bool present) {
-    auto attrs = reinterpret_cast<u8 *>(descriptor + header_attrs);
-    *attrs = *attrs | (present ? 1 : 0) << 7;
+  constexpr void setIST(u8 ist) { descriptor[header_ist] = ist & 0x07; }
+
+  constexpr void setPresent(bool present) {
+    descriptor[header_attrs] =
+        descriptor[header_attrs] | (present ? 1 : 0) << 7;
   }
 };
 
 template <int n = 256> struct Register {
-  u16 size = n * sizeof(Gate) - 1;
-  Gate *offset = gates;
   Gate gates[n] = {Gate()};
 
-  void load() { asm volatile("lidt %0" ::"m"(*this)); }
-} __attribute__((packed));
+  void load() const { Location{n * sizeof(Gate) - 1, gates}.load(); }
+};
 
 } // namespace kernel::platform::x86_64::idt
 
 static_assert(sizeof(kernel::platform::x86_64::idt::Gate) == 16);
+static_assert(sizeof(kernel::platform::x86_64::idt::Context) == 16 * 8);
+static_assert(sizeof(kernel::platform::x86_64::idt::Location) == 10);
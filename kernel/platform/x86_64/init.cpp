@@ -3,11 +3,22 @@ export module kernel.platform.x86_64.init;
 import libpara.err;
 import libpara.basic_types;
 import libpara.loop;
+import libpara.sync;
 
+import kernel.cpu;
 import kernel.pmm;
+import kernel.profile;
+import kernel.platform.x86_64.clock;
+import kernel.platform.x86_64.cpu;
+import kernel.platform.x86_64.interrupts;
+import kernel.platform.x86_64.memory;
 import kernel.platform.x86_64.panic;
+import kernel.platform.x86_64.port;
+import kernel.platform.x86_64.profile;
+import kernel.platform.x86_64.serial;
 import kernel.platform.x86_64.gdt;
 import kernel.platform.x86_64.idt;
+import kernel.platform.x86_64.timer;
 
 using namespace libpara::err;
 using namespace libpara::basic_types;
@@ -15,32 +26,118 @@ using namespace libpara::loop;
 
 #include <err.hpp>
 
+using namespace kernel::platform::x86_64;
+
+using GdtRegister = gdt::Register<2, kernel::cpu::MaxCPUs>;
+
+constexpr GdtRegister gdtImage = {
+    .segments = {
+        gdt::Segment(gdt::LongMode, gdt::Code | gdt::Privilege0),
+        gdt::Segment(gdt::Data | gdt::DataWritable),
+    }};
+
+constexpr u16 kernelCodeSegment = gdtImage.kernelCodeSegment();
+
+/**
+ * Interrupt stack table slots
+ */
+enum IST : u8 {
+  NoIST = 0,
+  DoubleFaultIST = 1,
+  NMIIST = 2,
+  MachineCheckIST = 3,
+};
+
+const usize ISTStackSize = 4096;
+
+#ifndef RELEASE
+// How long every CPU checks its TSC against other CPUs. Release builds
+// don't, as it adds to every CPU's bring-up.
+const u64 SyncCheckCycles = 1 << 20;
+#endif
+
+consteval idt::Register<> interruptGates() {
+  idt::Register<> idt;
+  for (u16 i = 0; i < 256; i++) {
+    auto ist = i == 0x02   ? NMIIST
+               : i == 0x08 ? DoubleFaultIST
+               : i == 0x12 ? MachineCheckIST
+                           : NoIST;
+    idt.gates[i] = idt::Gate(kernelCodeSegment,
+                             i < 32 ? idt::Trap : idt::Interrupt, 0, ist);
+  }
+  return idt;
+}
+
+// Shared by all CPUs. Every CPU only fills in its own TSS descriptor.
+alignas(16) constinit GdtRegister sharedGdt = gdtImage;
+
+// Shared by all CPUs. Entry pointers are filled in once, by the first CPU to
+// get here.
+alignas(16) constinit idt::Register<> sharedIdt = interruptGates();
+constinit libpara::sync::Once sharedIdtReady;
+
+constinit libpara::sync::Once legacyPICMasked;
+
+// CPUs are assumed to all have the features of the first one to get here.
+// Every CPU enables AVX for itself before the plan may take AVX2 on it.
+constinit libpara::sync::Once memoryRoutinesSelected;
+
 export namespace kernel::platform::x86_64 {
 
-Result<nothing> initialize(kernel::pmm::Allocator &allocator) {
-  using GdtRegister = gdt::Register<2>;
-  auto gdtrAlloc =
-      tryUnwrap(allocator.allocate(sizeof(GdtRegister), alignof(GdtRegister)));
-  auto gdtr = new (gdtrAlloc)
-      GdtRegister{.segments = {
-                      gdt::Segment(gdt::LongMode, gdt::Code | gdt::Privilege0),
-                      gdt::Segment(gdt::Data | gdt::DataWritable),
-                  }};
-
-  gdtr->load();
-
-  auto idtrAlloc = tryUnwrap(
-      allocator.allocate(sizeof(idt::Register<>), alignof(idt::Register<>)));
-  auto idtr = new (idtrAlloc) idt::Register{};
-
-  constexpr_loop<u64, 30>([&]<u64 i>() {
-    new (reinterpret_cast<void *>(idtr->gates + i))
-        idt::Gate(reinterpret_cast<void *>(
-                      kernel::platform::x86_64::panic::panic_isr<i>::isr),
-                  gdtr->kernelCodeSegment(), idt::Trap);
+Result<nothing> initialize(kernel::cpu::CPU &cpu) {
+  memory::enableAVX();
+  memoryRoutinesSelected.call([] { memory::select(); });
+
+  auto tss = new (tryUnwrap(
+      kernel::pmm::allocate<gdt::TaskStateSegment>(cpu.allocator, 16)))
+      gdt::TaskStateSegment{};
+  const IST ists[] = {DoubleFaultIST, NMIIST, MachineCheckIST};
+  for (auto ist : ists) {
+    auto stack = reinterpret_cast<usize>(
+        tryUnwrap(cpu.allocator.allocate(ISTStackSize, 16)));
+    tss->ist[ist - 1] = stack + ISTStackSize;
+  }
+  sharedGdt.system_segments[cpu.index].setTSS(tss);
+
+  sharedGdt.load();
+  sharedGdt.loadTaskRegister(cpu.index);
+  // loading segments has reset GS base
+  writeMSR(MSR::GSBase, reinterpret_cast<u64>(&cpu));
+
+  sharedIdtReady.call([] {
+    constexpr_loop<u64, 256>([]<u64 i>() {
+      sharedIdt.gates[i].setPointer(
+          reinterpret_cast<void *>(interrupts::entry<i>::stub));
+    });
+    constexpr_loop<u64, 32>([]<u64 i>() {
+      interrupts::set(i, panic::panic_handler<i>::handle);
+    });
+    interrupts::set(serial::SerialVector, serial::serialInterrupt);
+
+    // frequent interrupts take fast paths, bypassing the common entry
+    if constexpr (kernel::profile::Enabled)
+      sharedIdt.gates[0x02].setPointer(
+          reinterpret_cast<void *>(profile::nmiISR));
+    sharedIdt.gates[timer::TimerVector].setPointer(
+        reinterpret_cast<void *>(timer::timerISR));
+    sharedIdt.gates[timer::SpuriousVector].setPointer(
+        reinterpret_cast<void *>(timer::spuriousISR));
   });
 
-  idtr->load();
+  sharedIdt.load();
+
+  // Interrupts only come through the local and I/O APICs
+  legacyPICMasked.call([] {
+    Port(0x21).out(0, 0xFF);
+    Port(0xA1).out(0, 0xFF);
+  });
+
+  tryUnwrap(timer::initialize(cpu));
+
+#ifndef RELEASE
+  clock::checkSync(SyncCheckCycles);
+#endif
 
   return nothing{};
 }
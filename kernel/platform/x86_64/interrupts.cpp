@@ -0,0 +1,205 @@
+export module kernel.platform.x86_64.interrupts;
+
+import libpara.basic_types;
+import libpara.bench;
+
+import kernel.platform.x86_64.idt;
+import kernel.platform.x86_64.panic;
+
+using namespace libpara::basic_types;
+
+using interrupt_frame = kernel::platform::x86_64::idt::InterruptFrame;
+
+export namespace kernel::platform::x86_64::interrupts {
+
+using Handler = void (*)(idt::Context &context);
+
+} // namespace kernel::platform::x86_64::interrupts
+
+using namespace kernel::platform::x86_64;
+using namespace kernel::platform::x86_64::interrupts;
+
+// Handlers of all vectors that go through the common entry, shared by all
+// CPUs
+constinit Handler handlers[256] = {};
+
+extern "C" [[gnu::used]] void paraos_interrupt_dispatch(idt::Context *context) {
+  auto handler = __atomic_load_n(&handlers[context->vector], __ATOMIC_ACQUIRE);
+  if (handler == nullptr)
+    panic::unexpected(*context);
+  else
+    handler(*context);
+}
+
+// Entry shared by all vectors' stubs, which have pushed an error code and
+// the vector.
+//
+// Vector registers are not saved, and handlers are free to use them. Code
+// that may be interrupted through this entry declares them clobbered:
+// maskable interrupts are only taken while idle (see `impl<idle>`), software
+// interrupts list them at the `int`, and exceptions don't return. Fast path
+// entries are `[[gnu::interrupt]]` functions, which save every register they
+// use, vector ones included.
+extern "C" [[gnu::naked, gnu::used]] void paraos_interrupt_entry() {
+  asm volatile("push %rax ; push %rcx ; push %rdx ; push %rsi ; push %rdi ; "
+               "push %r8 ; push %r9 ; push %r10 ; push %r11 ; "
+               // the CPU has aligned the stack before pushing its frame,
+               // which the eleven words on top keep aligned
+               "cld ; mov %rsp, %rdi ; call paraos_interrupt_dispatch ; "
+               "pop %r11 ; pop %r10 ; pop %r9 ; pop %r8 ; pop %rdi ; "
+               "pop %rsi ; pop %rdx ; pop %rcx ; pop %rax ; "
+               // drops the vector and error code
+               "add $16, %rsp ; iretq");
+}
+
+export namespace kernel::platform::x86_64::interrupts {
+
+/**
+ * Entry of vector `vector`, which pushes a zero error code unless the CPU
+ * does, then the vector, and continues at the common entry
+ */
+template <u8 vector> struct entry {
+
+  // vectors are widened, or the ones above 0x7F would be sign-extended
+  [[gnu::naked]] static void
+  stub() requires panic::exception_without_error_code<vector> {
+    asm volatile("push $0 ; push %0 ; jmp paraos_interrupt_entry" ::"i"(
+        static_cast<usize>(vector)));
+  }
+
+  [[gnu::naked]] static void
+  stub() requires panic::exception_with_error_code<vector> {
+    asm volatile("push %0 ; jmp paraos_interrupt_entry" ::"i"(
+        static_cast<usize>(vector)));
+  }
+};
+
+/**
+ * Makes `handler` handle `vector` on all CPUs (`nullptr` panics again).
+ * Vectors whose gates lead to a fast path entry instead never get to it.
+ */
+void set(u8 vector, Handler handler) {
+  __atomic_store_n(&handlers[vector], handler, __ATOMIC_RELEASE);
+}
+
+} // namespace kernel::platform::x86_64::interrupts
+
+// Tests and benchmarks run before platform initialization, so they load an
+// IDT of their own with these vectors
+const u8 TestVector = 0x40;
+const u8 BenchVector = 0x41;
+const u8 FastBenchVector = 0x42;
+
+// what a software interrupt through the common entry clobbers, besides memory
+#define PARAOS_VECTOR_CLOBBERS                                                 \
+  "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8",     \
+      "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+
+alignas(16) constinit idt::Register<> scratchIdt;
+
+/**
+ * Loads `scratchIdt` with `vector` leading to `entry` for the lifetime of
+ * the guard, restoring current CPU's previous IDT afterwards
+ */
+class ScratchIDT {
+  idt::Location previous;
+
+public:
+  ScratchIDT(u8 vector, void *entry) : previous(idt::Location::current()) {
+    u16 cs;
+    asm volatile("mov %%cs, %0" : "=r"(cs));
+    scratchIdt.gates[vector] = idt::Gate(entry, cs, idt::Interrupt);
+    // NMIs (such as the profiler's) must still be taken as they were
+    if (previous.size >= 3 * sizeof(idt::Gate) - 1)
+      scratchIdt.gates[2] = static_cast<const idt::Gate *>(previous.offset)[2];
+    scratchIdt.load();
+  }
+  ScratchIDT(ScratchIDT &) = delete;
+
+  ~ScratchIDT() { previous.load(); }
+};
+
+[[gnu::interrupt]] void fastBenchISR(interrupt_frame *frame) {}
+
+export namespace kernel::platform::x86_64::interrupts::benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    // a software interrupt goes through the same entry and exit as any other
+    {
+      ScratchIDT loaded(BenchVector,
+                        reinterpret_cast<void *>(entry<BenchVector>::stub));
+      set(BenchVector, [](idt::Context &) {});
+      measure("interrupts.dispatch", [] {
+        asm volatile("int %0" ::"i"(BenchVector)
+                     : "memory", PARAOS_VECTOR_CLOBBERS);
+      });
+      set(BenchVector, nullptr);
+    }
+    {
+      ScratchIDT loaded(FastBenchVector,
+                        reinterpret_cast<void *>(fastBenchISR));
+      measure("interrupts.fast", [] {
+        asm volatile("int %0" ::"i"(FastBenchVector) : "memory");
+      });
+    }
+  }
+};
+
+} // namespace kernel::platform::x86_64::interrupts::benchmarks
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace kernel::platform::x86_64::interrupts::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+  static inline idt::Context seen;
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    ScratchIDT loaded(TestVector,
+                      reinterpret_cast<void *>(entry<TestVector>::stub));
+
+    test("Dispatch passes vector and frame to handler");
+    {
+      set(TestVector, [](idt::Context &context) { seen = context; });
+      u16 cs;
+      asm volatile("mov %%cs, %0" : "=r"(cs));
+      asm volatile("int %0" ::"i"(TestVector)
+                   : "memory", PARAOS_VECTOR_CLOBBERS);
+      Expect(seen.vector == TestVector);
+      Expect(seen.error_code == 0);
+      Expect(seen.frame.cs == cs);
+    }
+
+    test("Handlers can change interrupted registers");
+    {
+      set(TestVector, [](idt::Context &context) {
+        seen = context;
+        context.rax = context.rcx + 1;
+        context.r11 = 0;
+      });
+      usize rax, r11;
+      asm volatile("mov $0x1234, %%rcx ; mov $0x5678, %%r11 ; int %2 ; "
+                   "mov %%r11, %1"
+                   : "=a"(rax), "=r"(r11)
+                   : "i"(TestVector)
+                   : "rcx", "r11", "memory", PARAOS_VECTOR_CLOBBERS);
+      Expect(seen.rcx == 0x1234 && seen.r11 == 0x5678);
+      Expect(rax == 0x1235 && r11 == 0);
+    }
+
+    set(TestVector, nullptr);
+  }
+};
+
+} // namespace kernel::platform::x86_64::interrupts::tests
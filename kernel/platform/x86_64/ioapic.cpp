@@ -0,0 +1,54 @@
+export module kernel.platform.x86_64.ioapic;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+export namespace kernel::platform::x86_64 {
+
+/**
+ * I/O APIC, accessed through its (identity mapped) MMIO registers
+ *
+ * Legacy ISA IRQs are assumed to be identity mapped to the first I/O APIC's
+ * inputs, which holds for the serial ports on PC-compatible machines.
+ */
+class IOAPIC {
+  volatile u32 *base;
+
+public:
+  static const usize DefaultBase = 0xFEC00000;
+
+  enum Register : u8 {
+    ID = 0x00,
+    Version = 0x01,
+    RedirectionTable = 0x10,
+  };
+
+  static const u32 Masked = 1 << 16;
+
+  IOAPIC(usize base = DefaultBase)
+      : base(reinterpret_cast<volatile u32 *>(base)) {}
+
+  u32 read(u8 reg) {
+    base[0] = reg;
+    return base[4];
+  }
+
+  void write(u8 reg, u32 value) {
+    base[0] = reg;
+    base[4] = value;
+  }
+
+  /**
+   * Delivers `input` (edge triggered, active high) as `vector` to the local
+   * APIC with ID `apic_id`
+   */
+  void route(u8 input, u8 vector, u8 apic_id) {
+    write(RedirectionTable + input * 2 + 1, static_cast<u32>(apic_id) << 24);
+    write(RedirectionTable + input * 2, vector);
+  }
+
+  void mask(u8 input) { write(RedirectionTable + input * 2, Masked); }
+};
+
+} // namespace kernel::platform::x86_64
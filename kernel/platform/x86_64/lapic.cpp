@@ -0,0 +1,87 @@
+export module kernel.platform.x86_64.lapic;
+
+import libpara.basic_types;
+
+import kernel.platform.x86_64.cpu;
+
+using namespace libpara::basic_types;
+
+export namespace kernel::platform::x86_64 {
+
+/**
+ * Local APIC, accessed through its (identity mapped) MMIO registers
+ */
+class LocalAPIC {
+  volatile u32 *base;
+
+public:
+  enum Register : u16 {
+    ID = 0x20,
+    EOI = 0xB0,
+    SpuriousInterruptVector = 0xF0,
+    InterruptCommandLow = 0x300,
+    InterruptCommandHigh = 0x310,
+    LVTTimer = 0x320,
+    TimerInitialCount = 0x380,
+    TimerCurrentCount = 0x390,
+    TimerDivideConfiguration = 0x3E0,
+  };
+
+  enum TimerMode : u32 {
+    OneShot = 0 << 17,
+    Periodic = 1 << 17,
+    TSCDeadline = 2 << 17,
+  };
+
+  static const u32 Masked = 1 << 16;
+
+  LocalAPIC()
+      : base(reinterpret_cast<volatile u32 *>(readMSR(MSR::APICBase) &
+                                               ~0xFFFULL)) {}
+
+  u32 read(Register reg) { return base[reg / sizeof(u32)]; }
+
+  void write(Register reg, u32 value) { base[reg / sizeof(u32)] = value; }
+
+  /**
+   * Software-enables the APIC, routing spurious interrupts to `vector`
+   */
+  void enable(u8 vector) { write(SpuriousInterruptVector, 0x100 | vector); }
+
+  u8 id() { return static_cast<u8>(read(ID) >> 24); }
+
+  void eoi() { write(EOI, 0); }
+
+  /**
+   * Sends a non-maskable interrupt to the CPU with local APIC ID `id`
+   */
+  void sendNMI(u8 id) {
+    // NMI delivery mode, asserted, physical destination
+    send(id, 0x4400);
+  }
+
+  /**
+   * Sends interrupt `vector` to the CPU with local APIC ID `id`
+   */
+  void sendIPI(u8 id, u8 vector) {
+    // fixed delivery mode, asserted, physical destination
+    send(id, 0x4000 | vector);
+  }
+
+  void setTimer(u8 vector, TimerMode mode) {
+    write(LVTTimer, vector | mode);
+    // TSC deadline writes must not pass the LVT write
+    asm volatile("mfence" ::: "memory");
+  }
+
+private:
+  void send(u8 id, u32 command) {
+    const u32 DeliveryPending = 1 << 12;
+    while (read(InterruptCommandLow) & DeliveryPending)
+      __builtin_ia32_pause();
+    write(InterruptCommandHigh, static_cast<u32>(id) << 24);
+    write(InterruptCommandLow, command);
+  }
+};
+
+} // namespace kernel::platform::x86_64
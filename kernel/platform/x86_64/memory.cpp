@@ -0,0 +1,822 @@
+export module kernel.platform.x86_64.memory;
+
+import libpara.basic_types;
+import libpara.span;
+
+import kernel.platform.x86_64.cpu;
+
+using namespace libpara::basic_types;
+
+export namespace kernel::platform::x86_64::memory {
+
+/**
+ * CPU features `memcpy` and friends are picked by
+ */
+struct Features {
+  // Enhanced REP MOVSB/STOSB, which move whole cache lines at a time
+  bool erms = false;
+  // Fast Short REP MOV, which makes short string moves fast too
+  bool fsrm = false;
+  // supported and enabled
+  bool avx2 = false;
+  // bytes in the largest cache, 0 if unknown
+  usize cache = 0;
+};
+
+Features detect() {
+  Features features;
+  auto max = cpuid(0).eax;
+  if (max >= 7) {
+    auto leaf7 = cpuid(7);
+    features.erms = (leaf7.ebx & (1 << 9)) != 0;
+    features.fsrm = (leaf7.edx & (1 << 4)) != 0;
+    const u32 OSXSAVE = 1 << 27, AVX = 1 << 28;
+    if ((cpuid(1).ecx & (OSXSAVE | AVX)) == (OSXSAVE | AVX)) {
+      u32 xcr0_low, xcr0_high;
+      asm volatile("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+      // SSE and AVX state
+      features.avx2 = (xcr0_low & 0x6) == 0x6 && (leaf7.ebx & (1 << 5)) != 0;
+    }
+  }
+  // deterministic cache parameters, one subleaf per cache: leaf 4 on Intel,
+  // and leaf 0x8000001D, which is laid out the same, on AMD (with topology
+  // extensions)
+  auto caches = [&features](u32 leaf) {
+    for (u32 i = 0; i < 16; i++) {
+      auto parameters = cpuid(leaf, i);
+      if ((parameters.eax & 0x1F) == 0)
+        break;
+      auto size = static_cast<usize>((parameters.ebx >> 22) + 1) *
+                  (((parameters.ebx >> 12) & 0x3FF) + 1) *
+                  ((parameters.ebx & 0xFFF) + 1) *
+                  (static_cast<usize>(parameters.ecx) + 1);
+      if (size > features.cache)
+        features.cache = size;
+    }
+  };
+  if (max >= 4)
+    caches(4);
+  const u32 TopologyExtensions = 1 << 22;
+  if (features.cache == 0 && cpuid(0x80000000).eax >= 0x8000001D &&
+      (cpuid(0x80000001).ecx & TopologyExtensions) != 0)
+    caches(0x8000001D);
+  return features;
+}
+
+/**
+ * Enables AVX state on current CPU if it has AVX, as the loader may have
+ * left it disabled. XCR0 is per CPU, so every CPU must do this before the
+ * AVX2 way may be taken on it.
+ */
+void enableAVX() {
+  const u32 XSAVE = 1 << 26, AVX = 1 << 28;
+  if ((cpuid(1).ecx & (XSAVE | AVX)) != (XSAVE | AVX))
+    return;
+  const u64 OSXSAVE = 1 << 18;
+  u64 cr4;
+  asm volatile("mov %%cr4, %0" : "=r"(cr4));
+  asm volatile("mov %0, %%cr4" ::"r"(cr4 | OSXSAVE));
+  u32 xcr0_low, xcr0_high;
+  asm volatile("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  // x87, SSE and AVX state
+  asm volatile("xsetbv" ::"a"(xcr0_low | 0x7), "d"(xcr0_high), "c"(0));
+}
+
+/**
+ * Copies and fills of up to this many bytes take a few overlapping moves,
+ * whatever the plan
+ */
+const usize SmallSize = 128;
+
+/**
+ * How copies and fills above `SmallSize` bytes are done: with string
+ * instructions from `string` bytes, with non-temporal stores (which bypass
+ * the caches) from `nonTemporal` bytes, and with vector loops below
+ */
+struct Plan {
+  bool avx2 = false;
+  usize string = libpara::span::NotFound;
+  usize nonTemporal = libpara::span::NotFound;
+};
+
+/**
+ * String instructions start slower than vector loops, unless FSRM
+ */
+const usize StringSize = 2048;
+const usize FastStringSize = 256;
+
+/**
+ * Cache size assumed when the CPU doesn't tell
+ */
+const usize DefaultCacheSize = 1 << 20;
+
+/**
+ * Fastest plan for a CPU with `features`. Copies of three quarters of the
+ * largest cache or more would evict most of what's in it anyway, so they
+ * don't go through it.
+ */
+Plan best(const Features &features) {
+  auto cache = features.cache != 0 ? features.cache : DefaultCacheSize;
+  return {.avx2 = features.avx2,
+          .string = !features.erms  ? libpara::span::NotFound
+                    : features.fsrm ? FastStringSize
+                                    : StringSize,
+          .nonTemporal = cache / 4 * 3};
+}
+
+} // namespace kernel::platform::x86_64::memory
+
+using namespace kernel::platform::x86_64::memory;
+
+// SSE2 loops until `select()`, as every x86-64 CPU has it
+constinit Plan plan;
+
+export namespace kernel::platform::x86_64::memory {
+
+/**
+ * Plan all CPUs follow
+ */
+Plan current() {
+  return {.avx2 = __atomic_load_n(&plan.avx2, __ATOMIC_RELAXED),
+          .string = __atomic_load_n(&plan.string, __ATOMIC_RELAXED),
+          .nonTemporal = __atomic_load_n(&plan.nonTemporal, __ATOMIC_RELAXED)};
+}
+
+} // namespace kernel::platform::x86_64::memory
+
+typedef long long v16 __attribute__((vector_size(16)));
+typedef long long v32 __attribute__((vector_size(32)));
+typedef char i8x16 __attribute__((vector_size(16)));
+
+// Nothing below may turn into a call to the functions it implements, so
+// loops are kept from being recognized as copies or fills (`no_builtin`).
+// Constant-sized copies become unaligned vector loads and stores.
+template <typename V> inline V load(const u8 *p) {
+  V v;
+  __builtin_memcpy(&v, p, sizeof(V));
+  return v;
+}
+
+template <typename V> inline void store(u8 *p, V v) {
+  __builtin_memcpy(p, &v, sizeof(V));
+}
+
+/**
+ * Copies up to `SmallSize` bytes, loading all of them before storing any,
+ * so that they may overlap
+ */
+[[clang::no_builtin]] inline void copySmall(u8 *d, const u8 *s, usize n) {
+  if (n > 64) {
+    auto a = load<v16>(s), b = load<v16>(s + 16), c = load<v16>(s + 32),
+         e = load<v16>(s + 48), f = load<v16>(s + n - 64),
+         g = load<v16>(s + n - 48), h = load<v16>(s + n - 32),
+         i = load<v16>(s + n - 16);
+    store(d, a), store(d + 16, b), store(d + 32, c), store(d + 48, e);
+    store(d + n - 64, f), store(d + n - 48, g), store(d + n - 32, h);
+    store(d + n - 16, i);
+  } else if (n > 32) {
+    auto a = load<v16>(s), b = load<v16>(s + 16), c = load<v16>(s + n - 32),
+         e = load<v16>(s + n - 16);
+    store(d, a), store(d + 16, b), store(d + n - 32, c), store(d + n - 16, e);
+  } else if (n >= 16) {
+    auto a = load<v16>(s), b = load<v16>(s + n - 16);
+    store(d, a), store(d + n - 16, b);
+  } else if (n >= 8) {
+    auto a = load<u64>(s), b = load<u64>(s + n - 8);
+    store(d, a), store(d + n - 8, b);
+  } else if (n >= 4) {
+    auto a = load<u32>(s), b = load<u32>(s + n - 4);
+    store(d, a), store(d + n - 4, b);
+  } else if (n > 0) {
+    auto a = s[0], b = s[n / 2], c = s[n - 1];
+    d[0] = a, d[n / 2] = b, d[n - 1] = c;
+  }
+}
+
+/**
+ * Copies with a loop over blocks of four `V` vectors, after aligning the
+ * destination. The first vector and the last block are loaded up front and
+ * stored unaligned. Vectors stay within the function, as passing AVX ones
+ * around needs AVX enabled on both sides, and are moved one at a time, as
+ * larger constant-sized copies may become calls when not optimizing.
+ */
+template <typename V>
+[[gnu::always_inline, clang::no_builtin]] inline void
+copyVectors(u8 *d, const u8 *s, usize n) {
+  const usize Size = sizeof(V), Block = 4 * Size;
+  V head, a, b, c, e;
+  __builtin_memcpy(&head, s, Size);
+  __builtin_memcpy(&a, s + n - Block, Size);
+  __builtin_memcpy(&b, s + n - 3 * Size, Size);
+  __builtin_memcpy(&c, s + n - 2 * Size, Size);
+  __builtin_memcpy(&e, s + n - Size, Size);
+  auto end = d + n - Block;
+  __builtin_memcpy(d, &head, Size);
+  auto skip = Size - (reinterpret_cast<usize>(d) & (Size - 1));
+  s += skip;
+  for (d += skip; d < end; d += Block, s += Block) {
+    V f, g, h, i;
+    __builtin_memcpy(&f, s, Size), __builtin_memcpy(&g, s + Size, Size);
+    __builtin_memcpy(&h, s + 2 * Size, Size);
+    __builtin_memcpy(&i, s + 3 * Size, Size);
+    __builtin_memcpy(d, &f, Size), __builtin_memcpy(d + Size, &g, Size);
+    __builtin_memcpy(d + 2 * Size, &h, Size);
+    __builtin_memcpy(d + 3 * Size, &i, Size);
+  }
+  __builtin_memcpy(end, &a, Size), __builtin_memcpy(end + Size, &b, Size);
+  __builtin_memcpy(end + 2 * Size, &c, Size);
+  __builtin_memcpy(end + 3 * Size, &e, Size);
+}
+
+[[clang::no_builtin]] void copySSE2(u8 *d, const u8 *s, usize n) {
+  copyVectors<v16>(d, s, n);
+}
+
+[[gnu::target("avx2"), clang::no_builtin]] void copyAVX2(u8 *d, const u8 *s,
+                                                         usize n) {
+  copyVectors<v32>(d, s, n);
+}
+
+inline void copyString(u8 *d, const u8 *s, usize n) {
+  asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+[[clang::no_builtin]] void copyNonTemporal(u8 *d, const u8 *s, usize n) {
+  auto skip = -reinterpret_cast<usize>(d) & 15;
+  copySmall(d, s, skip);
+  d += skip, s += skip, n -= skip;
+  for (; n >= 64; d += 64, s += 64, n -= 64) {
+    auto a = load<v16>(s), b = load<v16>(s + 16), c = load<v16>(s + 32),
+         e = load<v16>(s + 48);
+    auto o = reinterpret_cast<v16 *>(d);
+    __builtin_nontemporal_store(a, o);
+    __builtin_nontemporal_store(b, o + 1);
+    __builtin_nontemporal_store(c, o + 2);
+    __builtin_nontemporal_store(e, o + 3);
+  }
+  // orders the weakly-ordered stores before anything that follows
+  asm volatile("sfence" ::: "memory");
+  copySmall(d, s, n);
+}
+
+[[clang::no_builtin]] void copyLarge(const Plan &with, u8 *d, const u8 *s,
+                                    usize n) {
+  if (n >= with.nonTemporal)
+    copyNonTemporal(d, s, n);
+  else if (n >= with.string)
+    copyString(d, s, n);
+  else if (with.avx2)
+    copyAVX2(d, s, n);
+  else
+    copySSE2(d, s, n);
+}
+
+/**
+ * Copies when the destination starts within the source, a block at a time
+ * from the end. Every block is loaded before it's stored, and the first
+ * vector up front.
+ */
+[[clang::no_builtin]] void moveBackward(u8 *d, const u8 *s, usize n) {
+  auto head = load<v16>(s);
+  for (; n >= 64; n -= 64) {
+    auto a = load<v16>(s + n - 64), b = load<v16>(s + n - 48),
+         c = load<v16>(s + n - 32), e = load<v16>(s + n - 16);
+    store(d + n - 64, a), store(d + n - 48, b);
+    store(d + n - 32, c), store(d + n - 16, e);
+  }
+  for (; n >= 16; n -= 16)
+    store(d + n - 16, load<v16>(s + n - 16));
+  store(d, head);
+}
+
+/**
+ * Copies when the source starts within the destination, like
+ * `moveBackward` from the start
+ */
+[[clang::no_builtin]] void moveForward(u8 *d, const u8 *s, usize n) {
+  auto tail = load<v16>(s + n - 16);
+  usize i = 0;
+  for (; i + 64 <= n; i += 64) {
+    auto a = load<v16>(s + i), b = load<v16>(s + i + 16),
+         c = load<v16>(s + i + 32), e = load<v16>(s + i + 48);
+    store(d + i, a), store(d + i + 16, b);
+    store(d + i + 32, c), store(d + i + 48, e);
+  }
+  for (; i + 16 <= n; i += 16)
+    store(d + i, load<v16>(s + i));
+  store(d + n - 16, tail);
+}
+
+/**
+ * Fills up to `SmallSize` bytes with the byte repeated throughout `v`
+ */
+[[clang::no_builtin]] inline void fillSmall(u8 *d, u64 v, usize n) {
+  v16 vv = {static_cast<long long>(v), static_cast<long long>(v)};
+  if (n > 64) {
+    store(d, vv), store(d + 16, vv), store(d + 32, vv), store(d + 48, vv);
+    store(d + n - 64, vv), store(d + n - 48, vv), store(d + n - 32, vv);
+    store(d + n - 16, vv);
+  } else if (n > 32) {
+    store(d, vv), store(d + 16, vv), store(d + n - 32, vv);
+    store(d + n - 16, vv);
+  } else if (n >= 16) {
+    store(d, vv), store(d + n - 16, vv);
+  } else if (n >= 8) {
+    store(d, v), store(d + n - 8, v);
+  } else if (n >= 4) {
+    store(d, static_cast<u32>(v)), store(d + n - 4, static_cast<u32>(v));
+  } else if (n > 0) {
+    d[0] = d[n / 2] = d[n - 1] = static_cast<u8>(v);
+  }
+}
+
+/**
+ * Fills like `copyVectors` copies
+ */
+template <typename V>
+[[gnu::always_inline, clang::no_builtin]] inline void
+fillVectors(u8 *d, u64 v, usize n) {
+  const usize Size = sizeof(V), Block = 4 * Size;
+  V vector = V{} + static_cast<long long>(v);
+  auto end = d + n - Block;
+  __builtin_memcpy(d, &vector, Size);
+  for (d += Size - (reinterpret_cast<usize>(d) & (Size - 1)); d < end;
+       d += Block) {
+    __builtin_memcpy(d, &vector, Size);
+    __builtin_memcpy(d + Size, &vector, Size);
+    __builtin_memcpy(d + 2 * Size, &vector, Size);
+    __builtin_memcpy(d + 3 * Size, &vector, Size);
+  }
+  __builtin_memcpy(end, &vector, Size);
+  __builtin_memcpy(end + Size, &vector, Size);
+  __builtin_memcpy(end + 2 * Size, &vector, Size);
+  __builtin_memcpy(end + 3 * Size, &vector, Size);
+}
+
+[[clang::no_builtin]] void fillSSE2(u8 *d, u64 v, usize n) {
+  fillVectors<v16>(d, v, n);
+}
+
+[[gnu::target("avx2"), clang::no_builtin]] void fillAVX2(u8 *d, u64 v,
+                                                         usize n) {
+  fillVectors<v32>(d, v, n);
+}
+
+inline void fillString(u8 *d, u64 v, usize n) {
+  asm volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(v) : "memory");
+}
+
+[[clang::no_builtin]] void fillNonTemporal(u8 *d, u64 v, usize n) {
+  auto skip = -reinterpret_cast<usize>(d) & 15;
+  fillSmall(d, v, skip);
+  d += skip, n -= skip;
+  v16 vv = {static_cast<long long>(v), static_cast<long long>(v)};
+  for (; n >= 64; d += 64, n -= 64) {
+    auto o = reinterpret_cast<v16 *>(d);
+    __builtin_nontemporal_store(vv, o);
+    __builtin_nontemporal_store(vv, o + 1);
+    __builtin_nontemporal_store(vv, o + 2);
+    __builtin_nontemporal_store(vv, o + 3);
+  }
+  asm volatile("sfence" ::: "memory");
+  fillSmall(d, v, n);
+}
+
+[[clang::no_builtin]] void fillLarge(const Plan &with, u8 *d, u64 v, usize n) {
+  if (n >= with.nonTemporal)
+    fillNonTemporal(d, v, n);
+  else if (n >= with.string)
+    fillString(d, v, n);
+  else if (with.avx2)
+    fillAVX2(d, v, n);
+  else
+    fillSSE2(d, v, n);
+}
+
+export namespace kernel::platform::x86_64::memory {
+
+/**
+ * `memcpy`, `memmove` and `memset` following `with` (which current CPU must
+ * support) rather than the plan all CPUs follow, so that plans can be tested
+ * and measured on one CPU while others go on as they were
+ */
+[[clang::no_builtin]] void *copyWith(const Plan &with, void *dest,
+                                     const void *src, usize n) {
+  auto d = static_cast<u8 *>(dest);
+  auto s = static_cast<const u8 *>(src);
+  if (n <= SmallSize)
+    copySmall(d, s, n);
+  else
+    copyLarge(with, d, s, n);
+  return dest;
+}
+
+[[clang::no_builtin]] void *moveWith(const Plan &with, void *dest,
+                                     const void *src, usize n) {
+  auto d = static_cast<u8 *>(dest);
+  auto s = static_cast<const u8 *>(src);
+  if (n <= SmallSize)
+    copySmall(d, s, n);
+  else if (d >= s + n || s >= d + n)
+    copyLarge(with, d, s, n);
+  else if (d > s)
+    moveBackward(d, s, n);
+  else if (d < s)
+    moveForward(d, s, n);
+  return dest;
+}
+
+[[clang::no_builtin]] void *fillWith(const Plan &with, void *dest, int c,
+                                     usize n) {
+  auto d = static_cast<u8 *>(dest);
+  auto v = static_cast<u8>(c) * 0x0101010101010101ULL;
+  if (n <= SmallSize)
+    fillSmall(d, v, n);
+  else
+    fillLarge(with, d, v, n);
+  return dest;
+}
+
+} // namespace kernel::platform::x86_64::memory
+
+// The compiler emits calls to these for copies, fills and comparisons it
+// doesn't inline, as there is no C library
+export extern "C" {
+
+[[gnu::used, clang::no_builtin]] void *memcpy(void *dest, const void *src,
+                                              usize n) {
+  return copyWith(current(), dest, src, n);
+}
+
+[[gnu::used, clang::no_builtin]] void *memmove(void *dest, const void *src,
+                                               usize n) {
+  return moveWith(current(), dest, src, n);
+}
+
+[[gnu::used, clang::no_builtin]] void *memset(void *dest, int c, usize n) {
+  return fillWith(current(), dest, c, n);
+}
+
+[[gnu::used, clang::no_builtin]] int memcmp(const void *a, const void *b,
+                                            usize n) {
+  auto x = static_cast<const u8 *>(a);
+  auto y = static_cast<const u8 *>(b);
+  usize i = 0;
+  // finds the first differing 16 bytes, then the byte within them
+  for (; i + 16 <= n; i += 16) {
+    auto equal = static_cast<u32>(__builtin_ia32_pmovmskb128(
+        (i8x16)(load<i8x16>(x + i) == load<i8x16>(y + i))));
+    if (equal != 0xFFFF) {
+      i += __builtin_ctz(~equal);
+      return x[i] - y[i];
+    }
+  }
+  for (; i < n; i++)
+    if (x[i] != y[i])
+      return x[i] - y[i];
+  return 0;
+}
+}
+
+export namespace kernel::platform::x86_64::memory {
+
+/**
+ * Makes all CPUs follow `next` (which they must support) from now on
+ */
+void use(const Plan &next) {
+  __atomic_store_n(&plan.avx2, next.avx2, __ATOMIC_RELAXED);
+  __atomic_store_n(&plan.string, next.string, __ATOMIC_RELAXED);
+  __atomic_store_n(&plan.nonTemporal, next.nonTemporal, __ATOMIC_RELAXED);
+}
+
+/**
+ * Picks the best plan for current CPU, which all others must match
+ */
+void select() { use(best(detect())); }
+
+/**
+ * Plans that each take one way for everything above `SmallSize`
+ */
+const Plan SSE2 = {};
+const Plan AVX2 = {.avx2 = true};
+const Plan String = {.string = 0};
+const Plan NonTemporal = {.nonTemporal = 0};
+
+} // namespace kernel::platform::x86_64::memory
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace kernel::platform::x86_64::memory::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+  static const usize BufferSize = 4096;
+
+  static inline u8 source[BufferSize];
+  static inline u8 destination[BufferSize];
+  static inline u8 expected[BufferSize];
+
+  // Expected results are worked out a byte at a time, by loops that must not
+  // become calls to what they check
+  [[clang::no_builtin]] static void pattern(u8 *buffer, u8 seed) {
+    for (usize i = 0; i < BufferSize; i++)
+      buffer[i] = static_cast<u8>(i * 7 + seed);
+  }
+
+  [[clang::no_builtin]] static void duplicate(u8 *to, const u8 *from) {
+    for (usize i = 0; i < BufferSize; i++)
+      to[i] = from[i];
+  }
+
+  [[clang::no_builtin]] static bool matches() {
+    for (usize i = 0; i < BufferSize; i++)
+      if (destination[i] != expected[i])
+        return false;
+    return true;
+  }
+
+  // bytes past the end of `source` and `destination` must be left alone, so
+  // copies stay within `BufferSize` with room to spare
+  [[clang::no_builtin]] static bool copies(const Plan &with, usize n, usize to,
+                                          usize from) {
+    pattern(source, 1);
+    pattern(destination, 2);
+    duplicate(expected, destination);
+    for (usize i = 0; i < n; i++)
+      expected[to + i] = source[from + i];
+    copyWith(with, destination + to, source + from, n);
+    return matches();
+  }
+
+  [[clang::no_builtin]] static bool fills(const Plan &with, usize n, usize to,
+                                        u8 c) {
+    pattern(destination, 3);
+    duplicate(expected, destination);
+    for (usize i = 0; i < n; i++)
+      expected[to + i] = c;
+    fillWith(with, destination + to, c, n);
+    return matches();
+  }
+
+  [[clang::no_builtin]] static bool moves(const Plan &with, usize n, usize to,
+                                        usize from) {
+    pattern(destination, 4);
+    duplicate(source, destination);
+    duplicate(expected, destination);
+    for (usize i = 0; i < n; i++)
+      expected[to + i] = source[from + i];
+    moveWith(with, destination + to, destination + from, n);
+    return matches();
+  }
+
+  // sizes around every threshold between ways of copying, and a few past
+  // them all
+  static usize size(usize i) {
+    const usize Large[] = {511, 1000, 2048, 3001};
+    return i <= 300 ? i : Large[i - 301];
+  }
+
+  static const usize Sizes = 305;
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    // every plan, with the tests named after it
+    struct Way {
+      const char *copies;
+      const char *fills;
+      const char *moves;
+      Plan plan;
+    };
+    const Way ways[] = {
+        {"memcpy copies every size at every alignment with SSE2",
+         "memset fills every size at every alignment with SSE2",
+         "memmove copies overlapping bytes in either direction with SSE2",
+         SSE2},
+        {"memcpy copies every size at every alignment with AVX2",
+         "memset fills every size at every alignment with AVX2",
+         "memmove copies overlapping bytes in either direction with AVX2",
+         AVX2},
+        {"memcpy copies every size at every alignment with string "
+         "instructions",
+         "memset fills every size at every alignment with string "
+         "instructions",
+         "memmove copies overlapping bytes in either direction with string "
+         "instructions",
+         String},
+        {"memcpy copies every size at every alignment with non-temporal "
+         "stores",
+         "memset fills every size at every alignment with non-temporal "
+         "stores",
+         "memmove copies overlapping bytes in either direction with "
+         "non-temporal stores",
+         NonTemporal},
+    };
+    for (auto &way : ways) {
+      // AVX2 may be missing, or present but not enabled
+      if (way.plan.avx2 && !detect().avx2)
+        continue;
+      auto &plan = way.plan;
+
+      test(way.copies);
+      {
+        bool copied = true;
+        for (usize i = 0; i < Sizes; i++)
+          for (usize to = 0; to < 4; to++)
+            copied = copied && copies(plan, size(i), to * 5, to * 3 % 4);
+        Expect(copied);
+      }
+
+      test(way.fills);
+      {
+        bool filled = true;
+        for (usize i = 0; i < Sizes; i++)
+          for (usize to = 0; to < 4; to++)
+            filled = filled && fills(plan, size(i), to * 5, 0xA5);
+        Expect(filled);
+      }
+
+      test(way.moves);
+      {
+        bool moved = true;
+        const usize Shifts[] = {1, 15, 16, 17, 64, 200};
+        for (usize i = 0; i < Sizes; i++)
+          for (auto shift : Shifts) {
+            auto n = size(i);
+            if (n + shift + 1 >= BufferSize)
+              continue;
+            moved = moved && moves(plan, n, shift + 1, 1) &&
+                    moves(plan, n, 1, shift + 1);
+          }
+        Expect(moved);
+        Expect(moves(plan, 300, 8, 8));
+      }
+    }
+
+    test("memcmp orders by the first differing byte");
+    {
+      pattern(source, 5);
+      duplicate(destination, source);
+      Expect(memcmp(source, destination, BufferSize) == 0);
+      Expect(memcmp(source, destination, 0) == 0);
+      bool ordered = true;
+      for (usize n = 1; n <= 80; n++)
+        for (usize at = 0; at < n; at++) {
+          destination[at] = static_cast<u8>(source[at] + 1);
+          // a later difference the other way doesn't count
+          if (at + 1 < n)
+            destination[n - 1] = static_cast<u8>(source[n - 1] - 1);
+          ordered = ordered && memcmp(source, destination, n) < 0 &&
+                    memcmp(destination, source, n) > 0 &&
+                    memcmp(source, destination, at) == 0;
+          duplicate(destination, source);
+        }
+      Expect(ordered);
+      // bytes compare unsigned
+      source[100] = 0x80;
+      destination[100] = 0x7F;
+      Expect(memcmp(source, destination, BufferSize) > 0);
+    }
+  }
+};
+
+} // namespace kernel::platform::x86_64::memory::tests
+
+import libpara.bench;
+import libpara.formatting;
+
+export namespace kernel::platform::x86_64::memory::benchmarks {
+
+/**
+ * Measures copies, fills, moves and comparisons of sizes from a few bytes to
+ * more than the caches hold, in memory that must be at least twice the size
+ * of the largest one (or it's left out)
+ */
+class Benchmark : public libpara::bench::Benchmark {
+
+  libpara::span::Span<u8> scratch;
+
+  // names of measurements, put together from their parts
+  class Name {
+    char chars[64] = {};
+    usize length = 0;
+
+  public:
+    void write(const char *s) {
+      while (*s != 0 && length < sizeof(chars) - 1)
+        chars[length++] = *s++;
+    }
+
+    void write(const u8 *bytes, usize size) {
+      for (usize i = 0; i < size && length < sizeof(chars) - 1; i++)
+        chars[length++] = static_cast<char>(bytes[i]);
+    }
+
+    operator const char *() const { return chars; }
+  };
+
+  struct Size {
+    usize bytes;
+    const char *label;
+    // measured with every way on its own too
+    bool everyWay;
+  };
+
+  static constexpr Size Sizes[] = {
+      {8, "8B", false},
+      {64, "64B", false},
+      {512, "512B", false},
+      {4 << 10, "4KiB", true},
+      {32 << 10, "32KiB", false},
+      {256 << 10, "256KiB", true},
+      {2 << 20, "2MiB", false},
+      {8 << 20, "8MiB", true},
+  };
+
+  bool fits(usize n) const { return 2 * n + 64 <= scratch.size(); }
+
+  // sizes are hidden from the compiler, which would otherwise inline
+  // constant-sized calls
+  static usize opaque(usize n) {
+    asm volatile("" : "+r"(n));
+    return n;
+  }
+
+  void copy(const Plan &with, const char *prefix, const Size &size) {
+    using libpara::bench::keep;
+    auto src = scratch.data(), dst = src + scratch.size() / 2;
+    auto n = opaque(size.bytes);
+    Name name;
+    libpara::formatting::format(name, prefix, size.label);
+    measure(name, [&] { keep(copyWith(with, dst, src, n)); });
+  }
+
+  void fill(const Plan &with, const char *prefix, const Size &size) {
+    using libpara::bench::keep;
+    auto dst = scratch.data();
+    auto n = opaque(size.bytes);
+    Name name;
+    libpara::formatting::format(name, prefix, size.label);
+    measure(name, [&] { keep(fillWith(with, dst, 0x5A, n)); });
+  }
+
+public:
+  Benchmark(libpara::testing::TestCaseSink &sink,
+            libpara::span::Span<u8> scratch)
+      : libpara::bench::Benchmark(sink), scratch(scratch) {}
+
+  virtual void run() {
+    using libpara::bench::keep;
+    auto features = detect();
+    auto plan = best(features);
+
+    for (auto &size : Sizes) {
+      if (!fits(size.bytes))
+        continue;
+      copy(plan, "memory.copy.", size);
+      fill(plan, "memory.fill.", size);
+
+      auto src = scratch.data();
+      auto n = opaque(size.bytes);
+      Name move;
+      libpara::formatting::format(move, "memory.move.", size.label);
+      // overlapping, so that it can't take the `memcpy` way
+      measure(move, [&] { keep(moveWith(plan, src + 64, src, n)); });
+
+      // equal all the way, so that all of it is compared
+      auto dst = src + scratch.size() / 2;
+      memcpy(dst, src, n);
+      Name compare;
+      libpara::formatting::format(compare, "memory.compare.", size.label);
+      measure(compare, [&] { keep(memcmp(dst, src, n)); });
+    }
+
+    // every way on its own, on either side of where the best plan switches
+    // between them
+    struct Way {
+      const char *copy;
+      const char *fill;
+      Plan plan;
+    };
+    const Way ways[] = {
+        {"memory.copy.sse2.", "memory.fill.sse2.", SSE2},
+        {"memory.copy.avx2.", "memory.fill.avx2.", AVX2},
+        {"memory.copy.string.", "memory.fill.string.", String},
+        {"memory.copy.nt.", "memory.fill.nt.", NonTemporal},
+    };
+    for (auto &way : ways) {
+      if (way.plan.avx2 && !features.avx2)
+        continue;
+      for (auto &size : Sizes)
+        if (size.everyWay && fits(size.bytes)) {
+          copy(way.plan, way.copy, size);
+          fill(way.plan, way.fill, size);
+        }
+    }
+  }
+};
+
+} // namespace kernel::platform::x86_64::memory::benchmarks
@@ -1,19 +1,13 @@
 export module kernel.platform.x86_64.panic;
 
 import libpara.basic_types;
+import libpara.formatting;
 import kernel.devices.serial;
 export import kernel.platform.x86_64.serial;
+import kernel.platform.x86_64.idt;
 
 using namespace libpara::basic_types;
 
-struct interrupt_frame {
-  usize ip;
-  usize cs;
-  usize flags;
-  usize sp;
-  usize ss;
-};
-
 export namespace kernel::platform::x86_64::panic {
 
 template <u64 interrupt> struct exception_name {
@@ -100,6 +94,18 @@ template <> struct exception_name<0x14> {
   static constexpr const char *name = "Virtualization Exception";
 };
 
+template <> struct exception_name<0x15> {
+  static constexpr const char *name = "Control Protection Exception";
+};
+
+template <> struct exception_name<0x1D> {
+  static constexpr const char *name = "VMM Communication Exception";
+};
+
+template <> struct exception_name<0x1E> {
+  static constexpr const char *name = "Security Exception";
+};
+
 template <u64 interrupt> struct exception_error_code {
   static constexpr bool present = false;
 };
@@ -140,6 +146,10 @@ template <> struct exception_error_code<0x1D> {
   static constexpr bool present = true;
 };
 
+template <> struct exception_error_code<0x1E> {
+  static constexpr bool present = true;
+};
+
 template <u64 interrupt>
 concept exception_with_error_code = exception_error_code<interrupt>::present;
 
@@ -147,28 +157,37 @@ template <u64 interrupt>
 concept exception_without_error_code =
     !exception_error_code<interrupt>::present;
 
-template <u64 interrupt> struct panic_isr {
-
-  [[gnu::interrupt]] static void
-  isr(interrupt_frame *frame) requires exception_without_error_code<interrupt> {
-    auto serial = kernel::platform::x86_64::SerialPort();
-    serial.initialize();
-    serial.write("PANIC: ");
-    serial.write(exception_name<interrupt>::name);
-    serial.write("\n");
-    asm volatile("cli ; hlt");
-  }
+/**
+ * Handles exception `interrupt` by reporting it and halting
+ */
+template <u64 interrupt> struct panic_handler {
 
-  [[gnu::interrupt]] static void
-  isr(interrupt_frame *frame,
-      usize error_code) requires exception_with_error_code<interrupt> {
+  static void handle(idt::Context &context) {
     auto serial = kernel::platform::x86_64::SerialPort();
     serial.initialize();
-    serial.write("PANIC: ");
-    serial.write(exception_name<interrupt>::name);
-    serial.write("\n");
+    if constexpr (exception_with_error_code<interrupt>)
+      libpara::formatting::format<"PANIC: {} at {:#x}, error code {:#x}\n">(
+          serial, exception_name<interrupt>::name, context.frame.ip,
+          context.error_code);
+    else
+      libpara::formatting::format<"PANIC: {} at {:#x}\n">(
+          serial, exception_name<interrupt>::name, context.frame.ip);
+    serial.flush();
     asm volatile("cli ; hlt");
   }
 };
 
+/**
+ * Handles an interrupt nothing was registered for by reporting it and
+ * halting
+ */
+inline void unexpected(idt::Context &context) {
+  auto serial = kernel::platform::x86_64::SerialPort();
+  serial.initialize();
+  libpara::formatting::format<"PANIC: Unexpected interrupt {:#x} at {:#x}\n">(
+      serial, context.vector, context.frame.ip);
+  serial.flush();
+  asm volatile("cli ; hlt");
+}
+
 } // namespace kernel::platform::x86_64::panic
@@ -0,0 +1,101 @@
+export module kernel.platform.x86_64.pci;
+
+import libpara.basic_types;
+import libpara.err;
+
+import kernel.platform.x86_64.port;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+export namespace kernel::platform::x86_64::pci {
+
+const auto DeviceNotFoundError = "PCIDeviceNotFound"_error;
+
+enum Register : u8 {
+  VendorID = 0x00,
+  DeviceID = 0x02,
+  Command = 0x04,
+  HeaderType = 0x0E,
+  BAR0 = 0x10,
+};
+
+enum CommandBits : u16 {
+  IOSpace = 1 << 0,
+  MemorySpace = 1 << 1,
+  BusMaster = 1 << 2,
+};
+
+/**
+ * PCI function, accessed through configuration mechanism #1 (I/O ports
+ * 0xCF8 and 0xCFC)
+ */
+struct Function {
+  u8 bus = 0;
+  u8 device = 0;
+  u8 function = 0;
+
+  u32 read32(u8 offset) const {
+    select(offset);
+    return Port(0xCFC).in32(0);
+  }
+
+  u16 read16(u8 offset) const {
+    return static_cast<u16>(read32(offset & ~3) >> ((offset & 2) * 8));
+  }
+
+  u8 read8(u8 offset) const {
+    return static_cast<u8>(read32(offset & ~3) >> ((offset & 3) * 8));
+  }
+
+  void write32(u8 offset, u32 value) const {
+    select(offset);
+    Port(0xCFC).out32(0, value);
+  }
+
+  void write16(u8 offset, u16 value) const {
+    auto shift = (offset & 2) * 8;
+    auto dword = read32(offset & ~3) & ~(0xFFFFU << shift);
+    write32(offset & ~3, dword | static_cast<u32>(value) << shift);
+  }
+
+  bool exists() const { return read16(VendorID) != 0xFFFF; }
+
+  /**
+   * Enables the function's response to I/O and memory accesses, and its
+   * DMA
+   */
+  void enable() const {
+    write16(Command, read16(Command) | IOSpace | MemorySpace | BusMaster);
+  }
+
+private:
+  void select(u8 offset) const {
+    Port(0xCF8).out32(0, 1U << 31 | static_cast<u32>(bus) << 16 |
+                             static_cast<u32>(device) << 11 |
+                             static_cast<u32>(function) << 8 | (offset & 0xFC));
+  }
+};
+
+/**
+ * Finds the first function with the given vendor and device IDs
+ */
+Result<Function> find(u16 vendor, u16 device) {
+  for (u16 bus = 0; bus < 256; bus++)
+    for (u8 slot = 0; slot < 32; slot++) {
+      auto first = Function{.bus = static_cast<u8>(bus), .device = slot};
+      if (!first.exists())
+        continue;
+      u8 functions = (first.read8(HeaderType) & 0x80) ? 8 : 1;
+      for (u8 f = 0; f < functions; f++) {
+        auto candidate = Function{
+            .bus = static_cast<u8>(bus), .device = slot, .function = f};
+        if (candidate.read16(VendorID) == vendor &&
+            candidate.read16(DeviceID) == device)
+          return candidate;
+      }
+    }
+  return DeviceNotFoundError;
+}
+
+} // namespace kernel::platform::x86_64::pci
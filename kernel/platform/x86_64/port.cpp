@@ -13,7 +13,8 @@ class Port {
 public:
   static const auto COM1 = 0x3F8;
 
-  Port() : port(COM1) {}
+  constexpr Port() : port(COM1) {}
+  constexpr Port(u16 port) : port(port) {}
 
   void out(u16 offset, u8 val) {
     u16 port_ = port + offset;
@@ -26,6 +27,30 @@ public:
     asm volatile("inb %1, %0" : "=a"(ret) : "Nd"(port_));
     return ret;
   }
+
+  void out16(u16 offset, u16 val) {
+    u16 port_ = port + offset;
+    asm volatile("outw %0, %1" : : "a"(val), "Nd"(port_));
+  }
+
+  u16 in16(u16 offset) {
+    u16 port_ = port + offset;
+    u16 ret;
+    asm volatile("inw %1, %0" : "=a"(ret) : "Nd"(port_));
+    return ret;
+  }
+
+  void out32(u16 offset, u32 val) {
+    u16 port_ = port + offset;
+    asm volatile("outl %0, %1" : : "a"(val), "Nd"(port_));
+  }
+
+  u32 in32(u16 offset) {
+    u16 port_ = port + offset;
+    u32 ret;
+    asm volatile("inl %1, %0" : "=a"(ret) : "Nd"(port_));
+    return ret;
+  }
 };
 
 } // namespace kernel::platform::x86_64
@@ -0,0 +1,94 @@
+export module kernel.platform.x86_64.profile;
+
+import libpara.basic_types;
+import libpara.formatting;
+import libpara.time;
+
+import kernel.cpu;
+import kernel.profile;
+import kernel.timer;
+import kernel.platform.x86_64.cpu;
+import kernel.platform.x86_64.idt;
+import kernel.platform.x86_64.lapic;
+import kernel.platform.x86_64.serial;
+import kernel.platform.x86_64.timer;
+
+using namespace libpara::basic_types;
+
+using interrupt_frame = kernel::platform::x86_64::idt::InterruptFrame;
+
+export namespace kernel::platform::x86_64::profile {
+
+/**
+ * Samples taken per second on every CPU
+ */
+const u64 SamplesPerSecond = 1000;
+
+/**
+ * Sampling period until the clock is calibrated
+ */
+const u64 UncalibratedPeriod = 1 << 21;
+
+} // namespace kernel::platform::x86_64::profile
+
+using namespace kernel::platform::x86_64;
+using namespace kernel::platform::x86_64::profile;
+
+// CPUs run with interrupts disabled except when idle, so they are sampled
+// with NMIs. Each is only taken as a sample if it was asked for.
+constinit bool sampleRequested[kernel::cpu::MaxCPUs] = {};
+
+/**
+ * Periodic timer on one CPU, interrupting all other sampling targets
+ */
+class Sampler : public kernel::timer::Timer {
+public:
+  constexpr Sampler() : Timer(UncalibratedPeriod) {}
+
+  virtual void expired() {
+    if (libpara::time::clock.isCalibrated())
+      period = libpara::time::clock.frequency() / SamplesPerSecond;
+    if (!kernel::profile::isSampling())
+      return;
+    auto self = currentCPU()->index;
+    LocalAPIC lapic;
+    for (u16 i = 0; i < kernel::cpu::MaxCPUs; i++) {
+      if (i == self ||
+          __atomic_load_n(&kernel::profile::buffers[i], __ATOMIC_ACQUIRE) ==
+              nullptr)
+        continue;
+      __atomic_store_n(&sampleRequested[i], true, __ATOMIC_RELEASE);
+      lapic.sendNMI(static_cast<u8>(kernel::profile::ids[i]));
+    }
+  }
+};
+
+constinit Sampler sampler;
+
+export namespace kernel::platform::x86_64::profile {
+
+[[gnu::interrupt]] void nmiISR(interrupt_frame *frame) {
+  auto cpu = currentCPU();
+  if (!__atomic_exchange_n(&sampleRequested[cpu->index], false,
+                           __ATOMIC_ACQUIRE)) {
+    auto serial = SerialPort();
+    serial.initialize();
+    libpara::formatting::format<"PANIC: Non-maskable interrupt at {:#x}\n">(
+        serial, frame->ip);
+    serial.flush();
+    asm volatile("cli ; hlt");
+  }
+  // the handler's frame holds the interrupted frame pointer
+  auto fp = static_cast<const usize *const *>(__builtin_frame_address(0));
+  kernel::profile::sample(frame->ip, *fp);
+}
+
+/**
+ * Starts sampling all other CPUs from current CPU, which must be able to
+ * take timer interrupts
+ */
+void start() {
+  timer::add(sampler, libpara::time::rdtsc() + sampler.period);
+}
+
+} // namespace kernel::platform::x86_64::profile
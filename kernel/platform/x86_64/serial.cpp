@@ -2,34 +2,138 @@ export module kernel.platform.x86_64.serial;
 
 import libpara.err;
 import libpara.basic_types;
+import libpara.ring;
+import libpara.sync;
 
 import kernel.devices.serial;
+import kernel.pmm;
 import kernel.platform;
+import kernel.platform.x86_64.idt;
+import kernel.platform.x86_64.ioapic;
+import kernel.platform.x86_64.lapic;
 import kernel.platform.x86_64.port;
+import kernel.platform.x86_64.virtio_console;
 
 using namespace libpara::err;
 using namespace libpara::basic_types;
 
+export namespace kernel::platform::x86_64::serial {
+
+const u8 SerialVector = 0x31;
+
+// COM1's ISA IRQ
+const u8 COM1IRQ = 4;
+
+const usize OutputBufferSize = 16384;
+
+// Depth of the 16550 transmit FIFO
+const usize FIFOSize = 16;
+
+// Rate of the UART's 1.8432 MHz clock divided by 16: the highest baud rate
+// a standard PC serial port can do (divisor 1)
+const u32 MaximumBaud = 115200;
+
+const u32 DefaultBaud = MaximumBaud;
+
+} // namespace kernel::platform::x86_64::serial
+
+using namespace kernel::platform::x86_64;
+using namespace kernel::platform::x86_64::serial;
+
 bool constinit is_initialized = false;
 
+// Output buffered for COM1, shared by all SerialPort instances
+constinit libpara::ring::ByteRing<OutputBufferSize> output;
+// Held by whoever is moving bytes from `output` to the UART
+constinit libpara::sync::Lock draining;
+// Set while a synchronous flush drains without holding `draining`, which
+// makes whoever holds it stop reading `output`
+constinit bool takenOver = false;
+// Set once the UART is configured and can transmit
+constinit bool transmitting = false;
+
+// Takes over all console output from the UART once attached
+constinit virtio::Console virtio_console;
+
+// How long a synchronous flush waits for another CPU to stop draining before
+// taking over
+const u32 FlushTakeoverSpins = 1 << 20;
+
+enum LineStatus : u8 {
+  TransmitHoldingEmpty = 0x20,
+  TransmitterEmpty = 0x40,
+};
+
+bool isTransmitEmpty(Port &port) {
+  return (port.in(5) & TransmitHoldingEmpty) != 0;
+}
+
+/**
+ * Moves buffered output to the UART for as long as it accepts bytes without
+ * waiting, a FIFO's worth at a time. Only one CPU drains at a time; others
+ * return immediately.
+ */
+void drain(Port &port) {
+  if (!__atomic_load_n(&transmitting, __ATOMIC_ACQUIRE))
+    return;
+  while (draining.tryLock()) {
+    while (output.canRead() && isTransmitEmpty(port) &&
+           !__atomic_load_n(&takenOver, __ATOMIC_ACQUIRE)) {
+      // the FIFO is empty too when the holding register is
+      u8 byte;
+      for (usize i = 0; i < FIFOSize && output.read(byte); i++)
+        port.out(0, byte);
+    }
+    draining.unlock();
+    // Bytes published while we held the lock can't be left waiting for an
+    // interrupt that will never come: one only comes after a transmission.
+    if (!output.canRead() || !isTransmitEmpty(port))
+      return;
+  }
+}
+
+export namespace kernel::platform::x86_64::serial {
+
+void serialInterrupt(idt::Context &context) {
+  Port port;
+  // acknowledges the transmitter holding register empty interrupt
+  port.in(2);
+  drain(port);
+  LocalAPIC().eoi();
+}
+
+} // namespace kernel::platform::x86_64::serial
+
 export namespace kernel::platform::x86_64 {
 
+/**
+ * Console output port: COM1, unless a virtio console has been attached with
+ * `impl<console>::select`
+ */
 class SerialPort : public kernel::devices::SerialPort {
   Port port;
+  u32 baud;
 
 public:
   using kernel::devices::SerialPort::write;
 
-  SerialPort() {}
+  /**
+   * COM1, running at `baud` once initialized. Only the first instance to be
+   * initialized determines the baud rate.
+   */
+  SerialPort(u32 baud = DefaultBaud) : baud(baud) {}
   virtual Result<nullptr_t> initialize() {
+    if (baud == 0 || baud > MaximumBaud || MaximumBaud % baud != 0)
+      return "UnsupportedBaudRate"_error;
     bool initialized = false;
     if (!__atomic_compare_exchange_n(&is_initialized, &initialized, true, false,
                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
       return nullptr;
-    port.out(1, 0x00); // Disable all interrupts
-    port.out(3, 0x80); // Enable DLAB (set baud rate divisor)
-    port.out(0, 0x03); // Set divisor to 3 (lo byte) 38400 baud
-    port.out(1, 0x00); //                  (hi byte)
+    u16 divisor = MaximumBaud / baud;
+    port.out(1, 0x00);         // Disable all interrupts
+    port.out(3, 0x80);         // Enable DLAB (set baud rate divisor)
+    port.out(0, divisor);      // Set divisor (lo byte)
+    port.out(1, divisor >> 8); //             (hi byte)
     port.out(3, 0x03); // 8 bits, no parity, one stop bit
     port.out(2, 0xC7); // Enable FIFO, clear them, with 14-byte threshold
     port.out(4, 0x0B); // IRQs enabled, RTS/DSR set
@@ -39,20 +143,72 @@ public:
 
     // Check if serial is faulty (i.e: not same byte as sent)
     if (port.in(0) != 0xAE)
-      return return_error("FaultySerialPort");
+      return "FaultySerialPort"_error;
 
     port.out(4, 0x0F);
+
+    // Transmitter holding register empty interrupts drain the output buffer
+    IOAPIC().route(COM1IRQ, SerialVector, LocalAPIC().id());
+    port.out(1, 0x02);
+    __atomic_store_n(&transmitting, true, __ATOMIC_RELEASE);
+    drain(port);
     return nullptr;
   }
 
-  virtual void write(const u8 b) {
-    while (!isTransmitEmpty()) {
+  /**
+   * Buffers `b` for transmission, never waiting for the UART
+   */
+  virtual void write(const u8 b) { write(&b, 1); }
+
+  /**
+   * Buffers `size` bytes for transmission as a whole, never waiting for the
+   * UART
+   */
+  virtual void write(const u8 *bytes, usize size) {
+    if (virtio_console.isAttached()) {
+      virtio_console.write(bytes, size);
+      return;
+    }
+    output.write(bytes, size);
+    drain(port);
+  }
+
+  /**
+   * Synchronously transmits all published output. Usable when panicking:
+   * if another CPU doesn't let go of the UART in time, it is taken over.
+   */
+  virtual void flush() {
+    virtio_console.flush();
+    if (!__atomic_load_n(&transmitting, __ATOMIC_ACQUIRE))
+      return;
+    bool locked = false;
+    for (u32 i = 0; i < FlushTakeoverSpins && !(locked = draining.tryLock());
+         i++)
+      __builtin_ia32_pause();
+    // the lock stays with its holder, who is only asked to stop
+    if (!locked)
+      __atomic_store_n(&takenOver, true, __ATOMIC_RELEASE);
+    while (output.canRead()) {
+      while (!isTransmitEmpty(port)) {
+      }
+      u8 byte;
+      for (usize i = 0; i < FIFOSize && output.read(byte); i++)
+        port.out(0, byte);
+    }
+    while ((port.in(5) & TransmitterEmpty) == 0) {
     }
-    port.out(0, b);
+    if (locked)
+      draining.unlock();
+    else
+      __atomic_store_n(&takenOver, false, __ATOMIC_RELEASE);
   }
 
-private:
-  bool isTransmitEmpty() { return (port.in(5) & 0x20) != 0; }
+  /**
+   * Number of bytes dropped because the output buffer was full
+   */
+  virtual u64 dropped() {
+    return output.dropped() + virtio_console.dropped();
+  }
 };
 
 } // namespace kernel::platform::x86_64
@@ -63,5 +219,16 @@ template <> struct impl<kernel::devices::SerialPort, kernel::platform::X86_64> {
   using type = kernel::platform::x86_64::SerialPort;
 };
 
-} // namespace kernel::platform
+template <> struct impl<kernel::platform::console, kernel::platform::X86_64> {
+  /**
+   * Moves console output to a virtio console if there is one (QEMU's
+   * `-device virtio-serial -device virtconsole`), as it is much faster than
+   * the UART
+   */
+  static const char *select(kernel::pmm::Allocator &allocator) {
+    auto attached = virtio_console.attach(allocator);
+    return attached.success() ? "virtio-console" : "COM1";
+  }
+};
 
+} // namespace kernel::platform
@@ -0,0 +1,140 @@
+export module kernel.platform.x86_64.timer;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.sync;
+import libpara.time;
+
+import kernel.cpu;
+import kernel.pmm;
+import kernel.timer;
+import kernel.trace;
+import kernel.platform.x86_64.cpu;
+import kernel.platform.x86_64.idt;
+import kernel.platform.x86_64.lapic;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+using interrupt_frame = kernel::platform::x86_64::idt::InterruptFrame;
+
+export namespace kernel::platform::x86_64::timer {
+
+const u8 TimerVector = 0x30;
+const u8 SpuriousVector = 0xFF;
+
+/**
+ * Period of the local APIC timer when TSC-deadline mode is not available
+ */
+const u64 PeriodicCycles = 1 << 20;
+
+enum class Mode : u8 { TSCDeadline, Periodic };
+
+} // namespace kernel::platform::x86_64::timer
+
+using namespace kernel::platform::x86_64;
+using namespace kernel::platform::x86_64::timer;
+
+// Timer configuration is the same on every CPU and is determined once
+constinit libpara::sync::Once configured;
+constinit Mode mode = Mode::Periodic;
+constinit u32 periodicCount = 0;
+
+/**
+ * Measures how many local APIC timer counts (at divide-by-16) elapse over
+ * `PeriodicCycles` TSC cycles
+ */
+u32 calibrate(LocalAPIC &lapic) {
+  lapic.write(LocalAPIC::TimerDivideConfiguration, 0x3);
+  lapic.write(LocalAPIC::LVTTimer, LocalAPIC::Masked);
+  lapic.write(LocalAPIC::TimerInitialCount, 0xFFFFFFFF);
+  auto start = libpara::time::rdtsc();
+  while (libpara::time::rdtsc() - start < PeriodicCycles) {
+    __builtin_ia32_pause();
+  }
+  auto elapsed = 0xFFFFFFFF - lapic.read(LocalAPIC::TimerCurrentCount);
+  lapic.write(LocalAPIC::TimerInitialCount, 0);
+  return elapsed;
+}
+
+void program(kernel::cpu::CPU &cpu) {
+  if (mode != Mode::TSCDeadline)
+    return;
+  auto deadline = cpu.timers->nextDeadline();
+  // zero disarms the timer
+  writeMSR(MSR::TSCDeadline,
+           deadline == kernel::timer::Wheel::Never ? 0 : deadline);
+}
+
+using TimerTick = kernel::trace::Tracepoint<"timer.tick", u64>;
+
+[[gnu::no_caller_saved_registers]] void tick() {
+  auto cpu = currentCPU();
+  auto now = libpara::time::rdtsc();
+  TimerTick::record(now);
+  cpu->timers->advance(now);
+  program(*cpu);
+  LocalAPIC().eoi();
+}
+
+export namespace kernel::platform::x86_64::timer {
+
+[[gnu::interrupt]] void timerISR(interrupt_frame *frame) { tick(); }
+
+[[gnu::interrupt]] void spuriousISR(interrupt_frame *frame) {}
+
+/**
+ * Sets up current CPU's timer wheel and local APIC timer
+ */
+Result<nothing> initialize(kernel::cpu::CPU &cpu) {
+  cpu.timers = new (tryUnwrap(
+      kernel::pmm::allocate<kernel::timer::Wheel>(cpu.allocator)))
+      kernel::timer::Wheel(libpara::time::rdtsc());
+
+  LocalAPIC lapic;
+  lapic.enable(SpuriousVector);
+
+  configured.call([&] {
+    if (hasTSCDeadline()) {
+      mode = Mode::TSCDeadline;
+    } else {
+      mode = Mode::Periodic;
+      periodicCount = calibrate(lapic);
+    }
+  });
+
+  if (mode == Mode::TSCDeadline) {
+    lapic.setTimer(TimerVector, LocalAPIC::TSCDeadline);
+  } else {
+    lapic.write(LocalAPIC::TimerDivideConfiguration, 0x3);
+    lapic.setTimer(TimerVector, LocalAPIC::Periodic);
+    lapic.write(LocalAPIC::TimerInitialCount, periodicCount);
+  }
+  return nothing{};
+}
+
+Mode currentMode() { return mode; }
+
+/**
+ * Arms `timer` on current CPU
+ */
+void add(kernel::timer::Timer &timer, u64 deadline) {
+  InterruptGuard guard;
+  auto cpu = currentCPU();
+  cpu->timers->add(timer, deadline);
+  program(*cpu);
+}
+
+/**
+ * Cancels `timer`, which must have been armed on current CPU
+ */
+void cancel(kernel::timer::Timer &timer) {
+  InterruptGuard guard;
+  auto cpu = currentCPU();
+  cpu->timers->cancel(timer);
+  program(*cpu);
+}
+
+} // namespace kernel::platform::x86_64::timer
@@ -0,0 +1,284 @@
+export module kernel.platform.x86_64.virtio_console;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.static_vector;
+import libpara.sync;
+
+import kernel.devices.serial;
+import kernel.pmm;
+import kernel.platform.x86_64.pci;
+import kernel.platform.x86_64.port;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::platform::x86_64::virtio {
+
+const u16 VendorID = 0x1AF4;
+// transitional virtio-console, which has the legacy I/O port interface
+const u16 ConsoleDeviceID = 0x1003;
+
+const auto NoLegacyInterfaceError = "VirtioNoLegacyInterface"_error;
+const auto UnsupportedQueueError = "VirtioUnsupportedQueue"_error;
+
+/**
+ * Legacy virtio PCI registers, at the start of the device's I/O BAR
+ */
+enum Register : u8 {
+  DeviceFeatures = 0x00,
+  DriverFeatures = 0x04,
+  QueueAddress = 0x08,
+  QueueSize = 0x0C,
+  QueueSelect = 0x0E,
+  QueueNotify = 0x10,
+  DeviceStatus = 0x12,
+  ISRStatus = 0x13,
+};
+
+enum Status : u8 {
+  Acknowledge = 1,
+  Driver = 2,
+  DriverOK = 4,
+  Failed = 128,
+};
+
+const usize QueueAlignment = 4096;
+
+struct Descriptor {
+  u64 address;
+  u32 length;
+  u16 flags;
+  u16 next;
+};
+
+struct UsedElement {
+  u32 id;
+  u32 length;
+};
+
+/**
+ * Split virtqueue in the legacy layout: descriptor table and available ring,
+ * followed by the used ring on the next `QueueAlignment` boundary
+ */
+class SplitQueue {
+  u16 size = 0;
+  Descriptor *descriptors = nullptr;
+  volatile u16 *available = nullptr;
+  volatile u16 *used = nullptr;
+
+  enum RingField : u8 { Flags = 0, Index = 1, Ring = 2 };
+
+  // the device doesn't need to be notified of new buffers
+  static const u16 NoNotify = 1;
+
+public:
+  constexpr SplitQueue() {}
+
+  static usize bytes(u16 size) {
+    return align(sizeof(Descriptor) * size + sizeof(u16) * (3 + size)) +
+           align(sizeof(u16) * 3 + sizeof(UsedElement) * size);
+  }
+
+  /**
+   * Lays the queue out in `memory`, which must be identity mapped, zeroed,
+   * aligned to `QueueAlignment` and `bytes(size)` long
+   */
+  SplitQueue(void *memory, u16 size)
+      : size(size), descriptors(reinterpret_cast<Descriptor *>(memory)),
+        available(reinterpret_cast<volatile u16 *>(descriptors + size)),
+        used(reinterpret_cast<volatile u16 *>(
+            reinterpret_cast<u8 *>(memory) +
+            align(sizeof(Descriptor) * size + sizeof(u16) * (3 + size)))) {}
+
+  u16 capacity() const { return size; }
+
+  Descriptor &descriptor(u16 index) { return descriptors[index]; }
+
+  /**
+   * Exposes descriptor `index` to the device. It only sees it after
+   * `publish()`.
+   */
+  void push(u16 position, u16 index) {
+    available[Ring + position % size] = index;
+  }
+
+  /**
+   * Makes all pushed descriptors (up to `position`) visible to the device,
+   * returning whether it wants to be notified
+   */
+  bool publish(u16 position) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    available[Index] = position;
+    // the index update must be visible before checking the device's flags
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return (used[Flags] & NoNotify) == 0;
+  }
+
+  /**
+   * Number of buffers the device has returned so far (wrapping around)
+   */
+  u16 usedIndex() const {
+    auto index = used[Index];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return index;
+  }
+
+  /**
+   * Descriptor the device returned at `position`, which must be before
+   * `usedIndex()`. The device may return them in any order.
+   */
+  u16 usedDescriptor(u16 position) const {
+    auto ring = reinterpret_cast<volatile const UsedElement *>(used + Ring);
+    return static_cast<u16>(ring[position % size].id);
+  }
+
+private:
+  static usize align(usize n) {
+    return (n + QueueAlignment - 1) & ~(QueueAlignment - 1);
+  }
+};
+
+/**
+ * Output-only driver for the first port of a virtio console, using the
+ * legacy (virtio 0.9.5) interface
+ *
+ * Every transmit descriptor has its own identity mapped buffer. A write
+ * fills as many of them as it needs, and all of them are handed to the
+ * device with a single index update and (at most) one notification. Writes
+ * that find no free buffers are dropped and counted, just like with the
+ * UART, so they never wait for the host. Buffers are freed as the device
+ * returns their descriptors in the used ring, in whatever order it does.
+ */
+class Console : public kernel::devices::SerialPort {
+public:
+  static const u16 TransmitQueue = 1;
+  static const usize BufferSize = 2048;
+  // bounds memory use on devices with large queues
+  static const u16 MaxBuffers = 64;
+  // how long a flush waits for a host that stopped consuming output
+  static const u32 FlushSpins = 1 << 24;
+
+private:
+  Port port;
+  SplitQueue transmit;
+  u8 *buffers = nullptr;
+  u16 buffer_count = 0;
+  // descriptors the device doesn't own
+  libpara::static_vector::StaticVector<u16, MaxBuffers> free;
+  // descriptors handed to the device, wrapping around
+  u16 submitted = 0;
+  // used ring entries whose descriptors are back in `free`, wrapping around
+  u16 reclaimed = 0;
+  u64 drops = 0;
+  libpara::sync::Lock lock;
+
+public:
+  using kernel::devices::SerialPort::write;
+
+  constexpr Console() {}
+
+  /**
+   * Finds and sets up the device, taking the memory it shares with the
+   * device from `allocator`
+   */
+  Result<nothing> attach(kernel::pmm::Allocator &allocator) {
+    auto function = tryUnwrap(pci::find(VendorID, ConsoleDeviceID));
+    auto bar = function.read32(pci::BAR0);
+    if ((bar & 1) == 0)
+      return NoLegacyInterfaceError;
+    function.enable();
+    port = Port(static_cast<u16>(bar & ~3U));
+
+    port.out(DeviceStatus, 0);
+    port.out(DeviceStatus, Acknowledge);
+    port.out(DeviceStatus, Acknowledge | Driver);
+    // no optional features: a single port, no event index
+    port.out32(DriverFeatures, 0);
+
+    port.out16(QueueSelect, TransmitQueue);
+    auto size = port.in16(QueueSize);
+    if (size == 0 || (size & (size - 1)) != 0) {
+      port.out(DeviceStatus, Failed);
+      return UnsupportedQueueError;
+    }
+    auto bytes = SplitQueue::bytes(size);
+    auto memory = reinterpret_cast<u8 *>(
+        tryUnwrap(allocator.allocate(bytes, QueueAlignment)));
+    for (usize i = 0; i < bytes; i++)
+      memory[i] = 0;
+    transmit = SplitQueue(memory, size);
+
+    buffer_count = size < MaxBuffers ? size : MaxBuffers;
+    buffers = reinterpret_cast<u8 *>(
+        tryUnwrap(allocator.allocate(buffer_count * BufferSize, 64)));
+    for (u16 i = 0; i < buffer_count; i++)
+      free.push(i);
+
+    // legacy devices take the queue's page frame number
+    port.out32(QueueAddress,
+               static_cast<u32>(reinterpret_cast<usize>(memory) >> 12));
+    port.out(DeviceStatus, Acknowledge | Driver | DriverOK);
+    return nothing{};
+  }
+
+  bool isAttached() const { return buffers != nullptr; }
+
+  virtual Result<nullptr_t> initialize() { return nullptr; }
+
+  virtual void write(const u8 b) { write(&b, 1); }
+
+  virtual void write(const u8 *bytes, usize size) {
+    if (!isAttached() || size == 0)
+      return;
+    lock.lock();
+    for (auto used = transmit.usedIndex(); reclaimed != used; reclaimed++) {
+      auto index = transmit.usedDescriptor(reclaimed);
+      // ids the driver never handed out would alias buffers still in use
+      if (index < buffer_count)
+        free.push(index);
+    }
+    auto needed = (size + BufferSize - 1) / BufferSize;
+    if (needed > free.size()) {
+      drops += size;
+      lock.unlock();
+      return;
+    }
+    auto position = submitted;
+    for (usize offset = 0; offset < size; offset += BufferSize, position++) {
+      u16 index = free.last();
+      free.pop();
+      auto buffer = buffers + index * BufferSize;
+      auto length = size - offset < BufferSize ? size - offset : BufferSize;
+      for (usize i = 0; i < length; i++)
+        buffer[i] = bytes[offset + i];
+      transmit.descriptor(index) =
+          Descriptor{.address = reinterpret_cast<u64>(buffer),
+                     .length = static_cast<u32>(length)};
+      transmit.push(position, index);
+    }
+    __atomic_store_n(&submitted, position, __ATOMIC_RELEASE);
+    if (transmit.publish(position))
+      port.out16(QueueNotify, TransmitQueue);
+    lock.unlock();
+  }
+
+  /**
+   * Waits until the device has consumed everything written so far, or gives
+   * up after `FlushSpins`
+   */
+  virtual void flush() {
+    if (!isAttached())
+      return;
+    // not taking the lock, which a panicking CPU may be holding
+    auto pending = __atomic_load_n(&submitted, __ATOMIC_ACQUIRE);
+    for (u32 i = 0; i < FlushSpins && transmit.usedIndex() != pending; i++)
+      __builtin_ia32_pause();
+  }
+
+  virtual u64 dropped() { return __atomic_load_n(&drops, __ATOMIC_RELAXED); }
+};
+
+} // namespace kernel::platform::x86_64::virtio
@@ -2,6 +2,7 @@ export module kernel.pmm;
 
 import libpara.err;
 import libpara.basic_types;
+import libpara.static_vector;
 import libpara.sync;
 
 using namespace libpara::err;
@@ -10,8 +11,6 @@ using namespace libpara::sync;
 
 #include <err.hpp>
 
-export void *operator new(unsigned long sz, void *ptr) { return ptr; }
-
 export namespace kernel::pmm {
 
 template <typename T>
@@ -19,8 +18,8 @@ concept allocator = requires(T a, usize size, usize alignment) {
   {a.allocate(size, alignment)};
 };
 
-const auto OutOfMemoryError = Error("OutOfMemory");
-const auto OverlappedMemoryError = Error("OverlappedMemory");
+const auto OutOfMemoryError = "OutOfMemory"_error;
+const auto OverlappedMemoryError = "OverlappedMemory"_error;
 
 class Allocator {
 
@@ -83,31 +82,29 @@ public:
 
 template <allocator A, int sz> class ChainedAllocator : public Allocator {
 
-  A allocators[sz] = {};
-  int added_allocators = 0;
+  libpara::static_vector::StaticVector<A, sz> allocators;
 
 public:
   constexpr ChainedAllocator() {}
 
   Result<int> addAllocator(A &&allocator) {
-    if (added_allocators + 1 > sz) {
+    if (allocators.isFull()) {
       return OutOfMemoryError;
     }
-    for (int i = 0; i < added_allocators; i++) {
-      if (allocators[i].overlaps(allocator))
+    for (auto &added : allocators) {
+      if (added.overlaps(allocator))
         return OverlappedMemoryError;
     }
-    allocators[added_allocators] = allocator;
-    added_allocators++;
-    return added_allocators;
+    allocators.push(allocator);
+    return static_cast<int>(allocators.size());
   }
 
   A &getAllocator(int index) { return allocators[index]; }
 
   virtual Result<void *> allocate(usize size, usize alignment) {
-    for (int i = 0; i < added_allocators; i++) {
-      auto alloc = allocators[i].allocate(size, alignment);
-      if (alloc.success || alloc != OutOfMemoryError)
+    for (auto &allocator : allocators) {
+      auto alloc = allocator.allocate(size, alignment);
+      if (alloc.success() || alloc != OutOfMemoryError)
         return alloc;
     }
     return OutOfMemoryError;
@@ -115,15 +112,15 @@ public:
 
   virtual usize availableMemory() {
     usize available = 0;
-    for (int i = 0; i < added_allocators; i++) {
-      available += allocators[i].availableMemory();
+    for (auto &allocator : allocators) {
+      available += allocator.availableMemory();
     }
     return available;
   }
 
   virtual bool overlaps(void *another_ptr) {
-    for (int i = 0; i < added_allocators; i++) {
-      if (allocators[i].overlaps(another_ptr))
+    for (auto &allocator : allocators) {
+      if (allocator.overlaps(another_ptr))
         return true;
     }
     return false;
@@ -158,7 +155,7 @@ public:
           WatermarkAllocator(reinterpret_cast<void *>(base), 1024 * 1024);
       Expect(alloc.availableMemory() == 1024 * 1024);
       Result<u64 *> a = kernel::pmm::allocate<u64>(alloc);
-      Expect(a.success);
+      Expect(a.success());
       Expect(reinterpret_cast<usize>(*a) - base == 0);
       Expect(alloc.availableMemory() == 1024 * 1024 - sizeof(u64));
     }
@@ -170,7 +167,7 @@ public:
           WatermarkAllocator(reinterpret_cast<void *>(base), 1024 * 1024);
       Expect(alloc.availableMemory() == 1024 * 1024);
       Result<u8 *> a = kernel::pmm::allocate<u8>(alloc);
-      Expect(a.success);
+      Expect(a.success());
       Expect(reinterpret_cast<usize>(*a) - base == 0);
       Expect(alloc.availableMemory() == 1024 * 1024 - sizeof(u8));
 
@@ -185,11 +182,11 @@ public:
       Expect(alloc
                  .addAllocator(
                      WatermarkAllocator(reinterpret_cast<void *>(0x0), 1024))
-                 .success);
+                 .success());
       Expect(alloc
                  .addAllocator(
                      WatermarkAllocator(reinterpret_cast<void *>(0x1000), 1024))
-                 .success);
+                 .success());
       Expect(alloc.availableMemory() == 1024 * 2);
       kernel::pmm::allocate<u8[1024]>(alloc);
       Expect(alloc.getAllocator(0).availableMemory() == 0);
@@ -197,9 +194,43 @@ public:
       kernel::pmm::allocate<u8[1024]>(alloc);
       Expect(alloc.availableMemory() == 0);
       Expect(alloc.getAllocator(1).availableMemory() == 0);
-      Expect(!kernel::pmm::allocate<u8[1024]>(alloc).success);
+      Expect(!kernel::pmm::allocate<u8[1024]>(alloc).success());
     }
   }
 };
 } // namespace kernel::pmm::tests
 
+import libpara.bench;
+
+export namespace kernel::pmm::benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+
+  static void *address(usize address) {
+    return reinterpret_cast<void *>(address);
+  }
+
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    using libpara::bench::keep;
+
+    // allocators only hand out addresses, so none of this memory needs to
+    // exist
+    auto watermark = WatermarkAllocator(address(0), 1ULL << 46);
+    measure("pmm.watermark.allocate",
+            [&] { keep(watermark.allocate(64, 16)); });
+
+    // allocations go past three exhausted allocators first
+    auto chained = ChainedAllocator<WatermarkAllocator, 4>();
+    for (usize i = 0; i < 3; i++) {
+      chained.addAllocator(WatermarkAllocator(address(i * 4096), 64));
+      chained.allocate(64, 16);
+    }
+    chained.addAllocator(WatermarkAllocator(address(1ULL << 40), 1ULL << 46));
+    measure("pmm.chained.allocate", [&] { keep(chained.allocate(64, 16)); });
+  }
+};
+
+} // namespace kernel::pmm::benchmarks
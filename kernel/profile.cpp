@@ -0,0 +1,280 @@
+export module kernel.profile;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.formatting;
+import libpara.time;
+
+import kernel.cpu;
+import kernel.pmm;
+import kernel.platform.x86_64.cpu;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::profile {
+
+/**
+ * Whether CPUs are sampled. Sampling needs frame pointers, which `make
+ * PROFILE=true` keeps.
+ */
+#ifdef PROFILE
+constexpr bool Enabled = true;
+#else
+constexpr bool Enabled = false;
+#endif
+
+/**
+ * Deepest call stack recorded, including the interrupted instruction
+ */
+const u8 MaxDepth = 32;
+
+/**
+ * Size of every CPU's sample buffer, in 64-bit words
+ */
+const usize BufferWords = 1 << 16;
+
+/**
+ * Largest frame followed when unwinding
+ */
+const usize MaxFrameSize = 64 * 1024;
+
+/**
+ * Walks the frame pointer chain starting at `fp` (the interrupted code's
+ * frame), writing `ip` and then return addresses to `frames`. Returns the
+ * number of frames written.
+ *
+ * Every next frame must be above the previous one and reasonably close, so
+ * that code without a frame pointer ends the walk rather than derails it.
+ */
+inline u8 unwind(usize ip, const usize *fp, usize *frames, u8 max) {
+  u8 depth = 0;
+  if (max == 0)
+    return 0;
+  frames[depth++] = ip;
+  while (depth < max && fp != nullptr &&
+         reinterpret_cast<usize>(fp) % sizeof(usize) == 0) {
+    auto next = reinterpret_cast<const usize *>(fp[0]);
+    auto ret = fp[1];
+    if (ret == 0)
+      break;
+    frames[depth++] = ret;
+    if (next <= fp || reinterpret_cast<usize>(next) -
+                              reinterpret_cast<usize>(fp) >
+                          MaxFrameSize)
+      break;
+    fp = next;
+  }
+  return depth;
+}
+
+/**
+ * Call stacks sampled on a single CPU, each stored as its depth followed by
+ * its frames (innermost first). Once full, further samples are dropped and
+ * counted.
+ */
+template <usize words> class Samples {
+  u64 buffer[words] = {};
+  u64 used = 0;
+  u64 drops = 0;
+
+public:
+  constexpr Samples() {}
+  Samples(Samples &) = delete;
+
+  void record(const usize *frames, u8 depth) {
+    if (used + 1 + depth > words) {
+      drops++;
+      return;
+    }
+    buffer[used] = depth;
+    for (u8 i = 0; i < depth; i++)
+      buffer[used + 1 + i] = frames[i];
+    __atomic_store_n(&used, used + 1 + depth, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Calls `f(frames, depth)` with every sample, oldest first
+   */
+  template <typename F> void forEach(F &&f) const {
+    auto end = __atomic_load_n(&used, __ATOMIC_ACQUIRE);
+    for (u64 position = 0; position < end; position += 1 + buffer[position])
+      f(&buffer[position + 1], static_cast<u8>(buffer[position]));
+  }
+
+  u64 dropped() const { return drops; }
+
+  void clear() {
+    __atomic_store_n(&used, 0, __ATOMIC_RELEASE);
+    drops = 0;
+  }
+};
+
+using CPUSamples = Samples<BufferWords>;
+
+// Sample buffers, indexed by CPU table index
+constinit CPUSamples *buffers[kernel::cpu::MaxCPUs] = {};
+// platform IDs of CPUs with sample buffers, for the platform's sampler
+constinit u16 ids[kernel::cpu::MaxCPUs] = {};
+// whether samples are taken, and CPUs interrupted for them
+constinit bool sampling = true;
+
+inline bool isSampling() {
+  return __atomic_load_n(&sampling, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stops taking samples, and interrupting CPUs for them, until `resume()`
+ */
+inline void pause() { __atomic_store_n(&sampling, false, __ATOMIC_SEQ_CST); }
+
+inline void resume() { __atomic_store_n(&sampling, true, __ATOMIC_SEQ_CST); }
+
+/**
+ * Sets up current CPU's sample buffer, which makes it a sampling target
+ */
+Result<nothing> initialize(kernel::cpu::CPU &cpu,
+                           kernel::pmm::Allocator &allocator) {
+  if constexpr (Enabled) {
+    auto samples = new (tryUnwrap(kernel::pmm::allocate<CPUSamples>(
+        allocator))) CPUSamples();
+    ids[cpu.index] = cpu.id;
+    __atomic_store_n(&buffers[cpu.index], samples, __ATOMIC_RELEASE);
+  }
+  return nothing{};
+}
+
+/**
+ * Records the call stack of the code current CPU was running when it was
+ * interrupted at `ip`, with `fp` as its frame pointer. Called by the
+ * platform's sampling interrupt handler.
+ */
+inline void sample(usize ip, const usize *fp) {
+  if constexpr (Enabled) {
+    if (!isSampling())
+      return;
+    // not `impl<current_cpu>`, which is defined in kernel.platform.x86_64:
+    // that imports the platform's sampler, and so this module
+    auto buffer = buffers[kernel::platform::x86_64::currentCPU()->index];
+    if (buffer == nullptr)
+      return;
+    usize frames[MaxDepth];
+    buffer->record(frames, unwind(ip, fp, frames, MaxDepth));
+  }
+}
+
+/**
+ * Writes out all samples for `tools/fold-profile.py` and clears the
+ * buffers. Sampling is paused meanwhile.
+ */
+template <libpara::formatting::writer W>
+void dump(W &writer, const kernel::cpu::Table &cpus) {
+  using libpara::formatting::format;
+  using libpara::formatting::hex;
+  pause();
+  format(writer, "profile: begin ", libpara::time::clock.frequency(), "\n");
+  for (u16 i = 0; i < cpus.size(); i++) {
+    auto buffer = __atomic_load_n(&buffers[cpus[i].index], __ATOMIC_ACQUIRE);
+    if (buffer == nullptr)
+      continue;
+    buffer->forEach([&](const u64 *frames, u8 depth) {
+      format(writer, "profile: stack ", cpus[i].id);
+      for (u8 f = 0; f < depth; f++)
+        format(writer, " ", hex(frames[f]));
+      format(writer, "\n");
+    });
+    if (buffer->dropped() > 0)
+      format(writer, "profile: dropped ", cpus[i].id, " ", buffer->dropped(),
+             "\n");
+    buffer->clear();
+  }
+  format(writer, "profile: end\n");
+  resume();
+}
+
+} // namespace kernel::profile
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace kernel::profile::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Unwinding follows frame pointers");
+    {
+      // three frames, as pushed by `push %rbp ; mov %rsp, %rbp`
+      usize stack[8] = {};
+      stack[0] = reinterpret_cast<usize>(&stack[2]);
+      stack[1] = 0x1001;
+      stack[2] = reinterpret_cast<usize>(&stack[6]);
+      stack[3] = 0x2002;
+      stack[6] = 0;
+      stack[7] = 0x3003;
+      usize frames[MaxDepth];
+      auto depth = unwind(0x500, stack, frames, MaxDepth);
+      Expect(depth == 4);
+      Expect(frames[0] == 0x500);
+      Expect(frames[1] == 0x1001 && frames[2] == 0x2002);
+      Expect(frames[3] == 0x3003);
+      Expect(unwind(0x500, stack, frames, 2) == 2);
+      Expect(unwind(0x500, nullptr, frames, MaxDepth) == 1);
+    }
+
+    test("Unwinding stops at frames going down");
+    {
+      usize stack[4] = {};
+      stack[2] = reinterpret_cast<usize>(&stack[0]);
+      stack[3] = 0x1001;
+      usize frames[MaxDepth];
+      Expect(unwind(0x500, &stack[2], frames, MaxDepth) == 2);
+    }
+
+    test("Samples read back recorded stacks");
+    {
+      Samples<16> samples;
+      const usize a[] = {1, 2, 3};
+      const usize b[] = {4};
+      samples.record(a, 3);
+      samples.record(b, 1);
+      u32 count = 0;
+      bool matches = true;
+      samples.forEach([&](const u64 *frames, u8 depth) {
+        if (count == 0)
+          matches = matches && depth == 3 && frames[0] == 1 &&
+                    frames[2] == 3;
+        else
+          matches = matches && depth == 1 && frames[0] == 4;
+        count++;
+      });
+      Expect(count == 2);
+      Expect(matches);
+    }
+
+    test("Samples drop stacks that don't fit");
+    {
+      Samples<8> samples;
+      const usize a[] = {1, 2, 3};
+      samples.record(a, 3);
+      samples.record(a, 3);
+      samples.record(a, 3);
+      u32 count = 0;
+      samples.forEach([&](const u64 *, u8) { count++; });
+      Expect(count == 2);
+      Expect(samples.dropped() == 1);
+      samples.clear();
+      count = 0;
+      samples.forEach([&](const u64 *, u8) { count++; });
+      Expect(count == 0 && samples.dropped() == 0);
+    }
+  }
+};
+
+} // namespace kernel::profile::tests
@@ -1,32 +1,70 @@
 export module kernel.testing;
 
 import libpara.basic_types;
+import libpara.bench;
+import libpara.bitset;
 import libpara.testing;
 import libpara.err;
+import libpara.formatting;
+import libpara.formatting.tests;
+import libpara.hash_table;
+import libpara.intrusive;
 import libpara.loop;
+import libpara.random;
+import libpara.ring;
+import libpara.span;
+import libpara.static_vector;
+import libpara.sync;
+import libpara.time;
+import libpara.xxh3;
+import libpara.xxh64;
+import kernel.environment;
 import kernel.pmm;
+import kernel.profile;
+import kernel.timeline;
+import kernel.timer;
+import kernel.torture;
+import kernel.trace;
+import kernel.devices.framebuffer;
 import kernel.devices.serial;
 import kernel.platform;
 import kernel.platform.x86_64;
+import kernel.platform.x86_64.interrupts;
+import kernel.platform.x86_64.memory;
 
 using namespace libpara::basic_types;
+using namespace libpara::formatting;
 
 export namespace kernel::testing {
 
-class SerialConsoleSink : public libpara::testing::TestCaseSink {
+/**
+ * What running a test case produced
+ */
+struct Record {
+  static const usize OutputSize = 4096;
 
-  using serial_port_t =
-      kernel::platform::impl<kernel::devices::SerialPort>::type;
+  char output[OutputSize];
+  usize size = 0;
+  bool truncated = false;
+  int errors = 0;
+  u16 cpu = 0;
+  u64 cycles = 0;
+  // set last, once the rest of the record is
+  bool done = false;
+};
 
-  serial_port_t &serial_port;
+/**
+ * Keeps a test case's output in its record, so that test cases running on
+ * different CPUs don't interleave their output
+ */
+class RecordingSink : public libpara::testing::TestCaseSink {
+
+  Record &record;
   const char *in_test = nullptr;
   bool errored = false;
 
-  int errors = 0;
-
 public:
-  SerialConsoleSink(serial_port_t &serial_port) : serial_port(serial_port) {}
-  ~SerialConsoleSink() { serial_port.write("\n"); }
+  RecordingSink(Record &record) : record(record) {}
 
   virtual void test(const char *name) {
     testComplete();
@@ -37,7 +75,7 @@ public:
   virtual void testComplete() {
     if (in_test != nullptr) {
       if (!errored)
-        serial_port.write(".");
+        write(".");
       in_test = nullptr;
       errored = false;
     }
@@ -46,41 +84,198 @@ public:
   virtual void report(bool success, const char *message = "",
                       const char *file = nullptr, const char *line = nullptr) {
     if (!success) {
-      errors++;
-      if (!errored) {
-        errored = true;
-      }
-      serial_port.write("\n[!] Failure: ");
-      serial_port.write(in_test);
-      serial_port.write(": ");
-      serial_port.write(message);
-      serial_port.write(" at ");
+      record.errors++;
+      errored = true;
+      write("\n[!] Failure: ");
+      write(in_test);
+      write(": ");
+      write(message);
+      write(" at ");
       if (file != nullptr) {
-        serial_port.write(file);
+        write(file);
         if (line != nullptr) {
-          serial_port.write(":");
-          serial_port.write(line);
+          write(":");
+          write(line);
         }
       }
-      serial_port.write("\n");
+      write("\n");
     }
   };
 
+  virtual void write(const char *s) {
+    for (; *s != 0; s++) {
+      if (record.size == Record::OutputSize) {
+        record.truncated = true;
+        return;
+      }
+      record.output[record.size++] = *s;
+    }
+  }
+};
+
+/**
+ * Writes records to the serial console
+ */
+class SerialConsoleSink : public libpara::testing::TestCaseSink {
+
+  using serial_port_t =
+      kernel::platform::impl<kernel::devices::SerialPort>::type;
+
+  serial_port_t &serial_port;
+
+  int errors = 0;
+
+public:
+  SerialConsoleSink(serial_port_t &serial_port) : serial_port(serial_port) {}
+  ~SerialConsoleSink() {
+    serial_port.write("\n");
+    serial_port.flush();
+  }
+
+  void merge(const Record &record) {
+    serial_port.write(reinterpret_cast<const u8 *>(record.output),
+                      record.size);
+    if (record.truncated)
+      serial_port.write("\n[!] Output truncated\n");
+    errors += record.errors;
+    // tests run with interrupts disabled, so output doesn't drain on its own
+    serial_port.flush();
+  }
+
+  using libpara::testing::TestCaseSink::write;
+
   virtual void write(const char *s) { serial_port.write(s); }
 
   bool hadAnyErrors() const { return errors > 0; }
 };
 
-inline void run() {
+/**
+ * A test case, named for the timing report
+ */
+struct Suite {
+  const char *name;
+  void (*start)(libpara::testing::TestCaseSink &sink);
+};
+
+template <typename T> void start(libpara::testing::TestCaseSink &sink) {
+  T(sink).start();
+}
+
+constinit const Suite suites[] = {
+    {"libpara.bench", start<libpara::bench::tests::TestCase>},
+    {"libpara.bitset", start<libpara::bitset::tests::TestCase>},
+    {"libpara.err", start<libpara::err::tests::TestCase>},
+    {"libpara.formatting", start<libpara::formatting::tests::TestCase>},
+    {"libpara.hash_table", start<libpara::hash_table::tests::TestCase>},
+    {"libpara.intrusive", start<libpara::intrusive::tests::TestCase>},
+    {"libpara.loop", start<libpara::loop::tests::TestCase>},
+    {"libpara.random", start<libpara::random::tests::TestCase>},
+    {"libpara.ring", start<libpara::ring::tests::TestCase>},
+    {"libpara.span", start<libpara::span::tests::TestCase>},
+    {"libpara.static_vector",
+     start<libpara::static_vector::tests::TestCase>},
+    {"libpara.sync", start<libpara::sync::tests::TestCase>},
+    {"libpara.time", start<libpara::time::tests::TestCase>},
+    {"libpara.xxh64", start<libpara::xxh64_tests::TestCase>},
+    {"libpara.xxh3", start<libpara::xxh3::tests::TestCase>},
+    {"kernel.environment", start<kernel::environment::tests::TestCase>},
+    {"kernel.pmm", start<kernel::pmm::tests::TestCase>},
+    {"kernel.profile", start<kernel::profile::tests::TestCase>},
+    {"kernel.timeline", start<kernel::timeline::tests::TestCase>},
+    {"kernel.timer", start<kernel::timer::tests::TestCase>},
+    {"kernel.trace", start<kernel::trace::tests::TestCase>},
+    {"kernel.devices.framebuffer",
+     start<kernel::devices::framebuffer::tests::TestCase>},
+    {"kernel.platform.x86_64.interrupts",
+     start<kernel::platform::x86_64::interrupts::tests::TestCase>},
+    {"kernel.platform.x86_64.memory",
+     start<kernel::platform::x86_64::memory::tests::TestCase>},
+};
+
+const usize Suites = sizeof(suites) / sizeof(Suite);
+
+// one record per suite, and the last one for the SMP torture suite
+constinit Record records[Suites + 1];
+
+// index of the next suite to be claimed by a CPU
+constinit usize next = 0;
+
+// all CPUs, once they have run out of suites to claim
+constinit kernel::torture::Team team;
+
+/**
+ * Runs `f(sink)` on the calling CPU, keeping what it wrote to `sink` in
+ * `record`
+ */
+template <typename F> void recordRun(Record &record, F &&f) {
+  {
+    RecordingSink sink(record);
+    libpara::time::Stopwatch stopwatch;
+    f(sink);
+    record.cycles = stopwatch.elapsed();
+  }
+  record.cpu = kernel::platform::impl<kernel::platform::cpuid>::function();
+  __atomic_store_n(&record.done, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Claims the next suite and runs it on the calling CPU, returning false once
+ * there are none left
+ */
+inline bool runNext() {
+  auto index = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED);
+  if (index >= Suites)
+    return false;
+  recordRun(records[index], suites[index].start);
+  return true;
+}
+
+/**
+ * Runs the tests on all `cpus` CPUs, each of which must call it. They claim
+ * suites off a shared queue until none are left, and then run the SMP
+ * torture suite together, randomized by `seed`.
+ *
+ * The bootstrap CPU writes the records to the serial console in the order
+ * suites are listed (as soon as they and all before them are done), followed
+ * by their timings, and exits the emulator; other CPUs return.
+ */
+inline void run(bool bootstrap, u16 cpus,
+                u64 seed = kernel::torture::DefaultSeed) {
+  if (!bootstrap) {
+    while (runNext())
+      ;
+    kernel::torture::test(team, team.join());
+    return;
+  }
+
   bool hadAnyErrors = false;
   {
     kernel::platform::impl<kernel::devices::SerialPort>::type serial;
     serial.initialize();
     auto sink = SerialConsoleSink(serial);
+    libpara::time::Stopwatch stopwatch;
+
+    usize merged = 0;
+    auto mergeDone = [&] {
+      while (merged <= Suites &&
+             __atomic_load_n(&records[merged].done, __ATOMIC_ACQUIRE))
+        sink.merge(records[merged++]);
+    };
+    while (runNext())
+      mergeDone();
+    recordRun(records[Suites], [&](libpara::testing::TestCaseSink &record) {
+      kernel::torture::test(team, team.lead(cpus, record, seed));
+    });
+    for (mergeDone(); merged <= Suites; mergeDone())
+      __builtin_ia32_pause();
+    auto total = stopwatch.elapsed();
 
-    libpara::err::tests::TestCase(sink).start();
-    libpara::loop::tests::TestCase(sink).start();
-    kernel::pmm::tests::TestCase(sink).start();
+    sink.write("\n");
+    for (usize i = 0; i <= Suites; i++)
+      format(sink, "[t] ", i < Suites ? suites[i].name : "kernel.torture",
+             ": ", records[i].cycles, " cycles on CPU #", records[i].cpu,
+             "\n");
+    format(sink, "[t] total: ", total, " cycles\n");
     hadAnyErrors = sink.hadAnyErrors();
   }
   kernel::platform::impl<kernel::platform::exit_emulator>::function(
@@ -88,4 +283,3 @@ inline void run() {
 }
 
 } // namespace kernel::testing
-
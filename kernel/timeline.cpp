@@ -0,0 +1,192 @@
+export module kernel.timeline;
+
+import libpara.basic_types;
+import libpara.formatting;
+import libpara.time;
+
+import kernel.cpu;
+
+using namespace libpara::basic_types;
+
+export namespace kernel::timeline {
+
+/**
+ * Points of the boot that every CPU reaching them records
+ */
+enum class Milestone : u8 {
+  // `bootboot_main` was entered
+  Entered,
+  // the loader's memory map is handed over to the allocator (BSP)
+  MemoryMapped,
+  // platform setup (descriptor tables, interrupts, timer) is done
+  PlatformInitialized,
+  // the serial console is ready (BSP)
+  ConsoleReady,
+  Online,
+  Failed,
+};
+
+inline const char *describe(Milestone milestone) {
+  switch (milestone) {
+  case Milestone::Entered:
+    return "kernel entered";
+  case Milestone::MemoryMapped:
+    return "memory map ingested";
+  case Milestone::PlatformInitialized:
+    return "platform initialized";
+  case Milestone::ConsoleReady:
+    return "console ready";
+  case Milestone::Online:
+    return "online";
+  case Milestone::Failed:
+    return "failed";
+  }
+  return "?";
+}
+
+struct Mark {
+  u64 timestamp = 0;
+  u16 cpu = 0;
+  Milestone milestone = Milestone::Entered;
+  bool published = false;
+};
+
+/**
+ * Milestones in a fixed buffer, filled by all CPUs at once. Recording one
+ * costs a timestamp and an atomic increment, so it's never compiled out.
+ * Marks that don't fit are counted and dropped.
+ */
+template <usize capacity> class Timeline {
+  Mark marks[capacity] = {};
+  usize reserved = 0;
+
+public:
+  constexpr Timeline() {}
+  Timeline(Timeline &) = delete;
+
+  void record(Milestone milestone, u16 cpu, u64 timestamp) {
+    auto slot = __atomic_fetch_add(&reserved, 1, __ATOMIC_RELAXED);
+    if (slot >= capacity)
+      return;
+    marks[slot].timestamp = timestamp;
+    marks[slot].cpu = cpu;
+    marks[slot].milestone = milestone;
+    __atomic_store_n(&marks[slot].published, true, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Calls `f` with every recorded mark, earliest first. Marks are sorted in
+   * place, so no CPU may be recording meanwhile.
+   */
+  template <typename F> void forEach(F &&f) {
+    auto n = size();
+    for (usize i = 1; i < n; i++)
+      for (usize j = i; j > 0 && marks[j - 1].timestamp > marks[j].timestamp;
+           j--) {
+        auto mark = marks[j];
+        marks[j] = marks[j - 1];
+        marks[j - 1] = mark;
+      }
+    for (usize i = 0; i < n; i++)
+      if (__atomic_load_n(&marks[i].published, __ATOMIC_ACQUIRE))
+        f(marks[i]);
+  }
+
+  usize size() const {
+    auto n = __atomic_load_n(&reserved, __ATOMIC_RELAXED);
+    return n < capacity ? n : capacity;
+  }
+
+  usize dropped() const {
+    auto n = __atomic_load_n(&reserved, __ATOMIC_RELAXED);
+    return n > capacity ? n - capacity : 0;
+  }
+};
+
+/**
+ * Room for every CPU to record every milestone
+ */
+const usize MaxMarks = 6 * kernel::cpu::MaxCPUs;
+
+constinit Timeline<MaxMarks> boot;
+
+/**
+ * Records that the CPU with platform ID `cpu` reached `milestone`
+ */
+inline void record(Milestone milestone, u16 cpu,
+                   u64 timestamp = libpara::time::rdtsc()) {
+  boot.record(milestone, cpu, timestamp);
+}
+
+/**
+ * Writes the boot timeline as a table. Times count from the TSC reset, so
+ * the first mark is also how long the firmware and loader took. They are
+ * in microseconds once the clock is calibrated, and in cycles before.
+ */
+template <libpara::formatting::writer W> void dump(W &writer) {
+  using libpara::formatting::format;
+  using libpara::formatting::padded;
+  auto &clock = libpara::time::clock;
+  auto unit = clock.isCalibrated() ? " us" : " cycles";
+  auto convert = [&](u64 cycles) {
+    return clock.isCalibrated() ? clock.nanoseconds(cycles) / 1000 : cycles;
+  };
+  format(writer, "Boot timeline (since reset, in", unit, "):\n");
+  format(writer, "        time       delta   CPU  milestone\n");
+  u64 previous = 0;
+  boot.forEach([&](const Mark &mark) {
+    format(writer, padded(convert(mark.timestamp), 12), " ",
+           padded(convert(mark.timestamp - previous), 11), "  #",
+           padded(mark.cpu, 3), "  ", describe(mark.milestone), "\n");
+    previous = mark.timestamp;
+  });
+  if (boot.dropped() > 0)
+    format(writer, "Boot timeline dropped: ", boot.dropped(), " marks\n");
+}
+
+} // namespace kernel::timeline
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace kernel::timeline::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Timeline visits marks in time order");
+    {
+      Timeline<8> timeline;
+      timeline.record(Milestone::Online, 1, 300);
+      timeline.record(Milestone::Entered, 0, 100);
+      timeline.record(Milestone::Entered, 1, 200);
+      u64 timestamps[3] = {};
+      usize n = 0;
+      timeline.forEach([&](const Mark &mark) {
+        if (n < 3)
+          timestamps[n] = mark.timestamp;
+        n++;
+      });
+      Expect(n == 3);
+      Expect(timestamps[0] == 100 && timestamps[1] == 200 &&
+             timestamps[2] == 300);
+    }
+
+    test("Timeline drops marks that don't fit");
+    {
+      Timeline<2> timeline;
+      for (u64 i = 0; i < 5; i++)
+        timeline.record(Milestone::Entered, 0, i);
+      usize n = 0;
+      timeline.forEach([&](const Mark &) { n++; });
+      Expect(n == 2);
+      Expect(timeline.size() == 2 && timeline.dropped() == 3);
+    }
+  }
+};
+
+} // namespace kernel::timeline::tests
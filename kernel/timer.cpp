@@ -0,0 +1,380 @@
+export module kernel.timer;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+export namespace kernel::timer {
+
+class Wheel;
+
+/**
+ * Timer that can be armed on a timer wheel
+ *
+ * All times are in timebase units (TSC cycles on x86_64).
+ */
+class Timer {
+  friend class Wheel;
+
+  Timer *next = nullptr;
+  Timer **pprev = nullptr;
+  // deadline as requested
+  u64 requested = 0;
+  // deadline after applying slack
+  u64 deadline = 0;
+  u8 level = 0;
+  u8 slot = 0;
+
+public:
+  // re-arm period, zero for one-shot timers
+  u64 period = 0;
+  // how late the timer is allowed to fire, letting it share an interrupt
+  // with other timers
+  u64 slack = 0;
+
+  constexpr Timer() {}
+  constexpr Timer(u64 period, u64 slack = 0) : period(period), slack(slack) {}
+
+  /**
+   * Called (in interrupt context) when the timer expires
+   */
+  virtual void expired() = 0;
+
+  bool isPending() const { return pprev != nullptr; }
+
+  u64 expiresAt() const { return deadline; }
+};
+
+/**
+ * Expiry statistics
+ */
+struct Stats {
+  u64 expired = 0;
+  // sum and maximum of how late timers fired past their deadlines
+  u64 total_lateness = 0;
+  u64 max_lateness = 0;
+};
+
+/**
+ * Hierarchical timer wheel
+ *
+ * Level 0 has one slot per tick, every next level has slots `Slots` times
+ * coarser. Timers are moved down a level whenever the level below wraps
+ * around. Insertion and cancellation are O(1), finding the next deadline
+ * is O(Levels) using per-level occupancy bitmaps.
+ */
+class Wheel {
+public:
+  static const auto SlotBits = 6;
+  static const auto Slots = 1 << SlotBits;
+  static const auto Levels = 6;
+  static const u64 Never = ~0ULL;
+
+private:
+  Timer *slots[Levels][Slots] = {};
+  u64 occupied[Levels] = {0};
+  u8 tick_shift;
+  // next tick to be processed
+  u64 current;
+  Stats statistics;
+
+public:
+  /**
+   * Constructs a wheel starting at `now`, with a tick of `1 << tick_shift`
+   * timebase units
+   */
+  constexpr Wheel(u64 now, u8 tick_shift = 12)
+      : tick_shift(tick_shift), current(now >> tick_shift) {}
+  Wheel(Wheel &) = delete;
+
+  /**
+   * Arms (or re-arms) `timer` to expire at `deadline`
+   */
+  void add(Timer &timer, u64 deadline) {
+    cancel(timer);
+    timer.requested = deadline;
+    timer.deadline = applySlack(deadline, timer.slack);
+    insert(timer);
+  }
+
+  void cancel(Timer &timer) {
+    if (!timer.isPending())
+      return;
+    unlink(timer);
+  }
+
+  /**
+   * Expires all timers with deadlines up to `now`
+   */
+  void advance(u64 now) {
+    u64 target = now >> tick_shift;
+    while (true) {
+      auto tick = nextTick();
+      if (tick == Never || tick > target)
+        break;
+      current = tick;
+      if ((tick & (Slots - 1)) == 0)
+        cascade();
+      current = tick + 1;
+      expire(tick & (Slots - 1), now);
+    }
+    if (current <= target)
+      current = target + 1;
+  }
+
+  /**
+   * Time at which the wheel next needs to be advanced, or `Never`
+   */
+  u64 nextDeadline() const {
+    auto tick = nextTick();
+    return tick == Never ? Never : tick << tick_shift;
+  }
+
+  const Stats &stats() const { return statistics; }
+
+private:
+  /**
+   * Moves the deadline within [deadline, deadline + slack] to the value
+   * with most trailing zero bits, so that timers with slack coalesce
+   */
+  static u64 applySlack(u64 deadline, u64 slack) {
+    if (slack == 0)
+      return deadline;
+    auto limit = deadline + slack;
+    auto mask = deadline ^ limit;
+    if (mask == 0)
+      return deadline;
+    auto bit = 63 - __builtin_clzll(mask);
+    return limit & ~((1ULL << bit) - 1);
+  }
+
+  static u64 rotateRight(u64 bits, u8 n) {
+    return n == 0 ? bits : (bits >> n) | (bits << (64 - n));
+  }
+
+  void insert(Timer &timer) {
+    // round up, so that timers never fire early
+    u64 expires = (timer.deadline >> tick_shift) +
+                  ((timer.deadline & ((1ULL << tick_shift) - 1)) != 0);
+    if (expires < current)
+      expires = current;
+    u64 delta = expires - current;
+    const u64 range = 1ULL << (SlotBits * Levels);
+    if (delta >= range) {
+      // beyond the wheel's range, will be re-inserted on cascade
+      expires = current + range - 1;
+      delta = range - 1;
+    }
+    u8 level = 0;
+    while (level < Levels - 1 && delta >= (1ULL << (SlotBits * (level + 1))))
+      level++;
+    link(timer, level, (expires >> (SlotBits * level)) & (Slots - 1));
+  }
+
+  void link(Timer &timer, u8 level, u8 slot) {
+    auto &head = slots[level][slot];
+    timer.level = level;
+    timer.slot = slot;
+    timer.next = head;
+    if (head != nullptr)
+      head->pprev = &timer.next;
+    timer.pprev = &head;
+    head = &timer;
+    occupied[level] |= 1ULL << slot;
+  }
+
+  void unlink(Timer &timer) {
+    if (timer.next != nullptr)
+      timer.next->pprev = timer.pprev;
+    *timer.pprev = timer.next;
+    if (slots[timer.level][timer.slot] == nullptr)
+      occupied[timer.level] &= ~(1ULL << timer.slot);
+    timer.next = nullptr;
+    timer.pprev = nullptr;
+  }
+
+  /**
+   * Earliest tick at which a level 0 slot expires or a higher level slot
+   * has to be cascaded
+   */
+  u64 nextTick() const {
+    u64 next = Never;
+    for (u8 level = 0; level < Levels; level++) {
+      if (occupied[level] == 0)
+        continue;
+      const u8 shift = SlotBits * level;
+      // first tick at or after `current` that starts a slot at this level
+      u64 start = ((current + (1ULL << shift) - 1) >> shift) << shift;
+      u8 index = (start >> shift) & (Slots - 1);
+      auto distance = __builtin_ctzll(rotateRight(occupied[level], index));
+      u64 tick = start + (static_cast<u64>(distance) << shift);
+      if (tick < next)
+        next = tick;
+    }
+    return next;
+  }
+
+  /**
+   * Moves timers from higher levels down as the levels below wrap around
+   */
+  void cascade() {
+    for (u8 level = 1; level < Levels; level++) {
+      u8 index = (current >> (SlotBits * level)) & (Slots - 1);
+      auto timer = slots[level][index];
+      slots[level][index] = nullptr;
+      occupied[level] &= ~(1ULL << index);
+      while (timer != nullptr) {
+        auto next = timer->next;
+        timer->next = nullptr;
+        timer->pprev = nullptr;
+        insert(*timer);
+        timer = next;
+      }
+      if (index != 0)
+        break;
+    }
+  }
+
+  void expire(u8 slot, u64 now) {
+    Timer *timer;
+    while ((timer = slots[0][slot]) != nullptr) {
+      unlink(*timer);
+
+      auto lateness = now > timer->deadline ? now - timer->deadline : 0;
+      statistics.expired++;
+      statistics.total_lateness += lateness;
+      if (lateness > statistics.max_lateness)
+        statistics.max_lateness = lateness;
+
+      // re-arm before firing so that the timer can cancel itself
+      if (timer->period > 0) {
+        auto requested = timer->requested + timer->period;
+        if (requested <= now)
+          requested += ((now - requested) / timer->period + 1) * timer->period;
+        add(*timer, requested);
+      }
+      timer->expired();
+    }
+  }
+};
+
+} // namespace kernel::timer
+
+#include <testing.hpp>
+
+import libpara.testing;
+
+export namespace kernel::timer::tests {
+
+class CountingTimer : public Timer {
+public:
+  using Timer::Timer;
+  int count = 0;
+  virtual void expired() { count++; }
+};
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  // Every test gets its own frame, as wheels are too large to keep several
+  // on the stack at once
+  virtual void run() {
+    oneShot();
+    coarseTicks();
+    cancellation();
+    cascading();
+    periodic();
+    slack();
+  }
+
+private:
+  void oneShot() {
+    test("Wheel one-shot timer");
+    Wheel wheel(0, 0);
+    CountingTimer timer;
+    wheel.add(timer, 10);
+    Expect(timer.isPending());
+    Expect(wheel.nextDeadline() == 10);
+    wheel.advance(9);
+    Expect(timer.count == 0);
+    wheel.advance(10);
+    Expect(timer.count == 1);
+    Expect(!timer.isPending());
+    Expect(wheel.nextDeadline() == Wheel::Never);
+  }
+
+  void coarseTicks() {
+    test("Wheel never fires early with coarse ticks");
+    Wheel wheel(0, 4);
+    CountingTimer timer;
+    wheel.add(timer, 17);
+    Expect(wheel.nextDeadline() == 32);
+    wheel.advance(31);
+    Expect(timer.count == 0);
+    wheel.advance(32);
+    Expect(timer.count == 1);
+  }
+
+  void cancellation() {
+    test("Wheel cancellation");
+    Wheel wheel(0, 0);
+    CountingTimer a, b;
+    wheel.add(a, 5);
+    wheel.add(b, 5);
+    wheel.cancel(a);
+    Expect(!a.isPending());
+    wheel.advance(100);
+    Expect(a.count == 0);
+    Expect(b.count == 1);
+  }
+
+  void cascading() {
+    test("Wheel cascades distant timers");
+    Wheel wheel(3, 0);
+    CountingTimer near, far, farthest;
+    wheel.add(near, 70);
+    wheel.add(far, 5000);
+    wheel.add(farthest, 300000);
+    wheel.advance(69);
+    Expect(near.count == 0);
+    wheel.advance(70);
+    Expect(near.count == 1);
+    wheel.advance(4999);
+    Expect(far.count == 0);
+    Expect(wheel.nextDeadline() == 5000);
+    wheel.advance(5000);
+    Expect(far.count == 1);
+    wheel.advance(299999);
+    Expect(farthest.count == 0);
+    wheel.advance(300000);
+    Expect(farthest.count == 1);
+    Expect(wheel.stats().max_lateness == 0);
+  }
+
+  void periodic() {
+    test("Wheel periodic timer");
+    Wheel wheel(0, 0);
+    CountingTimer timer(100);
+    wheel.add(timer, 100);
+    for (u64 t = 0; t <= 1000; t += 50)
+      wheel.advance(t);
+    Expect(timer.count == 10);
+    Expect(timer.expiresAt() == 1100);
+    wheel.cancel(timer);
+    wheel.advance(2000);
+    Expect(timer.count == 10);
+  }
+
+  void slack() {
+    test("Wheel coalesces timers with slack");
+    Wheel wheel(0, 0);
+    CountingTimer a(0, 64), b(0, 64);
+    wheel.add(a, 1001);
+    wheel.add(b, 1013);
+    Expect(a.expiresAt() == b.expiresAt());
+    Expect(a.expiresAt() >= 1013 && a.expiresAt() <= 1065);
+  }
+};
+} // namespace kernel::timer::tests
@@ -0,0 +1,340 @@
+export module kernel.torture;
+
+import libpara.basic_types;
+import libpara.bench;
+import libpara.err;
+import libpara.formatting;
+import libpara.random;
+import libpara.sync;
+import libpara.testing;
+import libpara.time;
+import kernel.pmm;
+
+using namespace libpara::basic_types;
+using namespace libpara::formatting;
+using namespace libpara::sync;
+
+#include <testing.hpp>
+
+export namespace kernel::torture {
+
+/**
+ * A counter on a cache line of its own
+ */
+struct alignas(64) Line {
+  u64 value = 0;
+};
+
+struct Allocation {
+  usize address = 0;
+  u32 size = 0;
+  u32 alignment = 0;
+};
+
+/**
+ * CPUs running scenarios together, along with the structures they share.
+ *
+ * The CPU that leads the team is member 0 and the only one writing to the
+ * sink; the others join as they arrive.
+ */
+class Team {
+  u16 members = 0;
+  u16 joined = 1;
+  bool assembled = false;
+  Barrier barrier;
+
+public:
+  static const u16 MaxMembers = 64;
+  static const usize MaxAllocations = 16384;
+  // allocations are made from a range nothing is ever written to
+  static const usize Region = 0x100000000000;
+  static const usize RegionSize = MaxAllocations * 128;
+
+  libpara::testing::TestCaseSink *sink = nullptr;
+  u64 seed = 0;
+  u32 failures = 0;
+
+  Lock lock;
+  Line guarded;
+  Line shared;
+  Line counters[MaxMembers];
+  kernel::pmm::WatermarkAllocator allocator;
+  Allocation allocations[MaxAllocations];
+
+  constexpr Team() {}
+  Team(Team &) = delete;
+
+  /**
+   * Assembles a team of `members` CPUs (at most `MaxMembers`) reporting to
+   * `sink`, the calling one being member 0
+   */
+  u16 lead(u16 members, libpara::testing::TestCaseSink &sink, u64 seed) {
+    this->members = members < MaxMembers ? members : MaxMembers;
+    this->sink = &sink;
+    this->seed = seed;
+    barrier = Barrier(this->members);
+    __atomic_store_n(&assembled, true, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  /**
+   * Waits until the team is assembled, returning the calling CPU's index
+   * (`size()` or above if the team was full)
+   */
+  u16 join() {
+    while (!__atomic_load_n(&assembled, __ATOMIC_ACQUIRE)) {
+      __builtin_ia32_pause();
+    }
+    return __atomic_fetch_add(&joined, 1, __ATOMIC_RELAXED);
+  }
+
+  u16 size() const { return members; }
+
+  /**
+   * Waits for all members
+   */
+  void sync() { barrier.wait(); }
+};
+
+/**
+ * A member's part in the scenarios. Every member draws its own stream of
+ * the team's seed, so a failing interleaving can be replayed from the seed.
+ */
+class Member {
+  Team &team;
+  u16 index;
+  libpara::random::Random random;
+
+public:
+  Member(Team &team, u16 index)
+      : team(team), index(index), random(team.seed, index) {}
+
+  /**
+   * Runs `work` on the first `active` members at once, returning the cycles
+   * it took all of them (as seen by member 0)
+   */
+  template <typename F> u64 together(u16 active, F &&work) {
+    team.sync();
+    libpara::time::Stopwatch stopwatch;
+    if (index < active)
+      work();
+    team.sync();
+    return stopwatch.elapsed();
+  }
+
+  /**
+   * Spins for up to `jitter` pauses, to shake interleavings up
+   */
+  void delay(u32 jitter) {
+    for (auto n = jitter > 0 ? random.below(jitter) : 0; n > 0; n--)
+      __builtin_ia32_pause();
+  }
+
+  /**
+   * Reports a check, which only member 0 makes
+   */
+  void expect(bool success, const char *message = "",
+              const char *file = nullptr, const char *line = nullptr) {
+    team.failures += !success;
+    team.sink->report(success, message, file, line);
+  }
+
+  u64 locking(u16 active, u32 iterations, u32 jitter) {
+    if (index == 0)
+      team.guarded.value = 0;
+    auto cycles = together(active, [&] {
+      for (u32 i = 0; i < iterations; i++) {
+        {
+          auto guard = LockGuard(team.lock);
+          team.guarded.value++;
+          delay(jitter);
+        }
+        delay(jitter);
+      }
+    });
+    if (index == 0)
+      Expect(team.guarded.value == static_cast<u64>(active) * iterations);
+    return cycles;
+  }
+
+  u64 allocating(u16 active, u32 iterations, u32 jitter) {
+    if (index == 0)
+      team.allocator = kernel::pmm::WatermarkAllocator(
+          reinterpret_cast<void *>(Team::Region), Team::RegionSize);
+    auto log = &team.allocations[index * iterations];
+    auto cycles = together(active, [&] {
+      for (u32 i = 0; i < iterations; i++) {
+        auto size = static_cast<u32>(1 + random.below(64));
+        auto alignment = 1U << random.below(7);
+        auto allocated = team.allocator.allocate(size, alignment);
+        log[i] = {.address = allocated.success()
+                                 ? reinterpret_cast<usize>(*allocated)
+                                 : 0,
+                  .size = size,
+                  .alignment = alignment};
+        delay(jitter);
+      }
+    });
+    if (index == 0)
+      Expect(allocationsAreDisjoint(active, iterations));
+    return cycles;
+  }
+
+  u64 pingPong(u16 active, u32 iterations) {
+    if (index == 0)
+      team.shared.value = 0;
+    auto cycles = together(active, [&] {
+      for (u32 i = 0; i < iterations; i++)
+        __atomic_fetch_add(&team.shared.value, 1, __ATOMIC_RELAXED);
+    });
+    if (index == 0)
+      Expect(team.shared.value == static_cast<u64>(active) * iterations);
+    return cycles;
+  }
+
+  u64 privateCounting(u16 active, u32 iterations) {
+    auto &counter = team.counters[index].value;
+    auto cycles = together(active, [&] {
+      counter = 0;
+      for (u32 i = 0; i < iterations; i++)
+        __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+    });
+    if (index == 0) {
+      bool counted = true;
+      for (u16 i = 0; i < active; i++)
+        counted = counted && team.counters[i].value == iterations;
+      Expect(counted);
+    }
+    return cycles;
+  }
+
+private:
+  /**
+   * Whether all allocations succeeded, aligned and within the region, with
+   * no two of them overlapping. Every member's allocations are in ascending
+   * order, so they are merged instead of sorted.
+   */
+  bool allocationsAreDisjoint(u16 active, u32 iterations) {
+    u32 next[Team::MaxMembers] = {};
+    usize end = Team::Region;
+    for (usize n = 0; n < static_cast<usize>(active) * iterations; n++) {
+      const Allocation *lowest = nullptr;
+      u16 member = 0;
+      for (u16 i = 0; i < active; i++) {
+        if (next[i] == iterations)
+          continue;
+        auto &allocation = team.allocations[i * iterations + next[i]];
+        if (lowest == nullptr || allocation.address < lowest->address) {
+          lowest = &allocation;
+          member = i;
+        }
+      }
+      next[member]++;
+      if (lowest->address < end || lowest->address % lowest->alignment != 0 ||
+          lowest->address + lowest->size > Team::Region + Team::RegionSize)
+        return false;
+      end = lowest->address + lowest->size;
+    }
+    return true;
+  }
+};
+
+const u64 DefaultSeed = 0x70D7;
+
+/**
+ * Checks invariants of shared structures with all members of `team`
+ * hammering them at once, with random delays in between
+ */
+inline void test(Team &team, u16 index) {
+  if (index >= team.size())
+    return;
+  const u32 Rounds = 4;
+  const u32 Jitter = 32;
+  auto iterations = static_cast<u32>(Team::MaxAllocations / team.size());
+  iterations = iterations < 512 ? iterations : 512;
+  Member member(team, index);
+  auto begin = [&](const char *name) {
+    if (index == 0)
+      team.sink->test(name);
+  };
+
+  begin("SMP locking loses no updates");
+  for (u32 round = 0; round < Rounds; round++)
+    member.locking(team.size(), iterations, Jitter);
+  begin("SMP allocations don't overlap");
+  for (u32 round = 0; round < Rounds; round++)
+    member.allocating(team.size(), iterations, Jitter);
+  begin("SMP atomic increments on a shared line");
+  for (u32 round = 0; round < Rounds; round++)
+    member.pingPong(team.size(), iterations);
+  begin("SMP atomic increments on private lines");
+  for (u32 round = 0; round < Rounds; round++)
+    member.privateCounting(team.size(), iterations);
+
+  if (index == 0) {
+    team.sink->testComplete();
+    if (team.failures > 0)
+      format(*team.sink, "\n[!] SMP torture seed: ", team.seed, "\n");
+  }
+}
+
+/**
+ * Measures throughput of shared structures as the number of active members
+ * of `team` goes from 1 to all of them, reporting a `bench:` line per count
+ * (in cycles per operation, with `speedup` of throughput over one member)
+ */
+inline void benchmark(Team &team, u16 index) {
+  if (index >= team.size())
+    return;
+  const usize Samples = 9;
+  auto iterations = static_cast<u32>(Team::MaxAllocations / team.size());
+  iterations = iterations < 4096 ? iterations : 4096;
+  Member member(team, index);
+
+  auto scale = [&](const char *name, auto &&round) {
+    u64 single = 0;
+    for (u16 active = 1; active <= team.size(); active++) {
+      u64 samples[Samples];
+      auto operations = static_cast<u64>(active) * iterations;
+      // warms up
+      round(active);
+      for (auto &sample : samples)
+        sample = round(active) * 100 / operations;
+      if (index != 0)
+        continue;
+      auto statistics = libpara::bench::Statistics::of(samples, Samples);
+      if (active == 1)
+        single = statistics.median;
+      auto &sink = *team.sink;
+      format(sink, "bench: ", name, ".", active, " iterations=", operations,
+             " min=");
+      libpara::bench::formatCycles(sink, statistics.min);
+      sink.write(" p10=");
+      libpara::bench::formatCycles(sink, statistics.p10);
+      sink.write(" median=");
+      libpara::bench::formatCycles(sink, statistics.median);
+      sink.write(" p90=");
+      libpara::bench::formatCycles(sink, statistics.p90);
+      sink.write(" max=");
+      libpara::bench::formatCycles(sink, statistics.max);
+      sink.write(" speedup=");
+      libpara::bench::formatCycles(
+          sink, statistics.median > 0
+                    ? single * 100 / statistics.median
+                    : 0);
+      sink.write("\n");
+      sink.testComplete();
+    }
+  };
+
+  scale("smp.lock",
+        [&](u16 active) { return member.locking(active, iterations, 0); });
+  scale("smp.allocate",
+        [&](u16 active) { return member.allocating(active, iterations, 0); });
+  scale("smp.pingpong.shared",
+        [&](u16 active) { return member.pingPong(active, iterations); });
+  scale("smp.pingpong.private",
+        [&](u16 active) { return member.privateCounting(active, iterations); });
+}
+
+} // namespace kernel::torture
@@ -0,0 +1,341 @@
+export module kernel.trace;
+
+import libpara.basic_types;
+import libpara.concepts;
+import libpara.err;
+import libpara.formatting;
+import libpara.time;
+import libpara.xxh64;
+
+import kernel.cpu;
+import kernel.pmm;
+import kernel.platform.x86_64.cpu;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace kernel::trace {
+
+/**
+ * Whether tracepoints record anything. When they don't, they compile to
+ * nothing.
+ */
+#ifdef TRACE
+constexpr bool Enabled = true;
+#else
+constexpr bool Enabled = false;
+#endif
+
+const u8 MaxArguments = 6;
+
+/**
+ * Size of every CPU's trace buffer, in 64-bit words
+ */
+const usize BufferWords = 2048;
+
+/**
+ * Tracepoint name, usable as a template argument
+ */
+template <usize n> struct Name {
+  char value[n];
+
+  consteval Name(const char (&name)[n]) {
+    for (usize i = 0; i < n; i++)
+      value[i] = name[i];
+  }
+};
+
+/**
+ * Describes a tracepoint to the trace decoder. Descriptors of all enabled
+ * tracepoints are collected in the `tracepoints` section.
+ */
+struct Descriptor {
+  u32 id;
+  u8 arguments;
+  const char *name;
+};
+
+/**
+ * Recorded event, as laid out in a trace buffer: two header words followed
+ * by one word per argument
+ */
+struct Event {
+  u64 timestamp;
+  u32 id;
+  u16 cpu;
+  u8 arguments;
+  u8 reserved;
+  u64 argument[MaxArguments];
+};
+
+/**
+ * Ring of variable-sized events, written by a single CPU. Once full, the
+ * oldest events are overwritten.
+ */
+template <usize words> class Buffer {
+  static_assert((words & (words - 1)) == 0, "words must be a power of two");
+
+  u64 ring[words] = {};
+  // word positions of the oldest event and past the newest one
+  u64 tail = 0;
+  u64 head = 0;
+
+  // records in progress, which readers must wait out
+  u32 writing = 0;
+
+  u64 &at(u64 position) { return ring[position & (words - 1)]; }
+  u64 at(u64 position) const { return ring[position & (words - 1)]; }
+
+  static u64 size(u64 header) { return 2 + ((header >> 48) & 0xFF); }
+
+public:
+  constexpr Buffer() {}
+  Buffer(Buffer &) = delete;
+
+  /**
+   * Announces a record, before checking whether recording is allowed
+   */
+  void enter() { __atomic_add_fetch(&writing, 1, __ATOMIC_SEQ_CST); }
+  void leave() { __atomic_sub_fetch(&writing, 1, __ATOMIC_RELEASE); }
+
+  bool isWriting() const {
+    return __atomic_load_n(&writing, __ATOMIC_ACQUIRE) != 0;
+  }
+
+  void record(u64 timestamp, u32 id, u16 cpu, const u64 *arguments,
+              u8 count) {
+    auto header = static_cast<u64>(count) << 48 | static_cast<u64>(cpu) << 32 |
+                  id;
+    auto size = 2 + count;
+    while (head + size - tail > words)
+      tail += this->size(at(tail + 1));
+    at(head) = timestamp;
+    at(head + 1) = header;
+    for (u8 i = 0; i < count; i++)
+      at(head + 2 + i) = arguments[i];
+    __atomic_store_n(&head, head + size, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Calls `f` with every recorded event, oldest first
+   */
+  template <typename F> void forEach(F &&f) const {
+    auto end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    for (auto position = tail; position < end;) {
+      auto header = at(position + 1);
+      Event event = {.timestamp = at(position),
+                     .id = static_cast<u32>(header),
+                     .cpu = static_cast<u16>(header >> 32),
+                     .arguments = static_cast<u8>(header >> 48)};
+      for (u8 i = 0; i < event.arguments; i++)
+        event.argument[i] = at(position + 2 + i);
+      f(event);
+      position += size(header);
+    }
+  }
+
+  void clear() { tail = head; }
+};
+
+using CPUBuffer = Buffer<BufferWords>;
+
+} // namespace kernel::trace
+
+using namespace kernel::trace;
+
+extern "C" const Descriptor __start_tracepoints[];
+extern "C" const Descriptor __stop_tracepoints[];
+
+export namespace kernel::trace {
+
+// Trace buffers, indexed by CPU table index. Referenced from tracepoints
+// instantiated in other modules.
+constinit CPUBuffer *buffers[kernel::cpu::MaxCPUs] = {};
+constinit bool recording = true;
+
+/**
+ * Static tracepoint recording integer or pointer arguments
+ *
+ * ```
+ * using TimerTick = kernel::trace::Tracepoint<"timer.tick", u64>;
+ * TimerTick::record(now);
+ * ```
+ *
+ * Tracepoints named `*.begin` and `*.end` are decoded as spans.
+ */
+template <Name name, typename... Args> struct Tracepoint {
+  static_assert(sizeof...(Args) <= MaxArguments, "too many arguments");
+
+  static constexpr u32 id =
+      static_cast<u32>(libpara::xxh64::hash(name.value, 0));
+
+  [[gnu::used, gnu::section("tracepoints")]] static constinit inline Descriptor
+      descriptor = {.id = id, .arguments = sizeof...(Args), .name = name.value};
+
+  /**
+   * Records an event on current CPU, once its trace buffer is set up
+   */
+  static inline void record(Args... args) {
+    if constexpr (Enabled) {
+      if (!__atomic_load_n(&recording, __ATOMIC_RELAXED))
+        return;
+      // not `impl<current_cpu>`, which is defined in kernel.platform.x86_64:
+      // that imports platform modules with tracepoints, and so this one
+      auto cpu = kernel::platform::x86_64::currentCPU();
+      auto buffer = buffers[cpu->index];
+      if (buffer == nullptr)
+        return;
+      const u64 arguments[sizeof...(Args) + 1] = {
+          static_cast<u64>(toWord(args))...};
+      buffer->enter();
+      // checked again, as `dump()` may have started since
+      if (__atomic_load_n(&recording, __ATOMIC_SEQ_CST))
+        buffer->record(libpara::time::rdtsc(), descriptor.id, cpu->id,
+                       arguments, sizeof...(Args));
+      buffer->leave();
+    }
+  }
+
+private:
+  template <typename T> static u64 toWord(T value) {
+    if constexpr (libpara::concepts::integer<T>)
+      return static_cast<u64>(value);
+    else
+      return reinterpret_cast<u64>(value);
+  }
+};
+
+/**
+ * Sets up current CPU's trace buffer
+ */
+Result<nothing> initialize(kernel::cpu::CPU &cpu) {
+  if constexpr (Enabled)
+    buffers[cpu.index] = new (tryUnwrap(
+        kernel::pmm::allocate<CPUBuffer>(cpu.allocator))) CPUBuffer();
+  return nothing{};
+}
+
+/**
+ * Writes out all recorded events for the trace decoder and clears the
+ * buffers. Recording is paused meanwhile, once records already in progress
+ * on other CPUs are done.
+ */
+template <libpara::formatting::writer W>
+void dump(W &writer, const kernel::cpu::Table &cpus) {
+  using libpara::formatting::format;
+  __atomic_store_n(&recording, false, __ATOMIC_SEQ_CST);
+  for (u16 i = 0; i < cpus.size(); i++) {
+    auto buffer = buffers[cpus[i].index];
+    while (buffer != nullptr && buffer->isWriting())
+      __builtin_ia32_pause();
+  }
+  format(writer, "trace: begin ", libpara::time::clock.frequency(), "\n");
+  for (auto d = __start_tracepoints; d < __stop_tracepoints; d++)
+    format(writer, "trace: point ", d->id, " ", d->arguments, " ", d->name,
+           "\n");
+  for (u16 i = 0; i < cpus.size(); i++) {
+    auto buffer = buffers[cpus[i].index];
+    if (buffer == nullptr)
+      continue;
+    buffer->forEach([&](const Event &event) {
+      format(writer, "trace: event ", event.timestamp, " ", event.cpu, " ",
+             event.id);
+      for (u8 a = 0; a < event.arguments; a++)
+        format(writer, " ", event.argument[a]);
+      format(writer, "\n");
+    });
+    buffer->clear();
+  }
+  format(writer, "trace: end\n");
+  __atomic_store_n(&recording, true, __ATOMIC_SEQ_CST);
+}
+
+} // namespace kernel::trace
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace kernel::trace::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Buffer reads back recorded events");
+    {
+      Buffer<16> buffer;
+      const u64 arguments[] = {7, 8};
+      buffer.record(100, 1, 2, arguments, 2);
+      buffer.record(200, 3, 4, arguments, 0);
+      u32 count = 0;
+      bool matches = true;
+      buffer.forEach([&](const Event &event) {
+        if (count == 0)
+          matches = matches && event.timestamp == 100 && event.id == 1 &&
+                    event.cpu == 2 && event.arguments == 2 &&
+                    event.argument[0] == 7 && event.argument[1] == 8;
+        else
+          matches = matches && event.timestamp == 200 && event.id == 3 &&
+                    event.cpu == 4 && event.arguments == 0;
+        count++;
+      });
+      Expect(count == 2);
+      Expect(matches);
+    }
+
+    test("Buffer overwrites oldest events");
+    {
+      Buffer<16> buffer;
+      const u64 arguments[] = {1, 2, 3};
+      for (u64 i = 0; i < 10; i++)
+        buffer.record(i, 0, 0, arguments, i % 4);
+      u64 first = 0, last = 0, count = 0;
+      buffer.forEach([&](const Event &event) {
+        if (count == 0)
+          first = event.timestamp;
+        last = event.timestamp;
+        count++;
+      });
+      // the last four events (4, 5, 2 and 3 words) fit, the fifth doesn't
+      Expect(last == 9);
+      Expect(first == 6);
+      Expect(count == 4);
+    }
+
+    test("Buffer tracks records in progress");
+    {
+      Buffer<16> buffer;
+      Expect(!buffer.isWriting());
+      buffer.enter();
+      buffer.enter();
+      buffer.leave();
+      Expect(buffer.isWriting());
+      buffer.leave();
+      Expect(!buffer.isWriting());
+    }
+
+    test("Buffer clear");
+    {
+      Buffer<16> buffer;
+      buffer.record(1, 0, 0, nullptr, 0);
+      buffer.clear();
+      u32 count = 0;
+      buffer.forEach([&](const Event &) { count++; });
+      Expect(count == 0);
+    }
+
+    test("Tracepoint ids are derived from names");
+    {
+      using A = Tracepoint<"test.a", u64>;
+      using B = Tracepoint<"test.b">;
+      Expect(A::id != B::id);
+      Expect(A::id == static_cast<u32>(libpara::xxh64::hash("test.a", 0)));
+    }
+  }
+};
+} // namespace kernel::trace::tests
@@ -24,6 +24,9 @@ struct nothing {
 
 } // namespace libpara::basic_types
 
+// placement new, as there is no <new> in freestanding code
+export void *operator new(unsigned long, void *ptr) { return ptr; }
+
 using namespace libpara::basic_types;
 
 static_assert(sizeof(u8) == 1);
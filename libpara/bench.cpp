@@ -0,0 +1,219 @@
+export module libpara.bench;
+
+import libpara.basic_types;
+import libpara.formatting;
+import libpara.testing;
+import libpara.time;
+
+using namespace libpara::basic_types;
+using namespace libpara::formatting;
+
+export namespace libpara::bench {
+
+/**
+ * Keeps the compiler from optimizing away the computation of `value`
+ */
+template <typename T> inline void keep(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * Distribution of cycles per operation over all samples of a benchmark, in
+ * hundredths of a cycle
+ */
+struct Statistics {
+  u64 min = 0;
+  u64 p10 = 0;
+  u64 median = 0;
+  u64 p90 = 0;
+  u64 max = 0;
+
+  /**
+   * Statistics of `n` samples, sorting them in place
+   */
+  static Statistics of(u64 *samples, usize n) {
+    for (usize i = 1; i < n; i++)
+      for (usize j = i; j > 0 && samples[j - 1] > samples[j]; j--) {
+        auto sample = samples[j];
+        samples[j] = samples[j - 1];
+        samples[j - 1] = sample;
+      }
+    // nearest rank
+    auto percentile = [&](usize p) { return samples[(n - 1) * p / 100]; };
+    return {.min = samples[0],
+            .p10 = percentile(10),
+            .median = percentile(50),
+            .p90 = percentile(90),
+            .max = samples[n - 1]};
+  }
+};
+
+/**
+ * Writes cycles per operation, given in hundredths of a cycle, with two
+ * decimals
+ */
+template <writer W> void formatCycles(W &writer, u64 hundredths) {
+  format(writer, hundredths / 100, ".", padded(hundredths % 100, 2, '0'));
+}
+
+/**
+ * Base for benchmarks, which run in the booted kernel like tests do and
+ * write their results to the same sinks
+ *
+ * Every measurement warms up first, then doubles the number of iterations
+ * per sample until a sample takes at least `SampleCycles`, so that reading
+ * the cycle counter costs next to nothing. Results are single lines:
+ *
+ * ```
+ * bench: <name> iterations=<n> min=<c> p10=<c> median=<c> p90=<c> max=<c>
+ * ```
+ *
+ * in cycles per operation, which `tools/bench-compare.py` reads.
+ */
+class Benchmark {
+
+  libpara::testing::TestCaseSink &sink;
+
+public:
+  static const usize Samples = 25;
+  static const u64 WarmupCycles = 1000000;
+  static const u64 SampleCycles = 200000;
+  static const u64 MaxIterations = 1ULL << 30;
+
+  Benchmark(libpara::testing::TestCaseSink &sink) : sink(sink) {}
+
+  void start() { run(); }
+
+  virtual void run() = 0;
+
+  /**
+   * Measures calls of `f`, reporting them as `name` (which must not
+   * contain spaces)
+   */
+  template <typename F> Statistics measure(const char *name, F &&f) {
+    libpara::time::Stopwatch warmup;
+    do
+      f();
+    while (warmup.elapsed() < WarmupCycles);
+
+    u64 iterations = 1;
+    while (iterations < MaxIterations && time(f, iterations) < SampleCycles)
+      iterations *= 2;
+
+    u64 samples[Samples];
+    for (auto &sample : samples)
+      sample = time(f, iterations) * 100 / iterations;
+    auto statistics = Statistics::of(samples, Samples);
+    format(sink, "bench: ", name, " iterations=", iterations);
+    report("min", statistics.min);
+    report("p10", statistics.p10);
+    report("median", statistics.median);
+    report("p90", statistics.p90);
+    report("max", statistics.max);
+    sink.write("\n");
+    // lets sinks flush each result as it comes
+    sink.testComplete();
+    return statistics;
+  }
+
+private:
+  void report(const char *key, u64 hundredths) {
+    format(sink, " ", key, "=");
+    formatCycles(sink, hundredths);
+  }
+
+  template <typename F> static u64 time(F &f, u64 iterations) {
+    libpara::time::Stopwatch stopwatch;
+    for (u64 i = 0; i < iterations; i++)
+      f();
+    return stopwatch.elapsed();
+  }
+};
+
+} // namespace libpara::bench
+
+#include <testing.hpp>
+
+export namespace libpara::bench::tests {
+
+/**
+ * Sink keeping the last line written
+ */
+class LineSink : public libpara::testing::TestCaseSink {
+public:
+  char line[256];
+  usize size = 0;
+
+  using libpara::testing::TestCaseSink::write;
+
+  virtual void write(const char *s) {
+    for (; *s != 0; s++) {
+      if (size > 0 && line[size - 1] == '\n')
+        size = 0;
+      if (size < sizeof(line) - 1)
+        line[size++] = *s;
+      line[size] = 0;
+    }
+  }
+
+  bool startsWith(const char *prefix) const {
+    for (usize i = 0; prefix[i] != 0; i++)
+      if (i >= size || line[i] != prefix[i])
+        return false;
+    return true;
+  }
+};
+
+class Counting : public Benchmark {
+public:
+  u64 calls = 0;
+  Statistics statistics;
+
+  using Benchmark::Benchmark;
+
+  virtual void run() {
+    statistics = measure("count", [&] { keep(++calls); });
+  }
+};
+
+class TestCase : public libpara::testing::TestCase {
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Statistics of samples");
+    {
+      u64 samples[] = {9, 1, 8, 2, 7, 3, 6, 4, 5, 10, 0};
+      auto statistics = Statistics::of(samples, 11);
+      Expect(statistics.min == 0 && statistics.max == 10);
+      Expect(statistics.p10 == 1);
+      Expect(statistics.median == 5);
+      Expect(statistics.p90 == 9);
+      Expect(samples[3] == 3);
+    }
+
+    test("Measurements scale iterations up and report one line");
+    {
+      LineSink sink;
+      Counting counting(sink);
+      counting.start();
+      Expect(counting.calls > Benchmark::Samples * 2);
+      Expect(counting.statistics.min <= counting.statistics.median);
+      Expect(counting.statistics.median <= counting.statistics.max);
+      Expect(sink.startsWith("bench: count iterations="));
+      Expect(sink.line[sink.size - 1] == '\n');
+    }
+
+    test("Cycles are formatted with two decimals");
+    {
+      LineSink sink;
+      formatCycles(sink, 1205);
+      sink.write(" ");
+      formatCycles(sink, 7);
+      sink.write("\n");
+      Expect(sink.startsWith("12.05 0.07\n"));
+    }
+  }
+};
+
+} // namespace libpara::bench::tests
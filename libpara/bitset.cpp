@@ -0,0 +1,177 @@
+export module libpara.bitset;
+
+import libpara.basic_types;
+import libpara.span;
+
+using namespace libpara::basic_types;
+
+export namespace libpara::bitset {
+
+/**
+ * `bits` bits stored inline in 64-bit words, so that finding a set or clear
+ * bit looks at 64 of them at a time
+ */
+template <usize bits> class InlineBitset {
+  static_assert(bits > 0);
+
+  static const usize WordBits = 64;
+  static const usize Words = (bits + WordBits - 1) / WordBits;
+
+  u64 words[Words] = {};
+
+  // bits of the last word that are past the end
+  static constexpr u64 lastWordMask() {
+    return bits % WordBits == 0 ? ~0ULL : (1ULL << (bits % WordBits)) - 1;
+  }
+
+  template <bool set> constexpr usize findFrom(usize from) const {
+    if (from >= bits)
+      return libpara::span::NotFound;
+    auto w = from / WordBits;
+    auto word = (set ? words[w] : ~words[w]) & (~0ULL << (from % WordBits));
+    while (true) {
+      if (w == Words - 1)
+        word &= lastWordMask();
+      if (word != 0)
+        return w * WordBits + __builtin_ctzll(word);
+      if (++w == Words)
+        return libpara::span::NotFound;
+      word = set ? words[w] : ~words[w];
+    }
+  }
+
+public:
+  constexpr InlineBitset() {}
+
+  constexpr usize size() const { return bits; }
+
+  constexpr bool test(usize i) const {
+    libpara::span::checkBounds(i < bits);
+    return (words[i / WordBits] >> (i % WordBits)) & 1;
+  }
+
+  constexpr void set(usize i) {
+    libpara::span::checkBounds(i < bits);
+    words[i / WordBits] |= 1ULL << (i % WordBits);
+  }
+
+  constexpr void reset(usize i) {
+    libpara::span::checkBounds(i < bits);
+    words[i / WordBits] &= ~(1ULL << (i % WordBits));
+  }
+
+  constexpr void clear() {
+    for (auto &word : words)
+      word = 0;
+  }
+
+  /**
+   * Number of set bits
+   */
+  constexpr usize count() const {
+    usize n = 0;
+    for (auto word : words)
+      n += __builtin_popcountll(word);
+    return n;
+  }
+
+  constexpr bool any() const {
+    for (auto word : words)
+      if (word != 0)
+        return true;
+    return false;
+  }
+
+  /**
+   * First set bit at or after `from`, or `NotFound`
+   */
+  constexpr usize findSet(usize from = 0) const { return findFrom<true>(from); }
+
+  /**
+   * First clear bit at or after `from`, or `NotFound`
+   */
+  constexpr usize findClear(usize from = 0) const {
+    return findFrom<false>(from);
+  }
+
+  /**
+   * Calls `f` with every set bit, in order
+   */
+  template <typename F> constexpr void forEach(F &&f) const {
+    for (usize w = 0; w < Words; w++)
+      for (auto word = words[w]; word != 0; word &= word - 1)
+        f(w * WordBits + __builtin_ctzll(word));
+  }
+};
+
+} // namespace libpara::bitset
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::bitset::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("InlineBitset sets and resets bits");
+    {
+      InlineBitset<100> bitset;
+      Expect(!bitset.any() && bitset.count() == 0);
+      bitset.set(0);
+      bitset.set(64);
+      bitset.set(99);
+      Expect(bitset.test(0) && bitset.test(64) && bitset.test(99));
+      Expect(!bitset.test(1) && !bitset.test(63));
+      Expect(bitset.count() == 3);
+      bitset.reset(64);
+      Expect(!bitset.test(64) && bitset.count() == 2);
+      bitset.clear();
+      Expect(!bitset.any());
+    }
+
+    test("InlineBitset finds set bits");
+    {
+      InlineBitset<130> bitset;
+      Expect(bitset.findSet() == libpara::span::NotFound);
+      bitset.set(5);
+      bitset.set(70);
+      bitset.set(129);
+      Expect(bitset.findSet() == 5);
+      Expect(bitset.findSet(6) == 70);
+      Expect(bitset.findSet(71) == 129);
+      Expect(bitset.findSet(130) == libpara::span::NotFound);
+      usize seen[3] = {}, n = 0;
+      bitset.forEach([&](usize i) {
+        if (n < 3)
+          seen[n] = i;
+        n++;
+      });
+      Expect(n == 3 && seen[0] == 5 && seen[1] == 70 && seen[2] == 129);
+    }
+
+    test("InlineBitset finds clear bits within its size");
+    {
+      InlineBitset<70> bitset;
+      for (usize i = 0; i < 70; i++)
+        if (i != 66)
+          bitset.set(i);
+      Expect(bitset.findClear() == 66);
+      bitset.set(66);
+      // bits past the end of the last word are never found
+      Expect(bitset.findClear() == libpara::span::NotFound);
+      static_assert([] {
+        InlineBitset<64> full;
+        for (usize i = 0; i < 64; i++)
+          full.set(i);
+        return full.findClear() == libpara::span::NotFound;
+      }());
+    }
+  }
+};
+
+} // namespace libpara::bitset::tests
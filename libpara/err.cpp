@@ -1,116 +1,274 @@
 export module libpara.err;
 
+import libpara.basic_types;
+import libpara.formatting;
 import libpara.xxh64;
 import libpara.testing;
 
+using namespace libpara::basic_types;
+
+export namespace libpara::err {
+
+/**
+ * Name of an error, for diagnostics. Names of all errors are collected in
+ * the `errors` section.
+ */
+struct ErrorName {
+  u32 code;
+  const char *name;
+};
+
+} // namespace libpara::err
+
+extern "C" const libpara::err::ErrorName __start_errors[];
+extern "C" const libpara::err::ErrorName __stop_errors[];
+
 export namespace libpara::err {
 
 struct Error;
-template <typename T> struct Result;
+template <typename T> class Result;
 
 template <typename T> consteval const Error return_error(T error);
 
 /**
  * Named error with no further details
+ *
+ * Errors are made from their names with `"Name"_error`. They are only a
+ * 32-bit code, derived from the name with xxHash64
+ * (https://github.com/Cyan4973/xxHash), so that they fit next to (or in)
+ * the values of Results. Names are looked up in the `errors` section when
+ * they have to be printed.
+ *
+ * At this moment we assume that 32 bits of the hash are enough to tell the
+ * errors of a single kernel apart; tests check that this holds.
  */
 struct Error {
-  // name
-  const char *name;
-  // unique error id
-  const unsigned long long id;
+  // never 0, which Results use for success
+  u32 code;
 
   /**
-   * Constructs a error
-   *
-   * Every error gets a unique ID based on xxHash64 of its name
-   * https://github.com/Cyan4973/xxHash
-   * At this moment we assume that the collision properties of this hash
-   * are decent:
-   * https://github.com/Cyan4973/xxHash/tree/dev/tests/collisions#examples
-   *
+   * Reconstructs an error from its code
    */
-  consteval Error(const char *name)
-      : name(name), id(libpara::xxh64::hash(name, 0)) {}
+  explicit constexpr Error(u32 code) : code(code) {}
 
   /**
    *  Can compare with other Errors
    */
-  constexpr bool operator==(const Error &err) const { return id == err.id; }
+  constexpr bool operator==(const Error &err) const {
+    return code == err.code;
+  }
 
   /**
    * Can compare with Results. True only if result has not succeeded and error
    * matches
    */
   template <typename T> constexpr bool operator==(const Result<T> &res) const {
-    return !res.success && res.result.error == *this;
+    return !res.success() && res.error() == *this;
+  }
+
+  /**
+   * Looks up the error's name, which is slow and only meant for diagnostics
+   */
+  const char *name() const {
+    for (auto entry = __start_errors; entry < __stop_errors; entry++)
+      if (entry->code == code)
+        return entry->name;
+    return "UnknownError";
   }
 };
 
+constexpr u32 errorCode(const char *name) {
+  auto code = static_cast<u32>(libpara::xxh64::hash(name, 0));
+  return code != 0 ? code : 1;
+}
+
+template <libpara::formatting::Literal name> struct NamedError {
+  static constexpr u32 code = errorCode(name.value);
+
+  [[gnu::used, gnu::section("errors")]] static constinit inline ErrorName
+      entry = {.code = code, .name = name.value};
+};
+
 /**
- * Handles return of an Error
+ * Makes an error from its name, registering the name
  */
-template <> consteval const Error return_error(Error error) { return error; }
+template <libpara::formatting::Literal name>
+constexpr Error operator""_error() {
+  // referencing the entry is what instantiates it into the section
+  (void)&NamedError<name>::entry;
+  return Error(NamedError<name>::code);
+}
+
 /**
- * Handles return of a const string as an Error
+ * Handles return of an Error
  */
-template <> consteval const Error return_error(const char *name) {
-  return Error(name);
-}
+template <> consteval const Error return_error(Error error) { return error; }
 
 /**
  * Handles an overloaded return of an error, handling unsupported
  * error type T
  */
 template <typename T> consteval const Error return_error(T error) {
-  return Error("Unsupported error");
+  return "Unsupported error"_error;
 }
 
 /**
- * Result is a union of a "success" value or an error, tagged with
- * the success
+ * Types with a single value, so that Results of them only need an error
+ * code
+ */
+template <typename T> struct is_unit {
+  constexpr static bool value = false;
+};
+template <> struct is_unit<nothing> { constexpr static bool value = true; };
+template <> struct is_unit<nullptr_t> { constexpr static bool value = true; };
+
+template <typename T>
+concept unit = is_unit<T>::value;
+
+/**
+ * Storage of a `Result`'s value and error code, which is 0 on success
+ *
+ * Trivially copyable values are stored as they are, and so is the storage.
+ * Others can only be moved, and are destroyed with the storage (see the
+ * specialization below). Keeping this out of `Result` itself leaves it with
+ * no special members of its own to constrain.
  */
-template <typename T> struct Result {
+template <typename T, bool trivial = __is_trivially_copyable(T)>
+class ResultStorage {
+protected:
   union {
     T value;
-    Error error;
-  } result;
-  bool success;
+  };
+  u32 code;
+
+public:
+  constexpr ResultStorage(const T &value) : value(value), code(0) {}
+  constexpr ResultStorage(T &&value)
+      : value(static_cast<T &&>(value)), code(0) {}
+  constexpr ResultStorage(Error error) : code(error.code) {}
+};
+
+template <typename T> class ResultStorage<T, false> {
+protected:
+  union {
+    T value;
+  };
+  u32 code;
+
+public:
+  ResultStorage(const T &value) : value(value), code(0) {}
+  ResultStorage(T &&value) : value(static_cast<T &&>(value)), code(0) {}
+  ResultStorage(Error error) : code(error.code) {}
+
+  ResultStorage(ResultStorage &&other) : code(other.code) {
+    if (code == 0)
+      new (&value) T(static_cast<T &&>(other.value));
+  }
+
+  ~ResultStorage() {
+    if (code == 0)
+      value.~T();
+  }
+};
+
+/**
+ * Either a value or an error
+ *
+ * The value shares no storage with the error code, so `Result<u32>` is 8
+ * bytes and `Result<u64>` is 16: both are returned in registers. Results of
+ * pointers and of `nothing` are even smaller (see below).
+ *
+ * Results of types that aren't trivially copyable can only be moved, and
+ * destroy their value.
+ */
+template <typename T> class Result : public ResultStorage<T> {
+  using ResultStorage<T>::value;
+  using ResultStorage<T>::code;
 
+public:
   /**
-   * Initialize as a success from an lvalue
+   * Initialize as a success from a value, or as an error
    */
-  Result(T &value) : result{.value = value}, success(true) {}
+  using ResultStorage<T>::ResultStorage;
+
+  constexpr bool success() const { return code == 0; }
+
   /**
-   * Initialize as a success from an rvalue
+   * Get error if not success, undefined if it is not an error
    */
-  Result(T &&value) : result{.value = static_cast<T>(value)}, success(true) {}
+  constexpr Error error() const { return Error(code); }
 
   /**
-   * Initialize as an error
+   * Get result if success, undefined if it isn't
    */
-  Result(Error error) : result{.error = error}, success(false) {}
+  constexpr const T *operator->() const { return &value; }
+  constexpr T *operator->() { return &value; }
 
   /**
    * Get result if success, undefined if it isn't
    */
-  constexpr const T *operator->() const { return &result.value; }
+  constexpr const T &operator*() const & { return value; }
+  constexpr T &operator*() & { return value; }
 
   /**
-   * Get result if success, undefined if it isn't
+   * Moves the result out if success, undefined if it isn't
    */
-  constexpr const T &operator*() const & { return result.value; }
+  constexpr T take() { return static_cast<T &&>(value); }
 
   /**
    * Compare with a value. True if successful and value is equal
    */
-  constexpr bool operator==(T &&value) {
-    return success && result.value == value;
+  constexpr bool operator==(const T &other) const {
+    return success() && value == other;
   }
+};
 
-  /**
-   * Get error if not success, undefined if it is not an error
-   */
-  constexpr Error error() const { return result.error; }
+/**
+ * Result of a pointer, which is a single pointer-sized word
+ *
+ * Errors are stored as addresses with bit 62 set and bit 63 clear. These
+ * are not canonical with either 4 or 5-level paging, so no valid pointer
+ * looks like an error.
+ */
+template <typename T> class Result<T *> {
+  static const u64 ErrorTag = 1ULL << 62;
+
+  T *value;
+
+  u64 bits() const { return reinterpret_cast<u64>(value); }
+
+public:
+  Result(T *value) : value(value) {}
+  Result(Error error) : value(reinterpret_cast<T *>(ErrorTag | error.code)) {}
+
+  bool success() const { return bits() >> 62 != 1; }
+
+  Error error() const { return Error(static_cast<u32>(bits())); }
+
+  T *const *operator->() const { return &value; }
+  T *const &operator*() const { return value; }
+  T *take() { return value; }
+
+  bool operator==(T *other) const { return success() && value == other; }
+};
+
+/**
+ * Result of a type with a single value, which is just an error code
+ */
+template <unit T> class Result<T> {
+  u32 code;
+
+public:
+  constexpr Result(T) : code(0) {}
+  constexpr Result(Error error) : code(error.code) {}
+
+  constexpr bool success() const { return code == 0; }
+  constexpr Error error() const { return Error(code); }
+
+  constexpr T operator*() const { return T{}; }
+  constexpr T take() const { return T{}; }
+
+  constexpr bool operator==(const T &) const { return success(); }
 };
 
 } // namespace libpara::err
@@ -120,67 +278,189 @@ template <typename T> struct Result {
 
 export namespace libpara::err::tests {
 
+using namespace libpara::err;
+
+/**
+ * Move-only value counting how many live copies of it there are
+ */
+class Unique {
+  int *live;
+
+public:
+  int value;
+
+  Unique(int *live, int value) : live(live), value(value) { (*live)++; }
+  Unique(const Unique &) = delete;
+  Unique(Unique &&other) : live(other.live), value(other.value) {
+    (*live)++;
+  }
+  ~Unique() { (*live)--; }
+};
+
+/**
+ * Layout of Results before they had compact errors, as a benchmark
+ * baseline: a 24-byte struct returned through memory
+ */
+struct LegacyResult {
+  union {
+    void *value;
+    struct {
+      const char *name;
+      u64 id;
+    } error;
+  } result;
+  bool success;
+};
+
+const auto FailedError = "Failed"_error;
+
+[[gnu::noinline]] Result<void *> step(u64 i) {
+  if (i == ~0ULL)
+    return FailedError;
+  return reinterpret_cast<void *>(i);
+}
+
+[[gnu::noinline]] Result<void *> steps(u64 i) {
+  auto a = tryUnwrap(step(i));
+  auto b = tryUnwrap(step(reinterpret_cast<u64>(a) + 1));
+  return b;
+}
+
+[[gnu::noinline]] LegacyResult legacyStep(u64 i) {
+  if (i == ~0ULL)
+    return {.result = {.error = {"Failed", 1}}, .success = false};
+  return {.result = {.value = reinterpret_cast<void *>(i)}, .success = true};
+}
+
+[[gnu::noinline]] LegacyResult legacySteps(u64 i) {
+  auto a = legacyStep(i);
+  if (!a.success)
+    return a;
+  return legacyStep(reinterpret_cast<u64>(a.result.value) + 1);
+}
+
+static_assert(sizeof(Error) == 4);
+static_assert(sizeof(Result<nothing>) == 4);
+static_assert(sizeof(Result<void *>) == 8);
+static_assert(sizeof(Result<u32>) == 8);
+static_assert(sizeof(Result<u64>) == 16);
+// trivially copyable and no larger than 16 bytes: returned in registers
+static_assert(__is_trivially_copyable(Result<nothing>));
+static_assert(__is_trivially_copyable(Result<void *>));
+static_assert(__is_trivially_copyable(Result<u64>));
+static_assert(!__is_trivially_copyable(Result<Unique>));
+
 class TestCase : public libpara::testing::TestCase {
 
+  static bool equal(const char *a, const char *b) {
+    for (; *a != 0 && *a == *b; a++, b++)
+      ;
+    return *a == *b;
+  }
+
 public:
   using libpara::testing::TestCase::TestCase;
 
   virtual void run() {
     test("Error construction");
     {
-
-      auto err = Error("test");
-      Expect(err.name[0] == 't');
-      Expect(err.name[1] == 'e');
-      Expect(err.name[2] == 's');
-      Expect(err.name[3] == 't');
-      Expect(err.name[4] == 0);
+      auto err = "test"_error;
+      Expect(err.code != 0);
+      Expect(equal(err.name(), "test"));
+      Expect(equal(Error(0).name(), "UnknownError"));
     }
 
     test("Error equality");
     {
 
-      auto err1 = Error("test1");
-      auto err2 = Error("test2");
-      auto err3 = Error("test1");
+      auto err1 = "test1"_error;
+      auto err2 = "test2"_error;
+      auto err3 = "test1"_error;
 
       Expect(err1 == err3);
       Expect(err1 != err2);
     }
+
+    test("Error codes are unique");
+    {
+      bool unique = true;
+      for (auto a = __start_errors; a < __stop_errors; a++)
+        for (auto b = a + 1; b < __stop_errors; b++)
+          unique &= a->code != b->code || equal(a->name, b->name);
+      Expect(unique);
+      Expect(__stop_errors - __start_errors >= 3);
+    }
+
     test("Result construction");
     {
 
       Result<int> r(1);
-      Expect(r.success);
+      Expect(r.success());
       Expect(r == 1);
       Expect(*r == 1);
 
-      Result<int> r1(Error("e"));
-      Expect(!r1.success);
-      Expect(r1 == Error("e"));
-      Expect(r1.error() == Error("e"));
+      Result<int> r1("e"_error);
+      Expect(!r1.success());
+      Expect(r1 == "e"_error);
+      Expect(r1.error() == "e"_error);
 
       int val = 1;
       Result<int> r2(val);
-      Expect(r2.success);
+      Expect(r2.success());
       Expect(r2 == 1);
       Expect(*r2 == 1);
     }
 
+    test("Results of pointers keep errors in the pointer");
+    {
+      int i = 0;
+      Result<int *> r(&i);
+      Expect(r.success() && *r == &i);
+      Result<int *> r1(nullptr);
+      Expect(r1.success() && r1 == nullptr);
+      Result<int *> r2("e"_error);
+      Expect(!r2.success() && r2.error() == "e"_error);
+      Result<nothing> r3(nothing{});
+      Expect(r3.success());
+      Result<nothing> r4("e"_error);
+      Expect(r4 == "e"_error);
+    }
+
+    test("Move-only results");
+    {
+      int live = 0;
+      {
+        auto make = [&](int value) -> Result<Unique> {
+          if (value < 0)
+            return "negative"_error;
+          return Unique(&live, value);
+        };
+        auto pass = [&](int value) -> Result<Unique> {
+          auto unique = tryUnwrap(make(value));
+          unique.value++;
+          return static_cast<Unique &&>(unique);
+        };
+        auto r = pass(1);
+        Expect(r.success() && r->value == 2);
+        Expect(live == 1);
+        Expect(pass(-1) == "negative"_error);
+        Expect(live == 1);
+      }
+      Expect(live == 0);
+    }
+
     test("return_error");
     {
       auto fret = []() -> Result<int> {
-        return return_error(Error("failure"));
+        return return_error("failure"_error);
       };
-      Expect(fret() == Error("failure"));
-      auto fret_str = []() -> Result<int> { return return_error("failure"); };
-      Expect(fret_str() == Error("failure"));
+      Expect(fret() == "failure"_error);
       auto fret_unsup = []() -> Result<int> { return return_error(true); };
-      Expect(fret_unsup() == Error("Unsupported error"));
+      Expect(fret_unsup() == "Unsupported error"_error);
     }
     test("tryUnwrap");
     {
-      auto f_fail = []() -> Result<int> { return Error("err"); };
+      auto f_fail = []() -> Result<int> { return "err"_error; };
       auto f = []() -> Result<int> { return 1; };
       auto f_try = [=]() -> Result<int> {
         tryUnwrap(f());
@@ -191,7 +471,7 @@ public:
         return 1;
       };
       Expect(f_try() == 2);
-      Expect(f_try_fail() == Error("err"));
+      Expect(f_try_fail() == "err"_error);
     }
 
     test("tryUnwrap executes code block once");
@@ -209,24 +489,56 @@ public:
 
       auto f_fail = [&]() -> Result<int> {
         i += 1;
-        return Error("err");
+        return "err"_error;
       };
 
       auto f_fail_try = [&]() -> Result<int> { return tryUnwrap(f_fail()); };
-      Expect(f_fail_try() == Error("err"));
+      Expect(f_fail_try() == "err"_error);
       Expect(i == 1);
     }
 
     test("tryCatch");
     {
-      Result<int> r(Error("err"));
+      Result<int> r("err"_error);
       Expect(tryCatch(r, err, 1) == 1);
-      Result<int> r0(Error("err"));
-      Expect(tryCatch(r0, err, err.name[0] == 'e' ? 1 : 0) == 1);
+      Result<int> r0("err"_error);
+      Expect(tryCatch(r0, err, err.name()[0] == 'e' ? 1 : 0) == 1);
       Result<int> r1(10);
       Expect(tryCatch(r1, err, 1) == 10);
+      int i = 0;
+      auto f_fail = [&]() -> Result<int> {
+        i += 1;
+        return "err"_error;
+      };
+      Expect(tryCatch(f_fail(), err, 2) == 2);
+      Expect(i == 1);
+    }
+
+    test("Errors propagate through chained results");
+    {
+      Expect(reinterpret_cast<u64>(*steps(1)) == 2);
+      Expect(steps(~0ULL) == FailedError);
     }
   }
 };
 } // namespace libpara::err::tests
 
+import libpara.bench;
+
+export namespace libpara::err::benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    using libpara::bench::keep;
+    u64 i = 0;
+    // two chained calls returning an 8-byte `Result<void *>` in a register
+    measure("result.compact", [&] { keep(tests::steps(i++)); });
+    // the same with the 24-byte results returned through memory before
+    measure("result.legacy", [&] { keep(tests::legacySteps(i++)); });
+  }
+};
+
+} // namespace libpara::err::benchmarks
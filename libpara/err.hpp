@@ -1,17 +1,16 @@
 #define tryUnwrap(e)                                                           \
   ({                                                                           \
     auto v = e;                                                                \
-    auto value = v.result.value;                                               \
-    if (!v.success)                                                            \
-      return v.result.error;                                                   \
-    value;                                                                     \
+    if (!v.success())                                                          \
+      return v.error();                                                        \
+    v.take();                                                                  \
   })
 
 #define tryCatch(e, err, c)                                                    \
   ({                                                                           \
     auto v = e;                                                                \
-    v.success ? v.result.value : ({                                            \
-      [[maybe_unused]] auto err = e.error();                                   \
+    v.success() ? v.take() : ({                                                \
+      [[maybe_unused]] auto err = v.error();                                   \
       c;                                                                       \
     });                                                                        \
   })
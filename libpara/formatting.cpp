@@ -7,16 +7,219 @@ using namespace libpara::basic_types;
 using namespace libpara;
 using namespace libpara::concepts;
 
-const constexpr char *digits = "0123456789";
-const constexpr double log10_2 = 0.30102999566398;
+// "00" to "99", so that decimal conversion produces two digits per division
+const constexpr char decimal_pairs[] = "00010203040506070809"
+                                       "10111213141516171819"
+                                       "20212223242526272829"
+                                       "30313233343536373839"
+                                       "40414243444546474849"
+                                       "50515253545556575859"
+                                       "60616263646566676869"
+                                       "70717273747576777879"
+                                       "80818283848586878889"
+                                       "90919293949596979899";
+
+const constexpr char *hex_digits = "0123456789abcdef";
 
 export namespace libpara::formatting {
 
+/**
+ * Destination of formatted output, taking either null-terminated strings or
+ * spans of bytes
+ */
 template <typename T>
-concept writer = requires(T t, const char *s) {
+concept writer = requires(T t, const char *s, const u8 *bytes, usize size) {
   {t.write(s)};
+  {t.write(bytes, size)};
+};
+
+/**
+ * Writer duplicating all output to two writers
+ */
+template <writer A, writer B> class Tee {
+  A &a;
+  B &b;
+
+public:
+  Tee(A &a, B &b) : a(a), b(b) {}
+
+  void write(const char *s) {
+    a.write(s);
+    b.write(s);
+  }
+
+  void write(const u8 *bytes, usize size) {
+    a.write(bytes, size);
+    b.write(bytes, size);
+  }
+};
+
+/**
+ * Writer collecting output in a buffer of its own (usually on the stack),
+ * passing it on in as few bulk writes as possible: when full, when flushed
+ * and when destroyed
+ */
+template <writer W, usize capacity = 256> class Buffered {
+  W &target;
+  u8 buffer[capacity];
+  usize used = 0;
+
+public:
+  Buffered(W &target) : target(target) {}
+  Buffered(Buffered &) = delete;
+  ~Buffered() { flush(); }
+
+  void write(const char *s) {
+    usize size = 0;
+    while (s[size] != 0)
+      size++;
+    write(reinterpret_cast<const u8 *>(s), size);
+  }
+
+  void write(const u8 *bytes, usize size) {
+    if (used + size > capacity) {
+      flush();
+      // too big to buffer at all
+      if (size > capacity) {
+        target.write(bytes, size);
+        return;
+      }
+    }
+    for (usize i = 0; i < size; i++)
+      buffer[used + i] = bytes[i];
+    used += size;
+  }
+
+  void flush() {
+    if (used > 0)
+      target.write(buffer, used);
+    used = 0;
+  }
 };
 
+template <typename T> struct is_buffered {
+  constexpr static bool value = false;
+};
+
+template <writer W, usize capacity> struct is_buffered<Buffered<W, capacity>> {
+  constexpr static bool value = true;
+};
+
+/**
+ * Maximum number of digits of any `T` value in `base` (2, 10 or 16),
+ * excluding the sign
+ */
+template <concepts::integer T> consteval usize maxDigits(u8 base) {
+  u64 value = ~0ULL >> (64 - sizeof(T) * 8);
+  usize digits = 1;
+  while (value >= base) {
+    value /= base;
+    digits++;
+  }
+  return digits;
+}
+
+/**
+ * Writes `value` in decimal, ending just before `end`, and returns where
+ * it starts
+ */
+inline u8 *toDecimal(u64 value, u8 *end) {
+  auto p = end;
+  while (value >= 100) {
+    auto pair = (value % 100) * 2;
+    value /= 100;
+    *--p = decimal_pairs[pair + 1];
+    *--p = decimal_pairs[pair];
+  }
+  if (value >= 10) {
+    *--p = decimal_pairs[value * 2 + 1];
+    *--p = decimal_pairs[value * 2];
+  } else
+    *--p = static_cast<u8>('0' + value);
+  return p;
+}
+
+/**
+ * Writes `value` in base `1 << bits` (binary or hexadecimal), ending just
+ * before `end`, and returns where it starts
+ */
+inline u8 *toPowerOfTwo(u64 value, u8 bits, u8 *end) {
+  auto p = end;
+  auto mask = (1U << bits) - 1;
+  do {
+    *--p = static_cast<u8>(hex_digits[value & mask]);
+    value >>= bits;
+  } while (value != 0);
+  return p;
+}
+
+/**
+ * Integer with formatting options, as made by `hex`, `binary`, `padded` and
+ * `pointer`
+ */
+template <concepts::integer T> struct Formatted {
+  T value;
+  // 2, 10 or 16
+  u8 base = 10;
+  // minimum number of characters, including the prefix and sign
+  u8 width = 0;
+  char fill = ' ';
+  // "0x" or "0b"
+  bool prefix = false;
+  // pad on the right instead
+  bool left = false;
+};
+
+/**
+ * Lowercase hexadecimal, with at least `width` digits. Negative values are
+ * written as their two's complement.
+ */
+template <concepts::integer T> Formatted<T> hex(T value, u8 width = 0) {
+  return {.value = value, .base = 16, .width = width, .fill = '0'};
+}
+
+/**
+ * Binary, with at least `width` digits. Negative values are written as their
+ * two's complement.
+ */
+template <concepts::integer T> Formatted<T> binary(T value, u8 width = 0) {
+  return {.value = value, .base = 2, .width = width, .fill = '0'};
+}
+
+/**
+ * Decimal, right-aligned to `width` characters with `fill`
+ */
+template <concepts::integer T>
+Formatted<T> padded(T value, u8 width, char fill = ' ') {
+  return {.value = value, .width = width, .fill = fill};
+}
+
+/**
+ * Address of `p` as "0x" and 16 hexadecimal digits
+ */
+inline Formatted<usize> pointer(const void *p) {
+  return {.value = reinterpret_cast<usize>(p),
+          .base = 16,
+          .width = 18,
+          .fill = '0',
+          .prefix = true};
+}
+
+/**
+ * Writes `fill` as many times as it takes to grow `length` characters to
+ * `width`
+ */
+template <writer W> void fill(W &writer, char fill, usize length, u8 width) {
+  u8 chunk[16];
+  for (auto &c : chunk)
+    c = static_cast<u8>(fill);
+  while (length < width) {
+    auto n = width - length < sizeof(chunk) ? width - length : sizeof(chunk);
+    writer.write(chunk, n);
+    length += n;
+  }
+}
+
 template <writer W, typename T, typename... Ts> struct formatter {};
 
 template <writer W, typename... Ts> struct formatter<W, const char *, Ts...> {
@@ -30,43 +233,359 @@ template <writer W, typename... Ts> struct formatter<W, const char *, Ts...> {
 template <writer W, concepts::integer T, typename... Ts>
 struct formatter<W, T, Ts...> {
   static void format(W &writer, T value, Ts... rest) {
-    // For simplicity's sake, we allow log10(2) * bitwidth + 1
-    // + 1 byte for null terminator + 1 (if signed) for sign
-    const constexpr usize len = (log10_2 * sizeof(T) * 8) + 2 +
-                                (concepts::is_signed_integer<T>::value ? 1 : 0);
+    const constexpr usize len =
+        maxDigits<T>(10) + (concepts::is_signed_integer<T>::value ? 1 : 0);
+    u8 buf[len];
+    u64 magnitude = static_cast<u64>(value);
     auto negative = false;
     if constexpr (concepts::is_signed_integer<T>::value) {
       if (value < 0) {
-        value = -value;
+        // also right for the most negative value, which can't be negated
+        magnitude = 0 - magnitude;
         negative = true;
       }
     }
-    char buf[len];
-    buf[len - 1] = 0;
-    auto i = len - 1;
-    if (value == 0) {
-      i--;
-      buf[i] = '0';
-    } else
-      while (value > 0) {
-        i--;
-        buf[i] = (char)digits[value % 10];
-        value = value / 10;
-      }
-    if (negative) {
-      i--;
-      buf[i] = '-';
+    auto start = toDecimal(magnitude, buf + len);
+    if (negative)
+      *--start = '-';
+    writer.write(start, static_cast<usize>(buf + len - start));
+
+    if constexpr (sizeof...(rest) > 0)
+      formatter<W, Ts...>::format(writer, rest...);
+  }
+};
+
+template <writer W, concepts::integer T, typename... Ts>
+struct formatter<W, Formatted<T>, Ts...> {
+  static void format(W &writer, Formatted<T> value, Ts... rest) {
+    // binary digits, a sign or prefix, and up to 255 characters of padding
+    const constexpr usize len = maxDigits<T>(2) + 2 + 255;
+    u8 buf[len];
+    auto end = buf + len;
+    // two's complement of negative values, in T's width
+    u64 bits = static_cast<u64>(value.value) & (~0ULL >> (64 - sizeof(T) * 8));
+    auto negative = false;
+    u8 *start;
+    switch (value.base) {
+    case 2:
+      start = toPowerOfTwo(bits, 1, end);
+      break;
+    case 16:
+      start = toPowerOfTwo(bits, 4, end);
+      break;
+    default:
+      if constexpr (concepts::is_signed_integer<T>::value)
+        negative = value.value < 0;
+      start = toDecimal(negative ? 0 - static_cast<u64>(value.value)
+                                 : static_cast<u64>(value.value),
+                        end);
+    }
+    usize prefix = value.prefix && value.base != 10 ? 2 : negative ? 1 : 0;
+    // zeros go between the sign or prefix and the digits, anything else
+    // before them
+    auto digits = static_cast<usize>(end - start);
+    if (value.fill == '0' && !value.left)
+      for (; digits + prefix < value.width; digits++)
+        *--start = '0';
+    if (prefix == 2) {
+      *--start = value.base == 16 ? 'x' : 'b';
+      *--start = '0';
+    } else if (negative)
+      *--start = '-';
+    auto length = static_cast<usize>(end - start);
+    if (value.left) {
+      writer.write(start, length);
+      fill(writer, value.fill, length, value.width);
+    } else {
+      while (static_cast<usize>(end - start) < value.width)
+        *--start = static_cast<u8>(value.fill);
+      writer.write(start, static_cast<usize>(end - start));
     }
-    writer.write(buf + i);
 
     if constexpr (sizeof...(rest) > 0)
       formatter<W, Ts...>::format(writer, rest...);
   }
 };
 
+/**
+ * Writes all arguments to `writer`, in a single bulk write unless they add
+ * up to more than `Buffered`'s default capacity
+ */
 template <writer W, typename T, typename... Ts>
 void format(W &writer, T value, Ts... rest) {
-  formatter<W, T, Ts...>::format(writer, value, rest...);
+  if constexpr (is_buffered<W>::value)
+    formatter<W, T, Ts...>::format(writer, value, rest...);
+  else {
+    Buffered<W> buffered(writer);
+    formatter<Buffered<W>, T, Ts...>::format(buffered, value, rest...);
+  }
+}
+
+/**
+ * Format string, usable as a template argument
+ */
+template <usize n> struct Literal {
+  char value[n];
+
+  consteval Literal(const char (&string)[n]) {
+    for (usize i = 0; i < n; i++)
+      value[i] = string[i];
+  }
+
+  // excluding the null terminator
+  static constexpr usize size = n - 1;
+};
+
+/**
+ * Replacement field options: `{:[[fill]<|>][#][0][width][d|x|b|p|s]}`
+ */
+struct Spec {
+  u8 base = 10;
+  u8 width = 0;
+  char fill = ' ';
+  bool prefix = false;
+  bool left = false;
+  // 'd', 'x', 'b', 'p', 's' or 0 if not given
+  char type = 0;
+};
+
+/**
+ * Piece of a format string: either literal text to copy or a replacement
+ * field
+ */
+struct Segment {
+  usize start = 0;
+  usize length = 0;
+  bool field = false;
+  Spec spec;
+};
+
+// Not constexpr: calling it while parsing a format string makes the
+// compiler report `message`
+void invalidFormatString(const char *message);
+
+/**
+ * Parses a replacement field's spec, between ':' and '}'
+ */
+consteval Spec parseSpec(const char *s, usize n) {
+  Spec spec;
+  usize i = 0;
+  if (n >= 2 && (s[1] == '<' || s[1] == '>')) {
+    spec.fill = s[0];
+    spec.left = s[1] == '<';
+    i = 2;
+  } else if (n >= 1 && (s[0] == '<' || s[0] == '>')) {
+    spec.left = s[0] == '<';
+    i = 1;
+  }
+  if (i < n && s[i] == '#') {
+    spec.prefix = true;
+    i++;
+  }
+  if (i < n && s[i] == '0') {
+    spec.fill = '0';
+    i++;
+  }
+  usize width = 0;
+  for (; i < n && s[i] >= '0' && s[i] <= '9'; i++)
+    width = width * 10 + static_cast<usize>(s[i] - '0');
+  if (width > 255)
+    invalidFormatString("width is over 255");
+  spec.width = static_cast<u8>(width);
+  if (i < n) {
+    spec.type = s[i++];
+    switch (spec.type) {
+    case 'd':
+    case 's':
+      break;
+    case 'x':
+    case 'p':
+      spec.base = 16;
+      break;
+    case 'b':
+      spec.base = 2;
+      break;
+    default:
+      invalidFormatString("unknown type in replacement field");
+    }
+  }
+  if (i != n)
+    invalidFormatString("malformed replacement field");
+  return spec;
+}
+
+/**
+ * Splits format string `s` of `n` characters into `segments`, unless null,
+ * and returns how many there are
+ */
+consteval usize parseSegments(const char *s, usize n, Segment *segments) {
+  usize count = 0;
+  auto add = [&](Segment segment) {
+    if (segments != nullptr)
+      segments[count] = segment;
+    count++;
+  };
+  usize text = 0;
+  for (usize i = 0; i < n;) {
+    if (s[i] != '{' && s[i] != '}') {
+      i++;
+      continue;
+    }
+    if (i + 1 < n && s[i + 1] == s[i]) {
+      // "{{" or "}}": the text runs up to and including the first brace
+      add(Segment{.start = text, .length = i + 1 - text});
+      text = i += 2;
+      continue;
+    }
+    if (s[i] == '}')
+      invalidFormatString("unmatched '}'");
+    if (i > text)
+      add(Segment{.start = text, .length = i - text});
+    auto close = i + 1;
+    while (close < n && s[close] != '}' && s[close] != '{')
+      close++;
+    if (close == n || s[close] != '}')
+      invalidFormatString("unterminated replacement field");
+    Spec spec;
+    if (close > i + 1) {
+      if (s[i + 1] != ':')
+        invalidFormatString("replacement fields can't have argument ids");
+      spec = parseSpec(s + i + 2, close - i - 2);
+    }
+    add(Segment{.field = true, .spec = spec});
+    text = i = close + 1;
+  }
+  if (n > text)
+    add(Segment{.start = text, .length = n - text});
+  return count;
+}
+
+template <usize n> struct Parsed {
+  static constexpr usize count = n;
+  Segment segments[n > 0 ? n : 1];
+  usize fields = 0;
+};
+
+template <Literal string> consteval auto parse() {
+  constexpr auto count = parseSegments(string.value, string.size, nullptr);
+  Parsed<count> parsed;
+  parseSegments(string.value, string.size, parsed.segments);
+  for (usize i = 0; i < count; i++)
+    if (parsed.segments[i].field)
+      parsed.fields++;
+  return parsed;
+}
+
+template <typename T> struct is_pointer {
+  constexpr static bool value = false;
+};
+
+template <typename T> struct is_pointer<T *> {
+  constexpr static bool value = true;
+};
+
+/**
+ * Formats `value` as described by `spec`, rejecting combinations that don't
+ * make sense at compile time
+ */
+template <Spec spec, writer W, typename T>
+void formatField(W &writer, T value) {
+  constexpr bool is_string =
+      requires(T t, const char *&s) { s = t; } && spec.type != 'p';
+  if constexpr (concepts::integer<T>) {
+    static_assert(spec.type != 's' && spec.type != 'p',
+                  "integers take d, x or b");
+    if constexpr (spec.base == 10 && spec.width == 0)
+      formatter<W, T>::format(writer, value);
+    else
+      formatter<W, Formatted<T>>::format(
+          writer, Formatted<T>{.value = value,
+                               .base = spec.base,
+                               .width = spec.width,
+                               .fill = spec.fill,
+                               .prefix = spec.prefix,
+                               .left = spec.left});
+  } else if constexpr (is_string) {
+    static_assert(spec.type == 0 || spec.type == 's', "strings take s");
+    static_assert(!spec.prefix && spec.fill != '0',
+                  "strings can't have a prefix or zero padding");
+    const char *s = value;
+    usize length = 0;
+    while (s[length] != 0)
+      length++;
+    if (!spec.left)
+      fill(writer, spec.fill, length, spec.width);
+    writer.write(reinterpret_cast<const u8 *>(s), length);
+    if (spec.left)
+      fill(writer, spec.fill, length, spec.width);
+  } else if constexpr (is_pointer<T>::value) {
+    static_assert(spec.type == 0 || spec.type == 'p', "pointers take p");
+    auto formatted = pointer(value);
+    formatted.left = spec.left;
+    if (spec.width > formatted.width) {
+      formatted.width = spec.width;
+      formatted.fill = spec.fill;
+    }
+    formatter<W, Formatted<usize>>::format(writer, formatted);
+  } else {
+    static_assert(spec.type == 0 && spec.width == 0,
+                  "only integers, strings and pointers take options");
+    formatter<W, T>::format(writer, value);
+  }
+}
+
+/**
+ * Formatting code for format string `string`, generated at compile time
+ */
+template <Literal string> struct Format {
+  static constexpr auto parsed = parse<string>();
+
+  template <usize i, writer W, typename... Args>
+  static void emit(W &writer, Args... args) {
+    if constexpr (i == parsed.count)
+      return;
+    else if constexpr (!parsed.segments[i].field) {
+      writer.write(reinterpret_cast<const u8 *>(string.value) +
+                       parsed.segments[i].start,
+                   parsed.segments[i].length);
+      emit<i + 1>(writer, args...);
+    } else
+      emitField<i>(writer, args...);
+  }
+
+  template <usize i, writer W, typename T, typename... Args>
+  static void emitField(W &writer, T value, Args... rest) {
+    formatField<parsed.segments[i].spec>(writer, value);
+    emit<i + 1>(writer, rest...);
+  }
+};
+
+/**
+ * Writes `args` as laid out by format string `string`, in a single bulk
+ * write unless it adds up to more than `Buffered`'s default capacity
+ *
+ * ```
+ * format<"CPU #{} ready, stack at {:p}, flags {:#010x}\n">(writer, id, sp,
+ *                                                          flags);
+ * ```
+ *
+ * `{}` is replaced with the next argument. Options after a colon follow
+ * `{:[[fill]<|>][#][0][width][type]}`, with type `d`, `x` or `b` for
+ * integers, `s` for strings and `p` for pointers. `{{` and `}}` are literal
+ * braces. The string is parsed at compile time, and malformed strings,
+ * argument count mismatches and options that don't fit an argument's type
+ * are compile errors.
+ */
+template <Literal string, writer W, typename... Args>
+void format(W &writer, Args... args) {
+  static_assert(Format<string>::parsed.fields == sizeof...(Args),
+                "number of arguments doesn't match the format string");
+  if constexpr (is_buffered<W>::value)
+    Format<string>::template emit<0>(writer, args...);
+  else {
+    Buffered<W> buffered(writer);
+    Format<string>::template emit<0>(buffered, args...);
+  }
 }
 
 } // namespace libpara::formatting
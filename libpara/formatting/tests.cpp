@@ -0,0 +1,245 @@
+export module libpara.formatting.tests;
+
+import libpara.basic_types;
+import libpara.bench;
+import libpara.formatting;
+import libpara.testing;
+
+using namespace libpara::basic_types;
+using namespace libpara::formatting;
+
+#include <testing.hpp>
+
+// libpara.testing depends on libpara.formatting, so its tests (and
+// benchmarks) live here
+export namespace libpara::formatting::tests {
+
+/**
+ * Writer collecting output into a string, counting writes
+ */
+class StringWriter {
+  char buffer[512];
+  usize size = 0;
+
+public:
+  u32 writes = 0;
+
+  void write(const char *s) {
+    usize n = 0;
+    while (s[n] != 0)
+      n++;
+    write(reinterpret_cast<const u8 *>(s), n);
+  }
+
+  void write(const u8 *bytes, usize n) {
+    writes++;
+    for (usize i = 0; i < n && size < sizeof(buffer) - 1; i++)
+      buffer[size++] = static_cast<char>(bytes[i]);
+    buffer[size] = 0;
+  }
+
+  bool is(const char *expected) const {
+    usize i = 0;
+    for (; expected[i] != 0; i++)
+      if (i >= size || buffer[i] != expected[i])
+        return false;
+    return i == size;
+  }
+
+  void clear() {
+    size = 0;
+    writes = 0;
+  }
+};
+
+/**
+ * Writer discarding its output, so that benchmarks measure conversion only
+ */
+struct NullWriter {
+  u64 bytes = 0;
+
+  void write(const char *s) {
+    while (s[0] != 0) {
+      bytes++;
+      s++;
+    }
+  }
+
+  void write(const u8 *, usize size) { bytes += size; }
+};
+
+/**
+ * Decimal conversion as it was before two-digit conversion, as a
+ * benchmark baseline
+ */
+template <writer W> void formatDigitByDigit(W &writer, u64 value) {
+  u8 buf[20];
+  auto i = sizeof(buf);
+  do {
+    buf[--i] = static_cast<u8>('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  writer.write(buf + i, sizeof(buf) - i);
+}
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    StringWriter w;
+
+    test("Decimal integers");
+    {
+      format(w, 0, " ", 7, " ", 42, " ", 1234567890);
+      Expect(w.is("0 7 42 1234567890"));
+      w.clear();
+      format(w, static_cast<u64>(18446744073709551615ULL));
+      Expect(w.is("18446744073709551615"));
+      w.clear();
+      format(w, static_cast<i8>(-128), " ", static_cast<i64>(-1), " ",
+             static_cast<i64>(-9223372036854775807LL - 1));
+      Expect(w.is("-128 -1 -9223372036854775808"));
+      w.clear();
+    }
+
+    test("Hexadecimal and binary integers");
+    {
+      format(w, hex(0xBEEFu), " ", hex(static_cast<u8>(5), 2), " ",
+             hex(static_cast<i16>(-1)), " ", binary(5u), " ",
+             binary(static_cast<u8>(5), 8));
+      Expect(w.is("beef 05 ffff 101 00000101"));
+      w.clear();
+    }
+
+    test("Padded integers");
+    {
+      format(w, "[", padded(42, 5), "][", padded(-42, 5, '0'), "][",
+             padded(123456, 3), "]");
+      Expect(w.is("[   42][-0042][123456]"));
+      w.clear();
+    }
+
+    test("Pointers");
+    {
+      format(w, pointer(reinterpret_cast<const void *>(0xFFFF800000001000)),
+             " ", pointer(nullptr));
+      Expect(w.is("0xffff800000001000 0x0000000000000000"));
+      w.clear();
+    }
+
+    test("format() writes once");
+    {
+      format(w, "CPU #", 3, " ready at ", hex(0x1000u), "\n");
+      Expect(w.is("CPU #3 ready at 1000\n"));
+      Expect(w.writes == 1);
+      w.clear();
+    }
+
+    test("Buffered writes output too big to buffer directly");
+    {
+      {
+        Buffered<StringWriter, 4> buffered(w);
+        buffered.write("ab");
+        Expect(w.writes == 0);
+        buffered.write("cdefgh");
+        // "ab" was flushed first
+        Expect(w.writes == 2);
+        buffered.write("ij");
+      }
+      Expect(w.is("abcdefghij"));
+      Expect(w.writes == 3);
+      w.clear();
+    }
+
+    test("Format strings");
+    {
+      format<"CPU #{} ready\n">(w, 3);
+      Expect(w.is("CPU #3 ready\n"));
+      Expect(w.writes == 1);
+      w.clear();
+      format<"{}">(w, "only");
+      Expect(w.is("only"));
+      w.clear();
+      format<"no fields">(w);
+      Expect(w.is("no fields"));
+      w.clear();
+      format<"{{{}}} }}{{">(w, -5);
+      Expect(w.is("{-5} }{"));
+      w.clear();
+    }
+
+    test("Format string options");
+    {
+      format<"{:x} {:#x} {:08x} {:#010x} {:b} {:#b} {:d}">(
+          w, 255u, 255u, 255u, 255u, 5u, 5u, 7);
+      Expect(w.is("ff 0xff 000000ff 0x000000ff 101 0b101 7"));
+      w.clear();
+      format<"[{:5}][{:<5}][{:*>5}][{:05}]">(w, 42, 42, 42, -42);
+      Expect(w.is("[   42][42   ][***42][-0042]"));
+      w.clear();
+      format<"[{:6}][{:<6s}][{:.>6}]">(w, "ab", "cd", "ef");
+      Expect(w.is("[    ab][cd    ][....ef]"));
+      w.clear();
+      format<"{} {:p}">(w, reinterpret_cast<void *>(0x1000),
+                        reinterpret_cast<const char *>(0x2000));
+      Expect(w.is("0x0000000000001000 0x0000000000002000"));
+      w.clear();
+    }
+
+    test("Format string parsing happens at compile time");
+    {
+      constexpr auto parsed = parse<"a{:#x}b{}">();
+      static_assert(parsed.count == 4);
+      static_assert(parsed.fields == 2);
+      static_assert(parsed.segments[1].field &&
+                    parsed.segments[1].spec.base == 16 &&
+                    parsed.segments[1].spec.prefix);
+      Expect(parsed.segments[2].length == 1);
+    }
+  }
+};
+
+} // namespace libpara::formatting::tests
+
+export namespace libpara::formatting::benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    tests::NullWriter sink;
+    u64 value = 0x9E3779B97F4A7C15;
+    measure("format.u64", [&] {
+      value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+      format(sink, value);
+    });
+    // conversion alone, against how it was before it took two digits at a
+    // time
+    measure("format.u64.convert", [&] {
+      value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+      formatter<tests::NullWriter, u64>::format(sink, value);
+    });
+    measure("format.u64.digits", [&] {
+      value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+      tests::formatDigitByDigit(sink, value);
+    });
+    measure("format.hex", [&] {
+      value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+      format(sink, hex(value));
+    });
+    measure("format.mixed", [&] {
+      value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+      format(sink, "CPU #", value >> 60, " at ", hex(value), "\n");
+    });
+    measure("format.string", [&] {
+      value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+      format<"CPU #{} at {:#x}\n">(sink, value >> 60, value);
+    });
+    libpara::bench::keep(sink.bytes);
+  }
+};
+
+} // namespace libpara::formatting::benchmarks
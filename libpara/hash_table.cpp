@@ -0,0 +1,637 @@
+export module libpara.hash_table;
+
+import libpara.basic_types;
+import libpara.concepts;
+import libpara.err;
+import libpara.xxh64;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace libpara::hash_table {
+
+/**
+ * Anything that hands out memory like `kernel::pmm` allocators do.
+ *
+ * Allocators that can also take memory back, with `deallocate(pointer,
+ * size)`, get the storage that a table outgrows returned to them. Others
+ * (like `kernel::pmm::WatermarkAllocator`) keep it.
+ */
+template <typename T>
+concept allocator = requires(T a, usize size, usize alignment) {
+  {a.allocate(size, alignment)};
+};
+
+template <typename T>
+concept deallocator = requires(T a, void *pointer, usize size) {
+  a.deallocate(pointer, size);
+};
+
+/**
+ * Default key hashing, with xxh64
+ *
+ * Integers are hashed (and compared) as their 64-bit value, so a table
+ * with `u64` keys can be looked up with any integer type. `const char *`
+ * keys are C strings, hashed and compared by contents; all other pointers
+ * are compared by address.
+ */
+struct Hasher {
+  template <libpara::concepts::integer T> static u64 hash(T value) {
+    auto v = static_cast<u64>(value);
+    return libpara::xxh64::hash(reinterpret_cast<const char *>(&v), sizeof(v),
+                                0);
+  }
+
+  template <typename T> static u64 hash(T *pointer) {
+    return hash(reinterpret_cast<usize>(pointer));
+  }
+
+  static u64 hash(const char *string) {
+    usize length = 0;
+    while (string[length] != 0)
+      length++;
+    return libpara::xxh64::hash(string, length, 0);
+  }
+
+  template <libpara::concepts::integer T, libpara::concepts::integer U>
+  static bool equal(T a, U b) {
+    return static_cast<u64>(a) == static_cast<u64>(b);
+  }
+
+  template <typename T> static bool equal(T *a, T *b) { return a == b; }
+
+  static bool equal(const char *a, const char *b) {
+    for (; *a != 0 && *a == *b; a++, b++)
+      ;
+    return *a == *b;
+  }
+};
+
+/**
+ * Control bytes, one per slot. Full slots have the top bit clear and keep
+ * 7 bits of their key's hash.
+ */
+enum Control : u8 {
+  Empty = 0x80,
+  Deleted = 0xFE,
+};
+
+/**
+ * Group of control bytes, scanned one byte at a time
+ *
+ * Matches are bit masks with bit `i` set for a match at byte `i`.
+ */
+struct ScalarGroup {
+  static const usize Width = 16;
+
+  const u8 *controls;
+
+  explicit ScalarGroup(const u8 *controls) : controls(controls) {}
+
+  u32 match(u8 h2) const {
+    u32 mask = 0;
+    for (usize i = 0; i < Width; i++)
+      if (controls[i] == h2)
+        mask |= 1U << i;
+    return mask;
+  }
+
+  u32 matchEmpty() const { return match(Empty); }
+
+  u32 matchEmptyOrDeleted() const {
+    u32 mask = 0;
+    for (usize i = 0; i < Width; i++)
+      if ((controls[i] & 0x80) != 0)
+        mask |= 1U << i;
+    return mask;
+  }
+};
+
+#ifdef __SSE2__
+typedef char i8x16 __attribute__((vector_size(16)));
+
+/**
+ * Group of control bytes, scanned with SSE2 compares and `pmovmskb`
+ */
+struct SSE2Group {
+  static const usize Width = 16;
+
+  i8x16 controls;
+
+  // groups are always aligned to their width
+  explicit SSE2Group(const u8 *controls)
+      : controls(*reinterpret_cast<const i8x16 *>(controls)) {}
+
+  u32 match(u8 h2) const {
+    return mask(controls == static_cast<char>(h2));
+  }
+
+  u32 matchEmpty() const { return match(Empty); }
+
+  // only empty and deleted slots have the top bit set
+  u32 matchEmptyOrDeleted() const { return mask(controls); }
+
+private:
+  template <typename V> static u32 mask(V v) {
+    return static_cast<u32>(__builtin_ia32_pmovmskb128((i8x16)v));
+  }
+};
+
+using Group = SSE2Group;
+#else
+using Group = ScalarGroup;
+#endif
+
+template <typename K, typename V> struct Entry {
+  K key;
+  V value;
+};
+
+/**
+ * Open addressing hash table storing `S` slots keyed by `K`, in the style of
+ * Swiss tables (https://abseil.io/about/design/swisstables)
+ *
+ * Slots are split into groups of `Group::Width`, each with a control byte.
+ * The upper bits of a key's hash pick the group where probing starts, the
+ * lower 7 bits are kept in its slot's control byte. A lookup compares these
+ * against a whole group of control bytes at once, and only looks at the
+ * slots that matched. Groups are probed quadratically until one that has
+ * an empty slot.
+ *
+ * Keys and values are copied around with their storage, so they must be
+ * trivially copyable. Lookups take any key type that `H` can hash and
+ * compare with `K`.
+ */
+template <typename K, typename S, allocator A, typename H = Hasher>
+class Table {
+  static_assert(__is_trivially_copyable(S));
+
+  // up to 7/8 of all slots can be used
+  static usize maxLoad(usize capacity) { return capacity - capacity / 8; }
+
+protected:
+  A &allocator;
+  u8 *controls = nullptr;
+  S *slots = nullptr;
+  usize slot_count = 0;
+  usize count = 0;
+  // slots that can still be filled before the table has to grow
+  usize growth_left = 0;
+
+public:
+  Table(A &allocator) : allocator(allocator) {}
+  Table(const Table &) = delete;
+  Table &operator=(const Table &) = delete;
+
+  ~Table() { release(controls, slot_count); }
+
+  usize size() const { return count; }
+  usize capacity() const { return slot_count; }
+
+  /**
+   * Makes room for `n` keys, so that inserting that many won't allocate
+   */
+  Result<nothing> reserve(usize n) {
+    auto capacity = Group::Width;
+    while (maxLoad(capacity) < n)
+      capacity *= 2;
+    if (capacity <= slot_count)
+      return nothing{};
+    return rehash(capacity);
+  }
+
+  /**
+   * Rebuilds the table with `capacity` slots (a power of two, no smaller
+   * than a group), dropping all deleted slots
+   */
+  Result<nothing> rehash(usize capacity) {
+    auto old_controls = controls;
+    auto old_slots = slots;
+    auto old_capacity = slot_count;
+
+    auto memory = reinterpret_cast<u8 *>(
+        tryUnwrap(allocator.allocate(bytes(capacity), alignment())));
+    controls = memory;
+    slots = reinterpret_cast<S *>(memory + capacity);
+    slot_count = capacity;
+    growth_left = maxLoad(capacity) - count;
+    for (usize i = 0; i < capacity; i++)
+      controls[i] = Empty;
+
+    for (usize i = 0; i < old_capacity; i++)
+      if (isFull(old_controls[i])) {
+        auto hash = H::hash(keyOf(old_slots[i]));
+        auto index = findInsertable(hash);
+        controls[index] = h2(hash);
+        slots[index] = old_slots[i];
+      }
+    release(old_controls, old_capacity);
+    return nothing{};
+  }
+
+  template <typename Q> bool contains(const Q &key) const {
+    return lookup(key) != nullptr;
+  }
+
+  /**
+   * Removes `key`, returning whether it was there
+   */
+  template <typename Q> bool erase(const Q &key) {
+    auto slot = lookup(key);
+    if (slot == nullptr)
+      return false;
+    auto index = static_cast<usize>(slot - slots);
+    // if the group still has an empty slot, no probe ever went past it and
+    // the slot can be empty again; otherwise it must stay a tombstone
+    auto group = index & ~(Group::Width - 1);
+    if (Group(controls + group).matchEmpty() != 0) {
+      controls[index] = Empty;
+      growth_left++;
+    } else
+      controls[index] = Deleted;
+    count--;
+    return true;
+  }
+
+  void clear() {
+    for (usize i = 0; i < slot_count; i++)
+      controls[i] = Empty;
+    count = 0;
+    growth_left = maxLoad(slot_count);
+  }
+
+protected:
+  static const K &keyOf(const S &slot) {
+    if constexpr (__is_same(S, K))
+      return slot;
+    else
+      return slot.key;
+  }
+
+  static bool isFull(u8 control) { return (control & 0x80) == 0; }
+  static u8 h2(u64 hash) { return static_cast<u8>(hash & 0x7F); }
+
+  template <typename Q> S *lookup(const Q &key) const {
+    if (count == 0)
+      return nullptr;
+    auto hash = H::hash(key);
+    auto mask = slot_count / Group::Width - 1;
+    auto group = (hash >> 7) & mask;
+    for (usize step = 1;; step++) {
+      auto g = Group(controls + group * Group::Width);
+      for (auto matches = g.match(h2(hash)); matches != 0;
+           matches &= matches - 1) {
+        auto index = group * Group::Width + __builtin_ctz(matches);
+        if (H::equal(keyOf(slots[index]), key))
+          return &slots[index];
+      }
+      if (g.matchEmpty() != 0)
+        return nullptr;
+      group = (group + step) & mask;
+    }
+  }
+
+  /**
+   * Finds the slot for `key`, claiming a new one for it if it isn't in the
+   * table yet (`inserted` tells which). The caller fills new slots in.
+   */
+  Result<S *> claim(const K &key, bool &inserted) {
+    auto existing = lookup(key);
+    inserted = existing == nullptr;
+    if (existing != nullptr)
+      return existing;
+
+    if (slot_count == 0)
+      tryUnwrap(rehash(Group::Width));
+    auto hash = H::hash(key);
+    auto index = findInsertable(hash);
+    // deleted slots can be reused, but taking an empty one uses up room
+    if (growth_left == 0 && controls[index] == Empty) {
+      // when tombstones take most of the room, dropping them is enough
+      auto capacity =
+          count < maxLoad(slot_count) / 2 ? slot_count : slot_count * 2;
+      tryUnwrap(rehash(capacity));
+      index = findInsertable(hash);
+    }
+    if (controls[index] == Empty)
+      growth_left--;
+    controls[index] = h2(hash);
+    count++;
+    return &slots[index];
+  }
+
+  template <typename F> void each(F &&f) {
+    for (usize i = 0; i < slot_count; i++)
+      if (isFull(controls[i]))
+        f(slots[i]);
+  }
+
+private:
+  static usize alignment() {
+    return alignof(S) > Group::Width ? alignof(S) : Group::Width;
+  }
+
+  static usize bytes(usize capacity) {
+    // `capacity` is a multiple of the group width, which keeps the slots
+    // after the control bytes aligned
+    return capacity + capacity * sizeof(S);
+  }
+
+  /**
+   * First empty or deleted slot on `hash`'s probe sequence
+   */
+  usize findInsertable(u64 hash) const {
+    auto mask = slot_count / Group::Width - 1;
+    auto group = (hash >> 7) & mask;
+    for (usize step = 1;; step++) {
+      auto available =
+          Group(controls + group * Group::Width).matchEmptyOrDeleted();
+      if (available != 0)
+        return group * Group::Width + __builtin_ctz(available);
+      group = (group + step) & mask;
+    }
+  }
+
+  void release(u8 *memory, usize capacity) {
+    if constexpr (deallocator<A>)
+      if (memory != nullptr)
+        allocator.deallocate(memory, bytes(capacity));
+  }
+};
+
+/**
+ * Hash map from `K` to `V`
+ */
+template <typename K, typename V, allocator A, typename H = Hasher>
+class HashMap : public Table<K, Entry<K, V>, A, H> {
+public:
+  using Table<K, Entry<K, V>, A, H>::Table;
+
+  /**
+   * Inserts `key` or replaces its value, returning where the value is
+   * stored (until the table grows)
+   */
+  Result<V *> insert(const K &key, const V &value) {
+    bool inserted;
+    auto entry = tryUnwrap(this->claim(key, inserted));
+    if (inserted)
+      entry->key = key;
+    entry->value = value;
+    return &entry->value;
+  }
+
+  template <typename Q> V *find(const Q &key) {
+    auto entry = this->lookup(key);
+    return entry != nullptr ? &entry->value : nullptr;
+  }
+
+  /**
+   * Calls `f(key, value)` for every entry, in no particular order
+   */
+  template <typename F> void forEach(F &&f) {
+    this->each([&](Entry<K, V> &entry) { f(entry.key, entry.value); });
+  }
+};
+
+/**
+ * Hash set of `K`
+ */
+template <typename K, allocator A, typename H = Hasher>
+class HashSet : public Table<K, K, A, H> {
+public:
+  using Table<K, K, A, H>::Table;
+
+  /**
+   * Inserts `key`, returning whether it wasn't in the set yet
+   */
+  Result<bool> insert(const K &key) {
+    bool inserted;
+    auto slot = tryUnwrap(this->claim(key, inserted));
+    *slot = key;
+    return inserted;
+  }
+
+  /**
+   * Calls `f(key)` for every key, in no particular order
+   */
+  template <typename F> void forEach(F &&f) {
+    this->each([&](K &key) { f(key); });
+  }
+};
+
+} // namespace libpara::hash_table
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::hash_table::tests {
+
+const auto ArenaExhaustedError = "ArenaExhausted"_error;
+
+/**
+ * Bump allocator over a static buffer, which counts the memory tables give
+ * back
+ */
+struct Arena {
+  alignas(64) static inline u8 memory[128 * 1024];
+  usize used = 0;
+  usize limit = sizeof(memory);
+  usize deallocated = 0;
+
+  Result<void *> allocate(usize size, usize alignment) {
+    auto start = (used + alignment - 1) & ~(alignment - 1);
+    if (start + size > limit)
+      return ArenaExhaustedError;
+    used = start + size;
+    return static_cast<void *>(memory + start);
+  }
+
+  void deallocate(void *, usize size) { deallocated += size; }
+};
+
+/**
+ * Distinct keys for distinct `i` (the splitmix64 finalizer is a bijection)
+ */
+u64 key(u64 i) {
+  i = (i ^ (i >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  i = (i ^ (i >> 27)) * 0x94D049BB133111EBULL;
+  return i ^ (i >> 31);
+}
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Insert, find and erase");
+    {
+      Arena arena;
+      HashMap<u64, u64, Arena> map(arena);
+      bool ok = true;
+      for (u64 i = 0; i < 1000; i++)
+        ok &= map.insert(key(i), i).success();
+      Expect(ok);
+      Expect(map.size() == 1000);
+      for (u64 i = 0; i < 1000; i++)
+        ok &= map.find(key(i)) != nullptr && *map.find(key(i)) == i;
+      Expect(ok);
+      Expect(map.find(key(1000)) == nullptr);
+      for (u64 i = 0; i < 1000; i += 2)
+        ok &= map.erase(key(i));
+      Expect(ok);
+      Expect(!map.erase(key(0)));
+      Expect(map.size() == 500);
+      for (u64 i = 0; i < 1000; i++)
+        ok &= map.contains(key(i)) == (i % 2 == 1);
+      Expect(ok);
+      auto value = map.insert(key(1), 42);
+      Expect(value.success() && **value == 42);
+      Expect(*map.find(key(1)) == 42);
+      Expect(map.size() == 500);
+      u64 sum = 0;
+      map.forEach([&](u64, u64 value) { sum += value; });
+      Expect(sum == 250000 - 1 + 42);
+    }
+
+    test("Growing gives the old storage back");
+    {
+      Arena arena;
+      HashMap<u64, u64, Arena> map(arena);
+      for (u64 i = 0; i < 100; i++)
+        map.insert(i, i);
+      Expect(map.capacity() == 128);
+      Expect(arena.deallocated == 16 * 17 + 32 * 17 + 64 * 17);
+      Expect(map.reserve(1000).success());
+      Expect(map.capacity() == 2048);
+      Expect(map.contains(99) && !map.contains(100));
+    }
+
+    test("Deleted slots are reused");
+    {
+      Arena arena;
+      HashSet<u32, Arena> set(arena);
+      for (u32 round = 0; round < 100; round++) {
+        for (u32 i = 0; i < 10; i++)
+          set.insert(round * 10 + i);
+        for (u32 i = 0; i < 10; i++)
+          set.erase(round * 10 + i);
+      }
+      Expect(set.size() == 0);
+      Expect(set.capacity() <= 32);
+      Expect(*set.insert(1) && !*set.insert(1));
+    }
+
+    test("Heterogeneous lookup");
+    {
+      Arena arena;
+      HashMap<u64, u32, Arena> map(arena);
+      map.insert(7, 1);
+      Expect(map.find(static_cast<u8>(7)) != nullptr);
+      Expect(map.contains(7U) && map.contains(7));
+      HashSet<const char *, Arena> names(arena);
+      names.insert("COM1");
+      names.insert("virtio-console");
+      char name[] = "COM1";
+      Expect(names.contains(static_cast<const char *>(name)));
+      Expect(!names.contains("COM2"));
+      Expect(names.erase("virtio-console") && names.size() == 1);
+    }
+
+    test("Running out of memory is reported");
+    {
+      Arena arena;
+      arena.limit = 16 * 17;
+      HashMap<u64, u64, Arena> map(arena);
+      bool ok = true;
+      for (u64 i = 0; i < 14; i++)
+        ok &= map.insert(i, i).success();
+      Expect(ok);
+      Expect(map.insert(14, 14) == ArenaExhaustedError);
+      Expect(map.size() == 14 && map.contains(13));
+    }
+
+    test("Scalar and SSE2 groups agree");
+    {
+      alignas(16) u8 controls[Group::Width];
+      bool ok = true;
+      for (u64 round = 0; round < 64; round++) {
+        for (usize i = 0; i < Group::Width; i++) {
+          auto r = key(round * Group::Width + i);
+          controls[i] = r % 3 == 0   ? Empty
+                        : r % 3 == 1 ? Deleted
+                                     : static_cast<u8>(r >> 8 & 0x7F);
+        }
+        auto scalar = ScalarGroup(controls);
+        auto group = Group(controls);
+        ok &= scalar.matchEmpty() == group.matchEmpty();
+        ok &= scalar.matchEmptyOrDeleted() == group.matchEmptyOrDeleted();
+        for (u8 h2 = 0; h2 < 0x80; h2++)
+          ok &= scalar.match(h2) == group.match(h2);
+      }
+      Expect(ok);
+    }
+  }
+};
+
+} // namespace libpara::hash_table::tests
+
+import libpara.bench;
+
+export namespace libpara::hash_table::benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+
+  struct Load {
+    usize keys;
+    const char *hit;
+    const char *miss;
+    const char *fill;
+  };
+
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    using libpara::bench::keep;
+    const usize Capacity = 4096;
+    // a quarter, half and the most the table takes before it grows
+    const Load loads[] = {
+        {Capacity / 4, "hash_table.find.hit.25%", "hash_table.find.miss.25%",
+         "hash_table.fill.25%"},
+        {Capacity / 2, "hash_table.find.hit.50%", "hash_table.find.miss.50%",
+         "hash_table.fill.50%"},
+        {Capacity / 8 * 7, "hash_table.find.hit.87%",
+         "hash_table.find.miss.87%", "hash_table.fill.87%"},
+    };
+    for (auto &load : loads) {
+      tests::Arena arena;
+      HashMap<u64, u64, tests::Arena> map(arena);
+      map.reserve(Capacity / 8 * 7);
+      for (usize i = 0; i < load.keys; i++)
+        map.insert(tests::key(i), i);
+
+      usize i = 0;
+      auto next = [&] {
+        auto current = i;
+        i = i + 1 == load.keys ? 0 : i + 1;
+        return current;
+      };
+      measure(load.hit, [&] { keep(map.find(tests::key(next()))); });
+      measure(load.miss,
+              [&] { keep(map.find(tests::key(load.keys + next()))); });
+      // inserts all keys into the emptied table on every call
+      measure(load.fill, [&] {
+        map.clear();
+        for (usize i = 0; i < load.keys; i++)
+          map.insert(tests::key(i), i);
+        keep(map.size());
+      });
+    }
+  }
+};
+
+} // namespace libpara::hash_table::benchmarks
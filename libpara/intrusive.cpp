@@ -0,0 +1,589 @@
+export module libpara.intrusive;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+export namespace libpara::intrusive {
+
+/**
+ * Links of a `T` in a `List`. Types derive from it once per list they can
+ * be in at the same time, with a different `Tag` for each.
+ */
+template <typename T, typename Tag = void> struct ListNode {
+  T *prev = nullptr;
+  T *next = nullptr;
+};
+
+/**
+ * Doubly linked list of items that carry their own links, so that adding
+ * and removing them never allocates. Items must stay in place while linked.
+ */
+template <typename T, typename Tag = void> class List {
+  using Node = ListNode<T, Tag>;
+
+  T *head = nullptr;
+  T *tail = nullptr;
+  usize count = 0;
+
+  static constexpr Node &node(T &item) { return static_cast<Node &>(item); }
+
+public:
+  constexpr List() {}
+  List(List &) = delete;
+
+  constexpr usize size() const { return count; }
+  constexpr bool isEmpty() const { return count == 0; }
+
+  constexpr T *front() const { return head; }
+  constexpr T *back() const { return tail; }
+
+  static constexpr T *next(T &item) { return node(item).next; }
+  static constexpr T *prev(T &item) { return node(item).prev; }
+
+  constexpr void pushFront(T &item) {
+    node(item) = {.prev = nullptr, .next = head};
+    if (head != nullptr)
+      node(*head).prev = &item;
+    else
+      tail = &item;
+    head = &item;
+    count++;
+  }
+
+  constexpr void pushBack(T &item) {
+    node(item) = {.prev = tail, .next = nullptr};
+    if (tail != nullptr)
+      node(*tail).next = &item;
+    else
+      head = &item;
+    tail = &item;
+    count++;
+  }
+
+  /**
+   * Links `item` right after `position`, which is in the list
+   */
+  constexpr void insertAfter(T &position, T &item) {
+    auto after = node(position).next;
+    if (after == nullptr)
+      return pushBack(item);
+    node(item) = {.prev = &position, .next = after};
+    node(position).next = &item;
+    node(*after).prev = &item;
+    count++;
+  }
+
+  /**
+   * Unlinks `item`, which must be in the list
+   */
+  constexpr void remove(T &item) {
+    auto &links = node(item);
+    if (links.prev != nullptr)
+      node(*links.prev).next = links.next;
+    else
+      head = links.next;
+    if (links.next != nullptr)
+      node(*links.next).prev = links.prev;
+    else
+      tail = links.prev;
+    links = {};
+    count--;
+  }
+
+  constexpr T *popFront() {
+    auto item = head;
+    if (item != nullptr)
+      remove(*item);
+    return item;
+  }
+
+  struct Iterator {
+    T *item;
+
+    constexpr T &operator*() const { return *item; }
+    constexpr Iterator &operator++() {
+      item = node(*item).next;
+      return *this;
+    }
+    constexpr bool operator==(const Iterator &) const = default;
+  };
+
+  constexpr Iterator begin() const { return {head}; }
+  constexpr Iterator end() const { return {nullptr}; }
+};
+
+/**
+ * Links of a `T` in a `Tree`, tagged like `ListNode`
+ */
+template <typename T, typename Tag = void> struct TreeNode {
+  T *parent = nullptr;
+  T *left = nullptr;
+  T *right = nullptr;
+  bool red = false;
+};
+
+/**
+ * Default ordering of tree items, with `<`
+ */
+struct Less {
+  template <typename A, typename B>
+  static constexpr bool less(const A &a, const B &b) {
+    return a < b;
+  }
+};
+
+/**
+ * Red-black tree of items that carry their own links, ordered by
+ * `O::less`. Equal items are kept in the order they were inserted in.
+ *
+ * Lookups take any key type that `O::less` can compare with `T` both ways.
+ * Items must stay in place while linked.
+ */
+template <typename T, typename O = Less, typename Tag = void> class Tree {
+  using Node = TreeNode<T, Tag>;
+
+  T *root = nullptr;
+  usize count = 0;
+
+  static constexpr Node &node(T *item) { return static_cast<Node &>(*item); }
+
+  static constexpr bool isRed(T *item) {
+    return item != nullptr && node(item).red;
+  }
+
+  static constexpr T *leftmost(T *item) {
+    while (node(item).left != nullptr)
+      item = node(item).left;
+    return item;
+  }
+
+  static constexpr T *rightmost(T *item) {
+    while (node(item).right != nullptr)
+      item = node(item).right;
+    return item;
+  }
+
+  // makes `replacement` take `item`'s place under its parent
+  constexpr void replaceChild(T *item, T *replacement) {
+    auto parent = node(item).parent;
+    if (parent == nullptr)
+      root = replacement;
+    else if (node(parent).left == item)
+      node(parent).left = replacement;
+    else
+      node(parent).right = replacement;
+    if (replacement != nullptr)
+      node(replacement).parent = parent;
+  }
+
+  constexpr void rotateLeft(T *item) {
+    auto pivot = node(item).right;
+    node(item).right = node(pivot).left;
+    if (node(pivot).left != nullptr)
+      node(node(pivot).left).parent = item;
+    replaceChild(item, pivot);
+    node(pivot).left = item;
+    node(item).parent = pivot;
+  }
+
+  constexpr void rotateRight(T *item) {
+    auto pivot = node(item).left;
+    node(item).left = node(pivot).right;
+    if (node(pivot).right != nullptr)
+      node(node(pivot).right).parent = item;
+    replaceChild(item, pivot);
+    node(pivot).right = item;
+    node(item).parent = pivot;
+  }
+
+  constexpr void insertFixup(T *item) {
+    T *parent;
+    while (isRed(parent = node(item).parent)) {
+      // a red parent is never the root
+      auto grandparent = node(parent).parent;
+      auto parentIsLeft = node(grandparent).left == parent;
+      auto uncle =
+          parentIsLeft ? node(grandparent).right : node(grandparent).left;
+      if (isRed(uncle)) {
+        node(parent).red = false;
+        node(uncle).red = false;
+        node(grandparent).red = true;
+        item = grandparent;
+        continue;
+      }
+      if (parentIsLeft) {
+        if (item == node(parent).right) {
+          rotateLeft(parent);
+          parent = item;
+        }
+        rotateRight(grandparent);
+      } else {
+        if (item == node(parent).left) {
+          rotateRight(parent);
+          parent = item;
+        }
+        rotateLeft(grandparent);
+      }
+      node(parent).red = false;
+      node(grandparent).red = true;
+      break;
+    }
+    node(root).red = false;
+  }
+
+  // `item` (possibly null) under `parent` is one black short
+  constexpr void removeFixup(T *item, T *parent) {
+    while (item != root && !isRed(item)) {
+      if (item == node(parent).left) {
+        auto sibling = node(parent).right;
+        if (isRed(sibling)) {
+          node(sibling).red = false;
+          node(parent).red = true;
+          rotateLeft(parent);
+          sibling = node(parent).right;
+        }
+        if (!isRed(node(sibling).left) && !isRed(node(sibling).right)) {
+          node(sibling).red = true;
+          item = parent;
+          parent = node(item).parent;
+          continue;
+        }
+        if (!isRed(node(sibling).right)) {
+          node(node(sibling).left).red = false;
+          node(sibling).red = true;
+          rotateRight(sibling);
+          sibling = node(parent).right;
+        }
+        node(sibling).red = node(parent).red;
+        node(parent).red = false;
+        node(node(sibling).right).red = false;
+        rotateLeft(parent);
+      } else {
+        auto sibling = node(parent).left;
+        if (isRed(sibling)) {
+          node(sibling).red = false;
+          node(parent).red = true;
+          rotateRight(parent);
+          sibling = node(parent).left;
+        }
+        if (!isRed(node(sibling).left) && !isRed(node(sibling).right)) {
+          node(sibling).red = true;
+          item = parent;
+          parent = node(item).parent;
+          continue;
+        }
+        if (!isRed(node(sibling).left)) {
+          node(node(sibling).right).red = false;
+          node(sibling).red = true;
+          rotateLeft(sibling);
+          sibling = node(parent).left;
+        }
+        node(sibling).red = node(parent).red;
+        node(parent).red = false;
+        node(node(sibling).left).red = false;
+        rotateRight(parent);
+      }
+      item = root;
+    }
+    if (item != nullptr)
+      node(item).red = false;
+  }
+
+  // black height of the subtree, or 0 if it breaks an invariant
+  static constexpr usize verify(T *item, T *parent) {
+    if (item == nullptr)
+      return 1;
+    auto &links = node(item);
+    if (links.parent != parent || (links.red && isRed(parent)))
+      return 0;
+    if ((links.left != nullptr && O::less(*item, *links.left)) ||
+        (links.right != nullptr && O::less(*links.right, *item)))
+      return 0;
+    auto left = verify(links.left, item);
+    auto right = verify(links.right, item);
+    if (left == 0 || left != right)
+      return 0;
+    return left + (links.red ? 0 : 1);
+  }
+
+public:
+  constexpr Tree() {}
+  Tree(Tree &) = delete;
+
+  constexpr usize size() const { return count; }
+  constexpr bool isEmpty() const { return count == 0; }
+
+  constexpr T *first() const {
+    return root != nullptr ? leftmost(root) : nullptr;
+  }
+
+  constexpr T *last() const {
+    return root != nullptr ? rightmost(root) : nullptr;
+  }
+
+  static constexpr T *next(T &item) {
+    auto current = &item;
+    if (node(current).right != nullptr)
+      return leftmost(node(current).right);
+    auto parent = node(current).parent;
+    while (parent != nullptr && current == node(parent).right) {
+      current = parent;
+      parent = node(parent).parent;
+    }
+    return parent;
+  }
+
+  static constexpr T *prev(T &item) {
+    auto current = &item;
+    if (node(current).left != nullptr)
+      return rightmost(node(current).left);
+    auto parent = node(current).parent;
+    while (parent != nullptr && current == node(parent).left) {
+      current = parent;
+      parent = node(parent).parent;
+    }
+    return parent;
+  }
+
+  constexpr void insert(T &item) {
+    T *parent = nullptr;
+    auto left = false;
+    for (auto current = root; current != nullptr;) {
+      parent = current;
+      left = O::less(item, *current);
+      current = left ? node(current).left : node(current).right;
+    }
+    node(&item) = {.parent = parent, .red = true};
+    if (parent == nullptr)
+      root = &item;
+    else if (left)
+      node(parent).left = &item;
+    else
+      node(parent).right = &item;
+    count++;
+    insertFixup(&item);
+  }
+
+  /**
+   * Unlinks `item`, which must be in the tree
+   */
+  constexpr void remove(T &item) {
+    auto removed = &item;
+    auto wasRed = node(removed).red;
+    T *child, *parent;
+    if (node(removed).left == nullptr) {
+      child = node(removed).right;
+      parent = node(removed).parent;
+      replaceChild(removed, child);
+    } else if (node(removed).right == nullptr) {
+      child = node(removed).left;
+      parent = node(removed).parent;
+      replaceChild(removed, child);
+    } else {
+      // the successor, which has no left child, takes the item's place
+      auto successor = leftmost(node(removed).right);
+      wasRed = node(successor).red;
+      child = node(successor).right;
+      if (node(successor).parent == removed)
+        parent = successor;
+      else {
+        parent = node(successor).parent;
+        replaceChild(successor, child);
+        node(successor).right = node(removed).right;
+        node(node(successor).right).parent = successor;
+      }
+      replaceChild(removed, successor);
+      node(successor).left = node(removed).left;
+      node(node(successor).left).parent = successor;
+      node(successor).red = node(removed).red;
+    }
+    if (!wasRed)
+      removeFixup(child, parent);
+    node(removed) = {};
+    count--;
+  }
+
+  /**
+   * Some item equal to `key`, or null
+   */
+  template <typename Q> constexpr T *find(const Q &key) const {
+    auto item = lowerBound(key);
+    return item != nullptr && !O::less(key, *item) ? item : nullptr;
+  }
+
+  /**
+   * First item that isn't less than `key`, or null
+   */
+  template <typename Q> constexpr T *lowerBound(const Q &key) const {
+    T *found = nullptr;
+    for (auto current = root; current != nullptr;)
+      if (O::less(*current, key))
+        current = node(current).right;
+      else {
+        found = current;
+        current = node(current).left;
+      }
+    return found;
+  }
+
+  /**
+   * Whether the tree is ordered and balanced, for tests
+   */
+  constexpr bool isValid() const {
+    return !isRed(root) && verify(root, nullptr) != 0;
+  }
+
+  struct Iterator {
+    T *item;
+
+    constexpr T &operator*() const { return *item; }
+    constexpr Iterator &operator++() {
+      item = next(*item);
+      return *this;
+    }
+    constexpr bool operator==(const Iterator &) const = default;
+  };
+
+  constexpr Iterator begin() const { return {first()}; }
+  constexpr Iterator end() const { return {nullptr}; }
+};
+
+} // namespace libpara::intrusive
+
+import libpara.random;
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::intrusive::tests {
+
+struct Queued;
+
+struct Item : ListNode<Item>, ListNode<Item, Queued>, TreeNode<Item> {
+  u64 key = 0;
+  u64 order = 0;
+
+  constexpr bool operator<(const Item &other) const { return key < other.key; }
+  constexpr bool operator<(u64 other) const { return key < other; }
+  friend constexpr bool operator<(u64 key, const Item &item) {
+    return key < item.key;
+  }
+};
+
+class TestCase : public libpara::testing::TestCase {
+
+  // too large for the stack tests run on in the kernel
+  static inline constinit Item treeItems[256];
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("List links items at both ends");
+    {
+      Item items[4];
+      List<Item> list;
+      Expect(list.isEmpty() && list.popFront() == nullptr);
+      list.pushBack(items[1]);
+      list.pushFront(items[0]);
+      list.pushBack(items[3]);
+      list.insertAfter(items[1], items[2]);
+      Expect(list.size() == 4);
+      Expect(list.front() == &items[0] && list.back() == &items[3]);
+      usize n = 0;
+      bool ordered = true;
+      for (auto &item : list)
+        ordered = &item == &items[n++] && ordered;
+      Expect(ordered && n == 4);
+      Expect(List<Item>::prev(items[2]) == &items[1]);
+    }
+
+    test("List removes items anywhere");
+    {
+      Item items[3];
+      List<Item> list;
+      for (auto &item : items)
+        list.pushBack(item);
+      list.remove(items[1]);
+      Expect(List<Item>::next(items[0]) == &items[2]);
+      list.remove(items[2]);
+      Expect(list.back() == &items[0]);
+      Expect(list.popFront() == &items[0] && list.isEmpty());
+      Expect(list.front() == nullptr && list.back() == nullptr);
+    }
+
+    test("Items can be in lists with different tags at once");
+    {
+      Item items[2];
+      List<Item> all;
+      List<Item, Queued> queued;
+      all.pushBack(items[0]);
+      all.pushBack(items[1]);
+      queued.pushBack(items[1]);
+      Expect(all.size() == 2 && queued.front() == &items[1]);
+      queued.remove(items[1]);
+      Expect(all.back() == &items[1] && queued.isEmpty());
+    }
+
+    test("Tree stays ordered and balanced");
+    {
+      const usize N = sizeof(treeItems) / sizeof(treeItems[0]);
+      auto &items = treeItems;
+      Tree<Item> tree;
+      libpara::random::Random random(1);
+      for (usize i = 0; i < N; i++) {
+        items[i].key = random.below(N / 2);
+        items[i].order = i;
+        tree.insert(items[i]);
+      }
+      Expect(tree.size() == N && tree.isValid());
+      // ascending, and equal keys in insertion order
+      bool ordered = true;
+      const Item *previous = nullptr;
+      for (auto &item : tree) {
+        if (previous != nullptr)
+          ordered = ordered && (previous->key < item.key ||
+                                (previous->key == item.key &&
+                                 previous->order < item.order));
+        previous = &item;
+      }
+      Expect(ordered);
+      Expect(tree.first()->key <= tree.last()->key);
+      Expect(Tree<Item>::prev(*tree.last()) != nullptr);
+
+      bool valid = true;
+      for (usize i = 0; i < N; i += 2) {
+        tree.remove(items[i]);
+        valid = valid && tree.isValid();
+      }
+      Expect(valid && tree.size() == N / 2);
+      for (usize i = 0; i < N; i += 2) {
+        tree.insert(items[i]);
+        valid = valid && tree.isValid();
+      }
+      for (usize i = 0; i < N; i++) {
+        tree.remove(items[(i * 7) % N]);
+        valid = valid && tree.isValid();
+      }
+      Expect(valid && tree.isEmpty() && tree.first() == nullptr);
+    }
+
+    test("Tree lookups");
+    {
+      Item items[5];
+      Tree<Item> tree;
+      for (u64 i = 0; i < 5; i++) {
+        items[i].key = i * 10;
+        tree.insert(items[i]);
+      }
+      Expect(tree.find(20ULL) == &items[2]);
+      Expect(tree.find(25ULL) == nullptr);
+      Expect(tree.lowerBound(25ULL) == &items[3]);
+      Expect(tree.lowerBound(0ULL) == &items[0]);
+      Expect(tree.lowerBound(41ULL) == nullptr);
+    }
+  }
+};
+
+} // namespace libpara::intrusive::tests
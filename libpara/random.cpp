@@ -0,0 +1,132 @@
+export module libpara.random;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+export namespace libpara::random {
+
+/**
+ * SplitMix64, a generator with a single word of state, used to seed others
+ */
+class SplitMix64 {
+  u64 state;
+
+public:
+  constexpr SplitMix64(u64 seed) : state(seed) {}
+
+  constexpr u64 next() {
+    u64 z = (state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+  }
+};
+
+/**
+ * Seeded pseudo-random numbers (xoshiro256**), not fit for cryptography
+ *
+ * The same seed and stream always produce the same sequence, so randomized
+ * tests can be reproduced from the seed they report. Streams of one seed
+ * (such as one per CPU) are independent of each other.
+ */
+class Random {
+  u64 state[4];
+
+  static constexpr u64 rotate(u64 x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+public:
+  constexpr Random(u64 seed, u64 stream = 0) : state() {
+    SplitMix64 mixer(SplitMix64(seed).next() ^ stream);
+    for (auto &word : state)
+      word = mixer.next();
+  }
+
+  constexpr u64 next() {
+    auto result = rotate(state[1] * 5, 7) * 9;
+    auto t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotate(state[3], 45);
+    return result;
+  }
+
+  /**
+   * Number in [0, bound), by multiplying and shifting instead of dividing
+   * (very slightly biased unless `bound` is a power of two)
+   */
+  constexpr u64 below(u64 bound) {
+    return static_cast<u64>(
+        (static_cast<unsigned __int128>(next()) * bound) >> 64);
+  }
+};
+
+} // namespace libpara::random
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::random::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("SplitMix64 reference values");
+    {
+      SplitMix64 mixer(0);
+      Expect(mixer.next() == 0xE220A8397B1DCDAF);
+      Expect(mixer.next() == 0x6E789E6AA1B965F4);
+      Expect(mixer.next() == 0x06C45D188009454F);
+    }
+
+    test("Random sequences are determined by seed and stream");
+    {
+      Random random(0);
+      Expect(random.next() == 0xFB5405F7BD79C540);
+      Expect(random.next() == 0x780C98E26CEA5883);
+      Expect(random.next() == 0x2A146E0980FEBC66);
+      Random stream(42, 1);
+      Expect(stream.next() == 0x0CEE3AC9AD457C96);
+      Expect(stream.next() == 0x719A1ABE9D3F4270);
+      Random a(42, 0), b(42, 0), c(42, 2);
+      bool same = true, different = false;
+      for (int i = 0; i < 100; i++) {
+        auto value = a.next();
+        same = same && value == b.next();
+        different = different || value != c.next();
+      }
+      Expect(same);
+      Expect(different);
+    }
+
+    test("Random numbers below a bound cover it");
+    {
+      Random random(7);
+      bool seen[10] = {};
+      bool bounded = true;
+      for (int i = 0; i < 1000; i++) {
+        auto value = random.below(10);
+        bounded = bounded && value < 10;
+        if (value < 10)
+          seen[value] = true;
+      }
+      Expect(bounded);
+      bool all = true;
+      for (auto s : seen)
+        all = all && s;
+      Expect(all);
+      Expect(random.below(1) == 0);
+    }
+  }
+};
+
+} // namespace libpara::random::tests
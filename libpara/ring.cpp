@@ -0,0 +1,158 @@
+export module libpara.ring;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+export namespace libpara::ring {
+
+/**
+ * Bounded multi-producer, single-consumer byte ring
+ *
+ * Producers reserve space with a compare-and-swap and then publish every
+ * byte on its own, so they never wait for each other or for the consumer.
+ * A write that doesn't fit is dropped as a whole and counted.
+ *
+ * Reading is not synchronized: callers must ensure there is only one
+ * consumer at a time.
+ */
+template <usize capacity> class ByteRing {
+  static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+  // Every slot holds a byte and, in the upper half, which lap (odd or even)
+  // it was written in. A slot from the previous lap is not published yet.
+  u16 slots[capacity] = {};
+  u64 reserved = 0;
+  u64 consumed = 0;
+  u64 drops = 0;
+
+  static constexpr u16 tag(u64 position) {
+    return static_cast<u16>((((position / capacity) & 1) + 1) << 8);
+  }
+
+public:
+  constexpr ByteRing() {}
+  ByteRing(ByteRing &) = delete;
+
+  /**
+   * Enqueues `size` bytes, returning false if they were dropped for lack of
+   * space
+   */
+  bool write(const u8 *bytes, usize size) {
+    auto start = __atomic_load_n(&reserved, __ATOMIC_RELAXED);
+    do {
+      // a stale `start` fails the exchange below rather than this check
+      if (start + size >
+          __atomic_load_n(&consumed, __ATOMIC_ACQUIRE) + capacity) {
+        __atomic_add_fetch(&drops, size, __ATOMIC_RELAXED);
+        return false;
+      }
+    } while (!__atomic_compare_exchange_n(&reserved, &start, start + size,
+                                          true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    for (usize i = 0; i < size; i++) {
+      auto position = start + i;
+      __atomic_store_n(&slots[position & (capacity - 1)],
+                       static_cast<u16>(tag(position) | bytes[i]),
+                       __ATOMIC_RELEASE);
+    }
+    return true;
+  }
+
+  /**
+   * Dequeues the next byte, unless it hasn't been published yet
+   */
+  bool read(u8 &byte) {
+    auto position = __atomic_load_n(&consumed, __ATOMIC_RELAXED);
+    auto slot =
+        __atomic_load_n(&slots[position & (capacity - 1)], __ATOMIC_ACQUIRE);
+    if ((slot & 0xFF00) != tag(position))
+      return false;
+    byte = static_cast<u8>(slot);
+    __atomic_store_n(&consumed, position + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  /**
+   * Whether the next byte is published and can be read
+   */
+  bool canRead() const {
+    auto position = __atomic_load_n(&consumed, __ATOMIC_RELAXED);
+    return (__atomic_load_n(&slots[position & (capacity - 1)],
+                            __ATOMIC_ACQUIRE) &
+            0xFF00) == tag(position);
+  }
+
+  /**
+   * Number of bytes dropped because the ring was full
+   */
+  u64 dropped() const { return __atomic_load_n(&drops, __ATOMIC_RELAXED); }
+};
+
+} // namespace libpara::ring
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::ring::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("ByteRing reads back what was written");
+    {
+      ByteRing<8> ring;
+      u8 byte;
+      Expect(!ring.canRead());
+      Expect(!ring.read(byte));
+      const u8 bytes[] = {1, 2, 3};
+      Expect(ring.write(bytes, 3));
+      Expect(ring.canRead());
+      Expect(ring.read(byte) && byte == 1);
+      Expect(ring.read(byte) && byte == 2);
+      Expect(ring.read(byte) && byte == 3);
+      Expect(!ring.read(byte));
+    }
+
+    test("ByteRing wraps around");
+    {
+      ByteRing<4> ring;
+      u8 byte;
+      bool ordered = true;
+      for (u8 i = 0; i < 20; i++) {
+        const u8 bytes[] = {i, static_cast<u8>(i + 100)};
+        ordered = ring.write(bytes, 2) && ring.read(byte) && byte == i &&
+                  ring.read(byte) && byte == i + 100 && ordered;
+      }
+      Expect(ordered);
+      Expect(!ring.canRead());
+      Expect(ring.dropped() == 0);
+    }
+
+    test("ByteRing drops writes that don't fit");
+    {
+      ByteRing<4> ring;
+      u8 byte;
+      const u8 bytes[] = {1, 2, 3, 4, 5};
+      Expect(ring.write(bytes, 3));
+      Expect(!ring.write(bytes, 2));
+      Expect(ring.dropped() == 2);
+      Expect(!ring.write(bytes, 5));
+      Expect(ring.dropped() == 7);
+      Expect(ring.write(bytes, 1));
+      Expect(ring.read(byte) && byte == 1);
+      Expect(ring.write(bytes, 1));
+      Expect(ring.read(byte) && byte == 2);
+      Expect(ring.read(byte) && byte == 3);
+      Expect(ring.read(byte) && byte == 1);
+      Expect(ring.read(byte) && byte == 1);
+      Expect(!ring.read(byte));
+    }
+  };
+};
+} // namespace libpara::ring::tests
@@ -0,0 +1,222 @@
+export module libpara.span;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+export namespace libpara::span {
+
+/**
+ * Traps if `inBounds` is false, unless this is a release build. In constant
+ * evaluation, an out of bounds access fails the compilation instead.
+ */
+constexpr void checkBounds(bool inBounds) {
+#ifndef RELEASE
+  if (!inBounds)
+    __builtin_trap();
+#endif
+}
+
+/**
+ * Position returned by searches that found nothing
+ */
+const usize NotFound = ~0ULL;
+
+/**
+ * Contiguous run of `T`s owned by someone else, such as an array or a
+ * `StaticVector`
+ */
+template <typename T> class Span {
+  T *items = nullptr;
+  usize count = 0;
+
+public:
+  constexpr Span() {}
+  constexpr Span(T *items, usize count) : items(items), count(count) {}
+  template <usize n> constexpr Span(T (&array)[n]) : items(array), count(n) {}
+
+  template <typename U>
+  requires __is_same(const U, T)
+  constexpr Span(Span<U> other) : items(other.data()), count(other.size()) {}
+
+  constexpr T *data() const { return items; }
+  constexpr usize size() const { return count; }
+  constexpr bool isEmpty() const { return count == 0; }
+
+  constexpr T &operator[](usize i) const {
+    checkBounds(i < count);
+    return items[i];
+  }
+
+  constexpr T *begin() const { return items; }
+  constexpr T *end() const { return items + count; }
+
+  /**
+   * Up to `n` items starting at `offset`, which may be the end
+   */
+  constexpr Span slice(usize offset, usize n = NotFound) const {
+    checkBounds(offset <= count);
+    return Span(items + offset, n < count - offset ? n : count - offset);
+  }
+
+  constexpr Span first(usize n) const { return slice(0, n); }
+
+  constexpr Span last(usize n) const {
+    return slice(n < count ? count - n : 0);
+  }
+};
+
+/**
+ * Characters of a string, which need not be terminated. Taking one of a C
+ * string measures it once, so it can be passed along without walking it
+ * again.
+ */
+class StringView {
+  const char *chars = "";
+  usize length = 0;
+
+  // a loop rather than `__builtin_strlen`, which becomes a call to `strlen`
+  // outside of constant evaluation, and the kernel has none
+  static constexpr usize measure(const char *s) {
+    usize n = 0;
+    while (s[n] != 0)
+      n++;
+    return n;
+  }
+
+public:
+  constexpr StringView() {}
+  constexpr StringView(const char *s) : chars(s), length(measure(s)) {}
+  constexpr StringView(const char *chars, usize length)
+      : chars(chars), length(length) {}
+  constexpr StringView(Span<const char> span)
+      : chars(span.data()), length(span.size()) {}
+
+  constexpr const char *data() const { return chars; }
+  constexpr usize size() const { return length; }
+  constexpr bool isEmpty() const { return length == 0; }
+
+  constexpr char operator[](usize i) const {
+    checkBounds(i < length);
+    return chars[i];
+  }
+
+  constexpr const char *begin() const { return chars; }
+  constexpr const char *end() const { return chars + length; }
+
+  constexpr operator Span<const char>() const { return {chars, length}; }
+
+  constexpr bool operator==(StringView other) const {
+    if (length != other.length)
+      return false;
+    for (usize i = 0; i < length; i++)
+      if (chars[i] != other.chars[i])
+        return false;
+    return true;
+  }
+
+  /**
+   * Up to `n` characters starting at `offset`, which may be the end
+   */
+  constexpr StringView slice(usize offset, usize n = NotFound) const {
+    return Span<const char>(*this).slice(offset, n);
+  }
+
+  constexpr bool startsWith(StringView prefix) const {
+    return prefix.length <= length && slice(0, prefix.length) == prefix;
+  }
+
+  constexpr bool endsWith(StringView suffix) const {
+    return suffix.length <= length &&
+           slice(length - suffix.length) == suffix;
+  }
+
+  /**
+   * Position of the first `c` at or after `from`, or `NotFound`
+   */
+  constexpr usize find(char c, usize from = 0) const {
+    for (usize i = from; i < length; i++)
+      if (chars[i] == c)
+        return i;
+    return NotFound;
+  }
+
+  /**
+   * Without the spaces, tabs and carriage returns around it
+   */
+  constexpr StringView trim() const {
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    usize start = 0, stop = length;
+    while (start < stop && isSpace(chars[start]))
+      start++;
+    while (stop > start && isSpace(chars[stop - 1]))
+      stop--;
+    return slice(start, stop - start);
+  }
+};
+
+} // namespace libpara::span
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::span::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Span covers an array");
+    {
+      u32 array[] = {1, 2, 3, 4};
+      Span<u32> span(array);
+      Expect(span.size() == 4 && span.data() == array);
+      span[1] = 20;
+      Expect(array[1] == 20);
+      u32 sum = 0;
+      for (auto item : span)
+        sum += item;
+      Expect(sum == 28);
+      Span<const u32> view = span;
+      Expect(view.size() == 4 && view[3] == 4);
+    }
+
+    test("Span slices stay within the span");
+    {
+      u32 array[] = {1, 2, 3, 4};
+      Span<u32> span(array);
+      Expect(span.slice(1, 2).size() == 2 && span.slice(1, 2)[0] == 2);
+      Expect(span.slice(2).size() == 2);
+      Expect(span.slice(4).isEmpty());
+      Expect(span.first(10).size() == 4);
+      Expect(span.last(1)[0] == 4 && span.last(10).size() == 4);
+    }
+
+    test("StringView measures C strings once");
+    {
+      static_assert(StringView("paraos").size() == 6);
+      StringView s("key=value");
+      Expect(s.size() == 9);
+      Expect(s == "key=value" && s != "key");
+      Expect(StringView() == "" && StringView().isEmpty());
+      Expect(s.slice(0, 3) == "key" && s.slice(4) == "value");
+    }
+
+    test("StringView searches");
+    {
+      StringView s("key=value");
+      Expect(s.find('=') == 3);
+      Expect(s.find('e', 2) == 8);
+      Expect(s.find('x') == NotFound);
+      Expect(s.startsWith("key") && !s.startsWith("value"));
+      Expect(s.endsWith("value") && !s.endsWith("key"));
+      Expect(StringView(" \t a b \r").trim() == "a b");
+      Expect(StringView("  ").trim().isEmpty());
+    }
+  }
+};
+
+} // namespace libpara::span::tests
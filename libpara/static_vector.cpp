@@ -0,0 +1,156 @@
+export module libpara.static_vector;
+
+import libpara.basic_types;
+import libpara.err;
+import libpara.span;
+
+using namespace libpara::basic_types;
+using namespace libpara::err;
+
+#include <err.hpp>
+
+export namespace libpara::static_vector {
+
+const auto CapacityExceededError = "CapacityExceeded"_error;
+
+/**
+ * Up to `capacity` `T`s stored inline, in insertion order
+ *
+ * All slots are default-constructed up front, so `T` must be default
+ * constructible and assignable. Removing items doesn't destroy them, it
+ * only stops counting them.
+ */
+template <typename T, usize capacity> class StaticVector {
+  T items[capacity] = {};
+  usize count = 0;
+
+public:
+  constexpr StaticVector() {}
+
+  constexpr usize size() const { return count; }
+  constexpr bool isEmpty() const { return count == 0; }
+  constexpr bool isFull() const { return count == capacity; }
+
+  constexpr T *data() { return items; }
+  constexpr const T *data() const { return items; }
+
+  constexpr T &operator[](usize i) {
+    libpara::span::checkBounds(i < count);
+    return items[i];
+  }
+
+  constexpr const T &operator[](usize i) const {
+    libpara::span::checkBounds(i < count);
+    return items[i];
+  }
+
+  constexpr T *begin() { return items; }
+  constexpr T *end() { return items + count; }
+  constexpr const T *begin() const { return items; }
+  constexpr const T *end() const { return items + count; }
+
+  constexpr operator libpara::span::Span<T>() { return {items, count}; }
+  constexpr operator libpara::span::Span<const T>() const {
+    return {items, count};
+  }
+
+  /**
+   * Appends `item`, which `last()` then returns
+   */
+  constexpr Result<nothing> push(const T &item) {
+    if (count == capacity)
+      return CapacityExceededError;
+    items[count++] = item;
+    return nothing{};
+  }
+
+  constexpr T &last() {
+    libpara::span::checkBounds(count > 0);
+    return items[count - 1];
+  }
+
+  constexpr void pop() {
+    libpara::span::checkBounds(count > 0);
+    count--;
+  }
+
+  /**
+   * Removes the item at `i` by moving the last one into its place, which
+   * doesn't keep the order
+   */
+  constexpr void swapRemove(usize i) {
+    libpara::span::checkBounds(i < count);
+    items[i] = items[--count];
+  }
+
+  constexpr void clear() { count = 0; }
+};
+
+} // namespace libpara::static_vector
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::static_vector::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("StaticVector keeps items in order");
+    {
+      StaticVector<u32, 4> vector;
+      Expect(vector.isEmpty());
+      Expect(vector.push(1).success() && vector.last() == 1);
+      vector.push(2);
+      vector.push(3);
+      Expect(vector.size() == 3 && vector[2] == 3 && vector.last() == 3);
+      u32 sum = 0;
+      for (auto item : vector)
+        sum += item;
+      Expect(sum == 6);
+      libpara::span::Span<const u32> span = vector;
+      Expect(span.size() == 3 && span[0] == 1);
+    }
+
+    test("StaticVector refuses items past its capacity");
+    {
+      StaticVector<u32, 2> vector;
+      vector.push(1);
+      vector.push(2);
+      Expect(vector.isFull());
+      Expect(vector.push(3) == CapacityExceededError);
+      Expect(vector.size() == 2);
+    }
+
+    test("StaticVector removals");
+    {
+      StaticVector<u32, 4> vector;
+      for (u32 i = 1; i <= 4; i++)
+        vector.push(i);
+      vector.swapRemove(0);
+      Expect(vector.size() == 3 && vector[0] == 4);
+      vector.pop();
+      Expect(vector.size() == 2 && vector.last() == 2);
+      vector.clear();
+      Expect(vector.isEmpty());
+    }
+
+    test("StaticVector is usable in constant evaluation");
+    {
+      constexpr auto size = [] {
+        StaticVector<u32, 4> vector;
+        vector.push(1);
+        vector.push(2);
+        vector.pop();
+        return vector.size();
+      }();
+      static_assert(size == 1);
+    }
+  }
+};
+
+} // namespace libpara::static_vector::tests
@@ -1,5 +1,9 @@
 export module libpara.sync;
 
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
 export namespace libpara::sync {
 
 class Lock {
@@ -15,15 +19,141 @@ public:
     }
   }
 
+  /**
+   * Takes the lock only if it is free, returning whether it was taken
+   */
+  bool tryLock() {
+    return __atomic_exchange_n(&locked, true, __ATOMIC_SEQ_CST) == false;
+  }
+
   void unlock() { __atomic_store_n(&locked, false, __ATOMIC_SEQ_CST); }
 };
 
+/**
+ * Runs a function exactly once, no matter how many CPUs call it. Callers
+ * that lose the race wait until the function has completed.
+ */
+class Once {
+  enum State : unsigned char { Pending = 0, Running = 1, Done = 2 };
+  State state = Pending;
+
+public:
+  constexpr Once() {}
+
+  template <typename F> void call(F &&f) {
+    auto expected = Pending;
+    if (__atomic_compare_exchange_n(&state, &expected, Running, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      f();
+      __atomic_store_n(&state, Done, __ATOMIC_RELEASE);
+      return;
+    }
+    while (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != Done) {
+      __builtin_ia32_pause();
+    }
+  }
+};
+
 class LockGuard {
   Lock &lock;
 
 public:
-  LockGuard(Lock &lock) : lock(lock) {}
+  LockGuard(Lock &lock) : lock(lock) { lock.lock(); }
   ~LockGuard() { lock.unlock(); }
 };
 
+/**
+ * Spinning barrier for a fixed number of CPUs, reusable as soon as all of
+ * them have passed it
+ */
+class Barrier {
+  u32 count = 0;
+  u32 waiting = 0;
+  u32 generation = 0;
+
+public:
+  constexpr Barrier() {}
+  constexpr Barrier(u32 count) : count(count) {}
+
+  /**
+   * Waits until `count` CPUs are waiting
+   */
+  void wait() {
+    auto current = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    if (__atomic_add_fetch(&waiting, 1, __ATOMIC_ACQ_REL) == count) {
+      __atomic_store_n(&waiting, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&generation, current + 1, __ATOMIC_RELEASE);
+      return;
+    }
+    while (__atomic_load_n(&generation, __ATOMIC_ACQUIRE) == current) {
+      __builtin_ia32_pause();
+    }
+  }
+};
+
 }; // namespace libpara::sync
+
+import libpara.bench;
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::sync::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("LockGuard holds the lock for its scope");
+    {
+      Lock lock;
+      {
+        auto guard = LockGuard(lock);
+        Expect(!lock.tryLock());
+      }
+      Expect(lock.tryLock());
+      lock.unlock();
+    }
+
+    test("Once calls once");
+    {
+      Once once;
+      int calls = 0;
+      once.call([&] { calls++; });
+      once.call([&] { calls++; });
+      Expect(calls == 1);
+    }
+
+    test("Barrier of one CPU never waits");
+    {
+      Barrier barrier(1);
+      barrier.wait();
+      barrier.wait();
+    }
+  }
+};
+
+} // namespace libpara::sync::tests
+
+export namespace libpara::sync::benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    Lock lock;
+    measure("sync.lock.uncontended", [&] {
+      lock.lock();
+      lock.unlock();
+    });
+    measure("sync.lock.try", [&] {
+      libpara::bench::keep(lock.tryLock());
+      lock.unlock();
+    });
+  }
+};
+
+} // namespace libpara::sync::benchmarks
@@ -1,6 +1,8 @@
 export module libpara.testing;
 
+import libpara.basic_types;
 import libpara.formatting;
+using namespace libpara::basic_types;
 using namespace libpara::formatting;
 
 export namespace libpara::testing {
@@ -13,6 +15,22 @@ public:
   virtual void report(bool success, const char *message = "",
                       const char *file = nullptr, const char *line = nullptr) {}
   virtual void write(const char *s) {}
+
+  /**
+   * Writes `size` bytes through `write(const char *)`
+   */
+  void write(const u8 *bytes, usize size) {
+    char chunk[65];
+    while (size > 0) {
+      usize n = size < sizeof(chunk) - 1 ? size : sizeof(chunk) - 1;
+      for (usize i = 0; i < n; i++)
+        chunk[i] = static_cast<char>(bytes[i]);
+      chunk[n] = 0;
+      write(chunk);
+      bytes += n;
+      size -= n;
+    }
+  }
 };
 
 class TestCase {
@@ -0,0 +1,228 @@
+export module libpara.time;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+export namespace libpara::time {
+
+/**
+ * Reads the time stamp counter, without any ordering guarantees
+ */
+inline u64 rdtsc() {
+  u32 lo, hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return static_cast<u64>(hi) << 32 | lo;
+}
+
+/**
+ * Reads the time stamp counter after all prior instructions have completed,
+ * also returning IA32_TSC_AUX (the CPU number, if the OS has set it)
+ */
+inline u64 rdtscp(u32 &aux) {
+  u32 lo, hi;
+  asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+  return static_cast<u64>(hi) << 32 | lo;
+}
+
+/**
+ * Reads the cycle counter at the beginning of a measured region: no prior
+ * instruction may still be executing, and no later one may have started
+ */
+inline u64 cyclesBegin() {
+  u32 lo, hi;
+  asm volatile("lfence ; rdtsc ; lfence" : "=a"(lo), "=d"(hi)::"memory");
+  return static_cast<u64>(hi) << 32 | lo;
+}
+
+/**
+ * Reads the cycle counter at the end of a measured region: all prior
+ * instructions have completed, and no later one has started
+ */
+inline u64 cyclesEnd() {
+  u32 lo, hi, aux;
+  asm volatile("rdtscp ; lfence" : "=a"(lo), "=d"(hi), "=c"(aux)::"memory");
+  return static_cast<u64>(hi) << 32 | lo;
+}
+
+/**
+ * Fixed-point scaling of one unit to another: `(value * multiplier) >>
+ * shift`, with a 128-bit intermediate product
+ */
+struct Conversion {
+  u64 multiplier = 0;
+  u8 shift = 0;
+
+  static const u64 NanosecondsPerSecond = 1000000000;
+
+  /**
+   * Conversion from units ticking at `from` Hz to units ticking at `to` Hz
+   */
+  static constexpr Conversion between(u64 from, u64 to) {
+    // the largest shift that keeps the multiplier within 64 bits
+    u8 shift = 63;
+    while (shift > 0 &&
+           ((static_cast<unsigned __int128>(to) << shift) >> 64) >= from)
+      shift--;
+    return Conversion{
+        .multiplier =
+            divide(static_cast<unsigned __int128>(to) << shift, from),
+        .shift = shift};
+  }
+
+  constexpr u64 operator()(u64 value) const {
+    return static_cast<u64>(
+        (static_cast<unsigned __int128>(value) * multiplier) >> shift);
+  }
+
+private:
+  /**
+   * 128 by 64 bit division, for quotients that fit in 64 bits. Avoids
+   * depending on the compiler runtime's 128-bit division outside of
+   * constant evaluation.
+   */
+  static constexpr u64 divide(unsigned __int128 dividend, u64 divisor) {
+    if (__builtin_is_constant_evaluated())
+      return static_cast<u64>(dividend / divisor);
+    u64 quotient, remainder;
+    asm("divq %4"
+        : "=a"(quotient), "=d"(remainder)
+        : "a"(static_cast<u64>(dividend)),
+          "d"(static_cast<u64>(dividend >> 64)), "rm"(divisor));
+    return quotient;
+  }
+};
+
+/**
+ * Outcome of clock calibration
+ */
+struct Calibration {
+  // cycle counter frequency, in Hz
+  u64 frequency;
+  // what the cycle counter was calibrated against
+  const char *reference;
+  // whether the cycle counter ticks at a constant rate in all power states
+  bool invariant;
+};
+
+/**
+ * Monotonic clock derived from the cycle counter
+ *
+ * Nanoseconds are counted from the time the cycle counter was zero.
+ */
+class Clock {
+  u64 hz = 0;
+  Conversion to_nanoseconds;
+  Conversion to_cycles;
+
+public:
+  constexpr Clock() {}
+
+  void calibrate(const Calibration &calibration) {
+    hz = calibration.frequency;
+    to_nanoseconds = Conversion::between(hz, Conversion::NanosecondsPerSecond);
+    to_cycles = Conversion::between(Conversion::NanosecondsPerSecond, hz);
+  }
+
+  bool isCalibrated() const { return hz != 0; }
+
+  u64 frequency() const { return hz; }
+
+  u64 nanoseconds(u64 cycles) const { return to_nanoseconds(cycles); }
+
+  u64 cycles(u64 nanoseconds) const { return to_cycles(nanoseconds); }
+
+  u64 now() const { return nanoseconds(rdtsc()); }
+};
+
+constinit Clock clock;
+
+/**
+ * Measures cycles elapsed since its construction or last restart
+ */
+class Stopwatch {
+  u64 started;
+
+public:
+  Stopwatch() : started(cyclesBegin()) {}
+
+  void restart() { started = cyclesBegin(); }
+
+  u64 elapsed() const { return cyclesEnd() - started; }
+
+  u64 elapsedNanoseconds() const { return clock.nanoseconds(elapsed()); }
+};
+
+/**
+ * Adds cycles elapsed during its lifetime to `total`
+ */
+class ScopedStopwatch {
+  Stopwatch stopwatch;
+  u64 &total;
+
+public:
+  ScopedStopwatch(u64 &total) : total(total) {}
+  ScopedStopwatch(ScopedStopwatch &) = delete;
+  ~ScopedStopwatch() { total += stopwatch.elapsed(); }
+};
+
+} // namespace libpara::time
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::time::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    test("Conversion from cycles to nanoseconds");
+    {
+      auto c = Conversion::between(3000000000, 1000000000);
+      Expect(c(3) == 0 || c(3) == 1);
+      Expect(c(3000000000) >= 999999999 && c(3000000000) <= 1000000000);
+      // no overflow for an uptime of a year at 3 GHz
+      auto year = 365ULL * 24 * 3600;
+      auto ns = c(year * 3000000000);
+      Expect(ns >= year * 1000000000 - 1000 && ns <= year * 1000000000);
+    }
+
+    test("Conversion from nanoseconds to cycles");
+    {
+      auto c = Conversion::between(1000000000, 2500000000);
+      Expect(c(2) == 5);
+      Expect(c(1000000000) == 2500000000);
+    }
+
+    test("Conversion with a slow source clock");
+    {
+      auto c = Conversion::between(1, 1000000000);
+      Expect(c(7) == 7000000000);
+    }
+
+    test("Clock");
+    {
+      Clock clock;
+      Expect(!clock.isCalibrated());
+      clock.calibrate({.frequency = 2000000000, .reference = "test"});
+      Expect(clock.isCalibrated());
+      Expect(clock.nanoseconds(2000) == 1000);
+      Expect(clock.cycles(1000) == 2000);
+    }
+
+    test("Stopwatch");
+    {
+      u64 total = 0;
+      {
+        ScopedStopwatch stopwatch(total);
+        Expect(true);
+      }
+      Expect(total > 0);
+    }
+  }
+};
+} // namespace libpara::time::tests
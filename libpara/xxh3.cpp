@@ -0,0 +1,586 @@
+export module libpara.xxh3;
+
+import libpara.basic_types;
+
+using namespace libpara::basic_types;
+
+// XXH3 as specified by the reference implementation (xxHash 0.8), using
+// only its default secret and secrets derived from a seed
+
+const usize StripeSize = 64;
+const usize SecretConsumeRate = 8;
+const usize Accumulators = 8;
+const usize SecretMergeStart = 11;
+const usize SecretLastStart = 7;
+const usize MidSizeMax = 240;
+const usize SecretSizeMin = 136;
+const usize SecretSize = 192;
+
+const u32 PRIME32_1 = 0x9E3779B1U;
+const u32 PRIME32_2 = 0x85EBCA77U;
+const u32 PRIME32_3 = 0xC2B2AE3DU;
+const u64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const u64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const u64 PRIME64_3 = 0x165667B19E3779F9ULL;
+const u64 PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const u64 PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+alignas(64) const u8 default_secret[SecretSize] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+inline u32 read32(const u8 *p) {
+  u32 v;
+  __builtin_memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline u64 read64(const u8 *p) {
+  u64 v;
+  __builtin_memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline void write64(u8 *p, u64 v) { __builtin_memcpy(p, &v, sizeof(v)); }
+
+inline u64 rotl64(u64 x, int r) { return (x << r) | (x >> (64 - r)); }
+inline u32 rotl32(u32 x, int r) { return (x << r) | (x >> (32 - r)); }
+
+/**
+ * Full 64x64-bit product, returning the low half and storing the high one
+ */
+inline u64 multiply(u64 a, u64 b, u64 &high) {
+  auto product = static_cast<unsigned __int128>(a) * b;
+  high = static_cast<u64>(product >> 64);
+  return static_cast<u64>(product);
+}
+
+inline u64 foldedMultiply(u64 a, u64 b) {
+  u64 high;
+  auto low = multiply(a, b, high);
+  return low ^ high;
+}
+
+inline u64 avalanche64(u64 h) {
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  return h ^ (h >> 32);
+}
+
+inline u64 avalanche(u64 h) {
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ULL;
+  return h ^ (h >> 32);
+}
+
+inline u64 rrmxmx(u64 h, u64 len) {
+  h ^= rotl64(h, 49) ^ rotl64(h, 24);
+  h *= 0x9FB21C651E98DF25ULL;
+  h ^= (h >> 35) + len;
+  h *= 0x9FB21C651E98DF25ULL;
+  return h ^ (h >> 28);
+}
+
+inline u64 mix16(const u8 *input, const u8 *secret, u64 seed) {
+  return foldedMultiply(read64(input) ^ (read64(secret) + seed),
+                        read64(input + 8) ^ (read64(secret + 8) - seed));
+}
+
+inline void mix32(u64 &low, u64 &high, const u8 *a, const u8 *b,
+                  const u8 *secret, u64 seed) {
+  low += mix16(a, secret, seed);
+  low ^= read64(b) + read64(b + 8);
+  high += mix16(b, secret + 16, seed);
+  high ^= read64(a) + read64(a + 8);
+}
+
+// Long inputs: stripes of input are accumulated into eight 64-bit lanes,
+// which are scrambled after every block. The same code is instantiated for
+// scalar lanes and for SSE2 and AVX2 vectors.
+
+typedef u64 u64x2 __attribute__((vector_size(16)));
+typedef u64 u64x4 __attribute__((vector_size(32)));
+
+template <typename V>
+[[gnu::always_inline]] inline void accumulateStripe(u64 *acc, const u8 *input,
+                                                    const u8 *secret) {
+  if constexpr (sizeof(V) == sizeof(u64)) {
+    for (usize i = 0; i < Accumulators; i++) {
+      auto data = read64(input + i * 8);
+      auto key = data ^ read64(secret + i * 8);
+      acc[i ^ 1] += data;
+      acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+  } else {
+    const usize lanes = sizeof(V) / sizeof(u64);
+    for (usize i = 0; i < Accumulators; i += lanes) {
+      V data, key, a;
+      __builtin_memcpy(&data, input + i * 8, sizeof(V));
+      __builtin_memcpy(&key, secret + i * 8, sizeof(V));
+      __builtin_memcpy(&a, acc + i, sizeof(V));
+      key ^= data;
+      V swapped;
+      if constexpr (lanes == 2)
+        swapped = __builtin_shufflevector(data, data, 1, 0);
+      else
+        swapped = __builtin_shufflevector(data, data, 1, 0, 3, 2);
+      a += swapped + (key & 0xFFFFFFFF) * (key >> 32);
+      __builtin_memcpy(acc + i, &a, sizeof(V));
+    }
+  }
+}
+
+template <typename V>
+[[gnu::always_inline]] inline void scramble(u64 *acc, const u8 *secret) {
+  const usize lanes = sizeof(V) / sizeof(u64);
+  for (usize i = 0; i < Accumulators; i += lanes) {
+    V a, key;
+    __builtin_memcpy(&a, acc + i, sizeof(V));
+    __builtin_memcpy(&key, secret + i * 8, sizeof(V));
+    a ^= a >> 47;
+    a ^= key;
+    a *= PRIME32_1;
+    __builtin_memcpy(acc + i, &a, sizeof(V));
+  }
+}
+
+template <typename V>
+[[gnu::always_inline]] inline void accumulateLong(u64 *acc, const u8 *input,
+                                                  usize len,
+                                                  const u8 *secret) {
+  const usize stripes_per_block =
+      (SecretSize - StripeSize) / SecretConsumeRate;
+  const usize block_size = StripeSize * stripes_per_block;
+  auto blocks = (len - 1) / block_size;
+  for (usize b = 0; b < blocks; b++) {
+    for (usize s = 0; s < stripes_per_block; s++)
+      accumulateStripe<V>(acc, input + b * block_size + s * StripeSize,
+                          secret + s * SecretConsumeRate);
+    scramble<V>(acc, secret + SecretSize - StripeSize);
+  }
+  auto stripes = ((len - 1) - block_size * blocks) / StripeSize;
+  for (usize s = 0; s < stripes; s++)
+    accumulateStripe<V>(acc, input + blocks * block_size + s * StripeSize,
+                        secret + s * SecretConsumeRate);
+  accumulateStripe<V>(acc, input + len - StripeSize,
+                      secret + SecretSize - StripeSize - SecretLastStart);
+}
+
+void accumulateScalar(u64 *acc, const u8 *input, usize len,
+                      const u8 *secret) {
+  accumulateLong<u64>(acc, input, len, secret);
+}
+
+void accumulateSSE2(u64 *acc, const u8 *input, usize len, const u8 *secret) {
+  accumulateLong<u64x2>(acc, input, len, secret);
+}
+
+[[gnu::target("avx2")]] void accumulateAVX2(u64 *acc, const u8 *input,
+                                            usize len, const u8 *secret) {
+  accumulateLong<u64x4>(acc, input, len, secret);
+}
+
+export namespace libpara::xxh3 {
+
+struct Hash128 {
+  u64 low;
+  u64 high;
+
+  bool operator==(const Hash128 &other) const = default;
+};
+
+/**
+ * Implementation of the loop over long (over 240 bytes) inputs
+ */
+enum class Kernel : u8 { Unselected, Scalar, SSE2, AVX2 };
+
+/**
+ * Fastest kernel current CPU can run: AVX2 needs both CPU support and the
+ * OS (this kernel, when freestanding) having enabled AVX state
+ */
+Kernel bestKernel() {
+  u32 eax, ebx, ecx, edx;
+  asm("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+  if (eax < 7)
+    return Kernel::SSE2;
+  asm("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+  const u32 OSXSAVE = 1 << 27, AVX = 1 << 28;
+  if ((ecx & (OSXSAVE | AVX)) != (OSXSAVE | AVX))
+    return Kernel::SSE2;
+  u32 xcr0_low, xcr0_high;
+  asm("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  // SSE and AVX state
+  if ((xcr0_low & 0x6) != 0x6)
+    return Kernel::SSE2;
+  asm("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+  const u32 AVX2 = 1 << 5;
+  return (ebx & AVX2) != 0 ? Kernel::AVX2 : Kernel::SSE2;
+}
+
+// Picked on first use of a long input, unless set with `use()`
+constinit Kernel selected = Kernel::Unselected;
+
+/**
+ * Makes long inputs go through `kernel` (which current CPU must support)
+ * from now on
+ */
+void use(Kernel kernel) {
+  __atomic_store_n(&selected, kernel, __ATOMIC_RELAXED);
+}
+
+} // namespace libpara::xxh3
+
+using namespace libpara::xxh3;
+
+void accumulate(u64 *acc, const u8 *input, usize len, const u8 *secret) {
+  auto kernel = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+  if (kernel == Kernel::Unselected) {
+    kernel = bestKernel();
+    use(kernel);
+  }
+  switch (kernel) {
+  case Kernel::AVX2:
+    accumulateAVX2(acc, input, len, secret);
+    break;
+  case Kernel::Scalar:
+    accumulateScalar(acc, input, len, secret);
+    break;
+  default:
+    accumulateSSE2(acc, input, len, secret);
+  }
+}
+
+inline u64 mergeAccumulators(const u64 *acc, const u8 *secret, u64 start) {
+  auto result = start;
+  for (usize i = 0; i < 4; i++)
+    result += foldedMultiply(acc[2 * i] ^ read64(secret + 16 * i),
+                             acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+  return avalanche(result);
+}
+
+/**
+ * Secret for `seed`, derived from the default one
+ */
+void deriveSecret(u8 *secret, u64 seed) {
+  for (usize i = 0; i < SecretSize / 16; i++) {
+    write64(secret + 16 * i, read64(default_secret + 16 * i) + seed);
+    write64(secret + 16 * i + 8, read64(default_secret + 16 * i + 8) - seed);
+  }
+}
+
+/**
+ * Accumulates a long input, returning the secret used to merge the lanes
+ */
+const u8 *accumulateLong(u64 *acc, const u8 *input, usize len, u64 seed,
+                         u8 *derived) {
+  const u64 initial[Accumulators] = {PRIME32_3, PRIME64_1, PRIME64_2,
+                                     PRIME64_3, PRIME64_4, PRIME32_2,
+                                     PRIME64_5, PRIME32_1};
+  for (usize i = 0; i < Accumulators; i++)
+    acc[i] = initial[i];
+  auto secret = default_secret;
+  if (seed != 0) {
+    deriveSecret(derived, seed);
+    secret = derived;
+  }
+  accumulate(acc, input, len, secret);
+  return secret;
+}
+
+u64 hash64Short(const u8 *p, usize len, u64 seed) {
+  auto secret = default_secret;
+  if (len > 8) {
+    auto flip1 = (read64(secret + 24) ^ read64(secret + 32)) + seed;
+    auto flip2 = (read64(secret + 40) ^ read64(secret + 48)) - seed;
+    auto low = read64(p) ^ flip1;
+    auto high = read64(p + len - 8) ^ flip2;
+    return avalanche(len + __builtin_bswap64(low) + high +
+                     foldedMultiply(low, high));
+  }
+  if (len >= 4) {
+    seed ^= static_cast<u64>(__builtin_bswap32(static_cast<u32>(seed))) << 32;
+    auto flip = (read64(secret + 8) ^ read64(secret + 16)) - seed;
+    auto input = read32(p + len - 4) + (static_cast<u64>(read32(p)) << 32);
+    return rrmxmx(input ^ flip, len);
+  }
+  if (len > 0) {
+    u32 combined = static_cast<u32>(p[0]) << 16 |
+                   static_cast<u32>(p[len >> 1]) << 24 | p[len - 1] |
+                   static_cast<u32>(len) << 8;
+    auto flip = static_cast<u64>(read32(secret) ^ read32(secret + 4)) + seed;
+    return avalanche64(combined ^ flip);
+  }
+  return avalanche64(seed ^ read64(secret + 56) ^ read64(secret + 64));
+}
+
+Hash128 hash128Short(const u8 *p, usize len, u64 seed) {
+  auto secret = default_secret;
+  if (len > 8) {
+    auto flip_low = (read64(secret + 32) ^ read64(secret + 40)) - seed;
+    auto flip_high = (read64(secret + 48) ^ read64(secret + 56)) + seed;
+    auto input_low = read64(p);
+    auto input_high = read64(p + len - 8);
+    u64 mul_high;
+    auto mul_low =
+        multiply(input_low ^ input_high ^ flip_low, PRIME64_1, mul_high);
+    mul_low += static_cast<u64>(len - 1) << 54;
+    input_high ^= flip_high;
+    mul_high += input_high + static_cast<u64>(static_cast<u32>(input_high)) *
+                                 (PRIME32_2 - 1);
+    mul_low ^= __builtin_bswap64(mul_high);
+    u64 result_high;
+    auto result_low = multiply(mul_low, PRIME64_2, result_high);
+    result_high += mul_high * PRIME64_2;
+    return {avalanche(result_low), avalanche(result_high)};
+  }
+  if (len >= 4) {
+    seed ^= static_cast<u64>(__builtin_bswap32(static_cast<u32>(seed))) << 32;
+    auto input = read32(p) + (static_cast<u64>(read32(p + len - 4)) << 32);
+    auto flip = (read64(secret + 16) ^ read64(secret + 24)) + seed;
+    u64 high;
+    auto low = multiply(input ^ flip, PRIME64_1 + (len << 2), high);
+    high += low << 1;
+    low ^= high >> 3;
+    low ^= low >> 35;
+    low *= 0x9FB21C651E98DF25ULL;
+    low ^= low >> 28;
+    return {low, avalanche(high)};
+  }
+  if (len > 0) {
+    u32 combined_low = static_cast<u32>(p[0]) << 16 |
+                       static_cast<u32>(p[len >> 1]) << 24 | p[len - 1] |
+                       static_cast<u32>(len) << 8;
+    u32 combined_high = rotl32(__builtin_bswap32(combined_low), 13);
+    auto flip_low =
+        static_cast<u64>(read32(secret) ^ read32(secret + 4)) + seed;
+    auto flip_high =
+        static_cast<u64>(read32(secret + 8) ^ read32(secret + 12)) - seed;
+    return {avalanche64(combined_low ^ flip_low),
+            avalanche64(combined_high ^ flip_high)};
+  }
+  return {avalanche64(seed ^ read64(secret + 64) ^ read64(secret + 72)),
+          avalanche64(seed ^ read64(secret + 80) ^ read64(secret + 88))};
+}
+
+/**
+ * Final mix of the 128-bit variant for inputs of 17 to 240 bytes
+ */
+inline Hash128 finish128(u64 low, u64 high, usize len, u64 seed) {
+  return {avalanche(low + high),
+          0 - avalanche(low * PRIME64_1 + high * PRIME64_4 +
+                        (len - seed) * PRIME64_2)};
+}
+
+export namespace libpara::xxh3 {
+
+/**
+ * XXH3-64 of `len` bytes at `data`
+ */
+u64 hash64(const void *data, usize len, u64 seed = 0) {
+  auto p = reinterpret_cast<const u8 *>(data);
+  auto secret = default_secret;
+  if (len <= 16)
+    return hash64Short(p, len, seed);
+  if (len <= 128) {
+    u64 acc = len * PRIME64_1;
+    if (len > 32) {
+      if (len > 64) {
+        if (len > 96) {
+          acc += mix16(p + 48, secret + 96, seed);
+          acc += mix16(p + len - 64, secret + 112, seed);
+        }
+        acc += mix16(p + 32, secret + 64, seed);
+        acc += mix16(p + len - 48, secret + 80, seed);
+      }
+      acc += mix16(p + 16, secret + 32, seed);
+      acc += mix16(p + len - 32, secret + 48, seed);
+    }
+    acc += mix16(p, secret, seed);
+    acc += mix16(p + len - 16, secret + 16, seed);
+    return avalanche(acc);
+  }
+  if (len <= MidSizeMax) {
+    u64 acc = len * PRIME64_1;
+    usize i = 0;
+    for (; i < 8; i++)
+      acc += mix16(p + 16 * i, secret + 16 * i, seed);
+    acc = avalanche(acc);
+    for (; i < len / 16; i++)
+      acc += mix16(p + 16 * i, secret + 16 * (i - 8) + 3, seed);
+    acc += mix16(p + len - 16, secret + SecretSizeMin - 17, seed);
+    return avalanche(acc);
+  }
+  alignas(32) u64 acc[Accumulators];
+  alignas(64) u8 derived[SecretSize];
+  auto used = accumulateLong(acc, p, len, seed, derived);
+  return mergeAccumulators(acc, used + SecretMergeStart, len * PRIME64_1);
+}
+
+/**
+ * XXH3-128 of `len` bytes at `data`
+ */
+Hash128 hash128(const void *data, usize len, u64 seed = 0) {
+  auto p = reinterpret_cast<const u8 *>(data);
+  auto secret = default_secret;
+  if (len <= 16)
+    return hash128Short(p, len, seed);
+  if (len <= 128) {
+    u64 low = len * PRIME64_1, high = 0;
+    if (len > 32) {
+      if (len > 64) {
+        if (len > 96)
+          mix32(low, high, p + 48, p + len - 64, secret + 96, seed);
+        mix32(low, high, p + 32, p + len - 48, secret + 64, seed);
+      }
+      mix32(low, high, p + 16, p + len - 32, secret + 32, seed);
+    }
+    mix32(low, high, p, p + len - 16, secret, seed);
+    return finish128(low, high, len, seed);
+  }
+  if (len <= MidSizeMax) {
+    u64 low = len * PRIME64_1, high = 0;
+    usize i = 0;
+    for (; i < 4; i++)
+      mix32(low, high, p + 32 * i, p + 32 * i + 16, secret + 32 * i, seed);
+    low = avalanche(low);
+    high = avalanche(high);
+    for (; i < len / 32; i++)
+      mix32(low, high, p + 32 * i, p + 32 * i + 16,
+            secret + 3 + 32 * (i - 4), seed);
+    mix32(low, high, p + len - 16, p + len - 32,
+          secret + SecretSizeMin - 17 - 16, 0 - seed);
+    return finish128(low, high, len, seed);
+  }
+  alignas(32) u64 acc[Accumulators];
+  alignas(64) u8 derived[SecretSize];
+  auto used = accumulateLong(acc, p, len, seed, derived);
+  return {mergeAccumulators(acc, used + SecretMergeStart, len * PRIME64_1),
+          mergeAccumulators(acc,
+                            used + SecretSize - sizeof(acc) - SecretMergeStart,
+                            ~(len * PRIME64_2))};
+}
+
+} // namespace libpara::xxh3
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::xxh3::tests {
+
+class TestCase : public libpara::testing::TestCase {
+
+  static inline u8 data[5000];
+
+  struct Vector {
+    usize length;
+    u64 seed;
+    u64 hash64;
+    Hash128 hash128;
+  };
+
+  // from the reference implementation, over bytes (i * 31 + 7) & 0xFF
+  static constexpr Vector vectors[] = {
+      {0, 0, 0x2d06800538d394c2, {0x6001c324468d497f, 0x99aa06d3014798d8}},
+      {1, 42, 0xc72384329881f542, {0xc72384329881f542, 0x8f345f94f33c2b82}},
+      {3, 0, 0x15f7093b173d005c, {0x15f7093b173d005c, 0x46f66cb935381565}},
+      {4, 42, 0x859b7ff8d1723aa1, {0xdd48c85cddc56442, 0xef5093cc1eee3328}},
+      {8, 0, 0xdec6a9a43575982e, {0x56bb836ceb6d4baa, 0x803c675a846cc6c2}},
+      {9, 42, 0x0131443739131d68, {0xa5f12b78647cce39, 0xed2eb2273204060c}},
+      {16, 0, 0x7e484c18d74895d0, {0xf853dd94614dfa07, 0x650fe308c566747d}},
+      {17, 42, 0x7c41a57ae29003da, {0xa358f41c08eae56b, 0xf2a4efb3033889ea}},
+      {128, 0, 0xf92b70eaa21a6288, {0x1e04fad9f0cacb4d, 0xb4f87b99d2db8a51}},
+      {129, 42, 0xb672f12eed8cd6b0, {0xe7587ad8e8bcb0b8, 0x78424f455e91958c}},
+      {240, 0, 0xccc7375172c41f03, {0x93e173833f75ab66, 0xde57aab31e77a2ff}},
+      {241, 42, 0x015f3bb61c188b1a, {0x015f3bb61c188b1a, 0x74ef3123b647beac}},
+      {1000, 0, 0x989765d0ea7a5ecd, {0x989765d0ea7a5ecd, 0xf534f51e82a81d29}},
+      {5000, 42, 0x9280bd17564fdf91, {0x9280bd17564fdf91, 0x101eadafa339a6ec}},
+  };
+
+  bool matchesVectors() {
+    for (auto &v : vectors)
+      if (hash64(data, v.length, v.seed) != v.hash64 ||
+          hash128(data, v.length, v.seed) != v.hash128)
+        return false;
+    return true;
+  }
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    for (usize i = 0; i < sizeof(data); i++)
+      data[i] = static_cast<u8>(i * 31 + 7);
+    auto best = bestKernel();
+
+    test("XXH3 matches the reference implementation");
+    Expect(matchesVectors());
+
+    test("XXH3 kernels agree");
+    use(Kernel::Scalar);
+    Expect(matchesVectors());
+    use(Kernel::SSE2);
+    Expect(matchesVectors());
+    if (best == Kernel::AVX2) {
+      use(Kernel::AVX2);
+      Expect(matchesVectors());
+    }
+    use(best);
+  }
+};
+
+} // namespace libpara::xxh3::tests
+
+import libpara.bench;
+
+export namespace libpara::xxh3::benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+
+  static inline u8 data[4096];
+
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    using libpara::bench::keep;
+    for (usize i = 0; i < sizeof(data); i++)
+      data[i] = static_cast<u8>(i * 31 + 7);
+    keep(data);
+    auto best = bestKernel();
+    use(best);
+    measure("xxh3.8B", [] { keep(hash64(data, 8)); });
+    measure("xxh3.64B", [] { keep(hash64(data, 64)); });
+    measure("xxh3.4KiB", [] { keep(hash64(data, sizeof(data))); });
+
+    // every kernel on its own, on input long enough to be all stripes
+    use(Kernel::Scalar);
+    measure("xxh3.4KiB.scalar", [] { keep(hash64(data, sizeof(data))); });
+    use(Kernel::SSE2);
+    measure("xxh3.4KiB.sse2", [] { keep(hash64(data, sizeof(data))); });
+    if (best == Kernel::AVX2) {
+      use(Kernel::AVX2);
+      measure("xxh3.4KiB.avx2", [] { keep(hash64(data, sizeof(data))); });
+    }
+    use(best);
+  }
+};
+
+} // namespace libpara::xxh3::benchmarks
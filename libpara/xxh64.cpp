@@ -2,10 +2,17 @@ export module libpara.xxh64;
 
 import libpara.basic_types;
 
-int constexpr length(const char *str) { return __builtin_strlen(str); }
-
 using namespace libpara::basic_types;
 
+// a loop rather than `__builtin_strlen`, which becomes a call to `strlen`
+// outside of constant evaluation, and the kernel has none
+constexpr u64 length(const char *str) {
+  u64 n = 0;
+  while (str[n] != 0)
+    n++;
+  return n;
+}
+
 export namespace libpara {
 // Largely based on the code from https://github.com/ekpyron/xxhashct
 /*
@@ -31,15 +38,77 @@ export namespace libpara {
  */
 
 struct xxh64 {
+  /**
+   * Hashes `len` bytes at `p`. Constant evaluation and run time give the
+   * same results, but take different paths: the recursive one below, which
+   * is usable in `consteval` code, and an iterative one with wide loads.
+   */
   static constexpr u64 hash(const char *p, u64 len, u64 seed) {
-    return finalize((len >= 32 ? h32bytes(p, len, seed) : seed + PRIME5) + len,
-                    p + (len & ~0x1F), len & 0x1F);
+    if (__builtin_is_constant_evaluated())
+      return finalize((len >= 32 ? h32bytes(p, len, seed) : seed + PRIME5) +
+                          len,
+                      p + (len & ~0x1F), len & 0x1F);
+    return hashRuntime(reinterpret_cast<const u8 *>(p), len, seed);
   }
 
   static constexpr u64 hash(const char *p, u64 seed) {
     return hash(p, length(p), seed);
   }
 
+  /**
+   * Incremental hashing of data that isn't contiguous: `update()` with each
+   * piece, then `digest()`. Gives the same result as hashing all pieces
+   * at once.
+   */
+  class State {
+    u64 v1, v2, v3, v4;
+    u64 seed;
+    u64 total = 0;
+    // input that doesn't fill a whole stripe yet
+    u8 buffer[32];
+    u8 buffered = 0;
+
+  public:
+    constexpr State(u64 seed = 0)
+        : v1(seed + PRIME1 + PRIME2), v2(seed + PRIME2), v3(seed),
+          v4(seed - PRIME1), seed(seed) {}
+
+    void update(const void *data, usize len) {
+      auto p = reinterpret_cast<const u8 *>(data);
+      total += len;
+      if (buffered + len < sizeof(buffer)) {
+        __builtin_memcpy(buffer + buffered, p, len);
+        buffered += static_cast<u8>(len);
+        return;
+      }
+      if (buffered > 0) {
+        auto fill = sizeof(buffer) - buffered;
+        __builtin_memcpy(buffer + buffered, p, fill);
+        stripe(buffer);
+        p += fill;
+        len -= fill;
+        buffered = 0;
+      }
+      for (; len >= 32; p += 32, len -= 32)
+        stripe(p);
+      __builtin_memcpy(buffer, p, len);
+      buffered = static_cast<u8>(len);
+    }
+
+    u64 digest() const {
+      u64 h = total >= 32 ? merge(v1, v2, v3, v4) : seed + PRIME5;
+      return finalizeRuntime(h + total, buffer, buffered);
+    }
+
+  private:
+    void stripe(const u8 *p) {
+      v1 = round(v1, load64(p));
+      v2 = round(v2, load64(p + 8));
+      v3 = round(v3, load64(p + 16));
+      v4 = round(v4, load64(p + 24));
+    }
+  };
+
 private:
   static constexpr u64 PRIME1 = 11400714785074694791ULL;
   static constexpr u64 PRIME2 = 14029467366897019727ULL;
@@ -118,5 +187,160 @@ private:
     return h32bytes(p, len, seed + PRIME1 + PRIME2, seed + PRIME2, seed,
                     seed - PRIME1);
   }
+
+  // Run time path, for little endian targets only
+
+  static u64 load64(const u8 *p) {
+    u64 v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static u32 load32(const u8 *p) {
+    u32 v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static u64 round(u64 acc, u64 input) {
+    return rotl(acc + input * PRIME2, 31) * PRIME1;
+  }
+
+  static u64 merge(u64 v1, u64 v2, u64 v3, u64 v4) {
+    u64 h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = (h ^ round(0, v1)) * PRIME1 + PRIME4;
+    h = (h ^ round(0, v2)) * PRIME1 + PRIME4;
+    h = (h ^ round(0, v3)) * PRIME1 + PRIME4;
+    return (h ^ round(0, v4)) * PRIME1 + PRIME4;
+  }
+
+  static u64 finalizeRuntime(u64 h, const u8 *p, usize len) {
+    for (; len >= 8; p += 8, len -= 8)
+      h = rotl(h ^ round(0, load64(p)), 27) * PRIME1 + PRIME4;
+    if (len >= 4) {
+      h = rotl(h ^ static_cast<u64>(load32(p)) * PRIME1, 23) * PRIME2 + PRIME3;
+      p += 4;
+      len -= 4;
+    }
+    for (; len > 0; p++, len--)
+      h = rotl(h ^ *p * PRIME5, 11) * PRIME1;
+    return mix1(mix1(mix1(h, PRIME2, 33), PRIME3, 29), 1, 32);
+  }
+
+  static u64 hashRuntime(const u8 *p, usize len, u64 seed) {
+    u64 h;
+    auto tail = len & 0x1F;
+    if (len >= 32) {
+      u64 v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed,
+          v4 = seed - PRIME1;
+      for (auto end = p + len - tail; p < end; p += 32) {
+        v1 = round(v1, load64(p));
+        v2 = round(v2, load64(p + 8));
+        v3 = round(v3, load64(p + 16));
+        v4 = round(v4, load64(p + 24));
+      }
+      h = merge(v1, v2, v3, v4);
+    } else
+      h = seed + PRIME5;
+    return finalizeRuntime(h + len, p, tail);
+  }
 };
 } // namespace libpara
+
+import libpara.testing;
+
+#include <testing.hpp>
+
+export namespace libpara::xxh64_tests {
+
+// `libpara::xxh64` is a struct, so its tests can't go in a nested namespace
+class TestCase : public libpara::testing::TestCase {
+
+  static inline char data[1000];
+
+  struct Vector {
+    usize length;
+    u64 seed;
+    u64 hash;
+  };
+
+  // from the reference implementation, over bytes (i * 31 + 7) & 0xFF
+  static constexpr Vector vectors[] = {
+      {0, 0, 0xef46db3751d8e999},   {1, 42, 0xda6da76043d2a83e},
+      {3, 0, 0x56e6957632a487f9},   {4, 42, 0xe2c155d02e150d37},
+      {8, 0, 0x3da5c7aa269683e0},   {9, 42, 0x86ddf140d3505b88},
+      {16, 0, 0xa19ad429b02bc413},  {31, 42, 0xbb093c6946ef4856},
+      {32, 0, 0x8d57d6a4671cc43d},  {33, 42, 0xc03305a3e364a332},
+      {100, 0, 0xefa0ad2d3e70c151}, {1000, 42, 0xebbb006470311ebc},
+  };
+
+public:
+  using libpara::testing::TestCase::TestCase;
+
+  virtual void run() {
+    for (usize i = 0; i < sizeof(data); i++)
+      data[i] = static_cast<char>(i * 31 + 7);
+
+    test("xxh64 matches the reference implementation");
+    {
+      bool matches = true;
+      for (auto &v : vectors)
+        matches = matches && xxh64::hash(data, v.length, v.seed) == v.hash;
+      Expect(matches);
+    }
+
+    test("xxh64 gives the same results at compile time");
+    {
+      static_assert(xxh64::hash("test.a", 0) == 0xe4088ff7fa4a2d69);
+      const char *name = "test.a";
+      Expect(xxh64::hash(name, 0) == 0xe4088ff7fa4a2d69);
+      constexpr char long_name[] = "a name long enough for 32-byte stripes";
+      constexpr auto hash = xxh64::hash(long_name, 0);
+      const char *runtime_name = long_name;
+      Expect(xxh64::hash(runtime_name, 0) == hash);
+    }
+
+    test("xxh64 State matches one-shot hashing");
+    {
+      bool matches = true;
+      for (auto &v : vectors) {
+        xxh64::State state(v.seed);
+        // uneven pieces, so that some straddle stripes
+        for (usize offset = 0, piece = 1; offset < v.length;
+             offset += piece, piece = piece * 2 + 1) {
+          auto size = v.length - offset < piece ? v.length - offset : piece;
+          state.update(data + offset, size);
+        }
+        matches = matches && state.digest() == v.hash;
+      }
+      Expect(matches);
+    }
+  }
+};
+
+} // namespace libpara::xxh64_tests
+
+import libpara.bench;
+
+export namespace libpara::xxh64_benchmarks {
+
+class Benchmark : public libpara::bench::Benchmark {
+
+  static inline char data[4096];
+
+public:
+  using libpara::bench::Benchmark::Benchmark;
+
+  virtual void run() {
+    using libpara::bench::keep;
+    for (usize i = 0; i < sizeof(data); i++)
+      data[i] = static_cast<char>(i * 31 + 7);
+    // `data` is opaque to the compiler, so hashes aren't constant folded
+    keep(data);
+    measure("xxh64.8B", [] { keep(xxh64::hash(data, 8, 0)); });
+    measure("xxh64.64B", [] { keep(xxh64::hash(data, 64, 0)); });
+    measure("xxh64.4KiB", [] { keep(xxh64::hash(data, sizeof(data), 0)); });
+  }
+};
+
+} // namespace libpara::xxh64_benchmarks
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Compares ParaOS benchmark results against a baseline.
+
+`make bench` runs it on the serial console it captured:
+
+    tools/bench-compare.py build/bench.log bench-baseline.log
+
+Without a baseline, results are only listed. Exits with status 1 when a
+benchmark's median got slower than the baseline's by more than the threshold
+(in percent), or when the run didn't complete.
+"""
+
+import argparse
+import os
+import sys
+
+
+def parse(lines):
+    """Returns ({name: {statistic: value}}, complete) for benchmark output"""
+    results, complete = {}, False
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("bench: "):
+            continue
+        name, *fields = line[len("bench: "):].split()
+        if name == "end":
+            complete = True
+        elif fields:
+            results[name] = {key: float(value) for key, value in
+                             (field.split("=", 1) for field in fields)}
+    return results, complete
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("log", type=argparse.FileType("r"))
+    parser.add_argument("baseline", nargs="?")
+    parser.add_argument("--threshold", type=float, default=10,
+                        help="allowed slowdown of medians, in percent")
+    args = parser.parse_args()
+
+    results, complete = parse(args.log)
+    if not results:
+        sys.exit("no benchmark results found")
+    baseline = {}
+    if args.baseline and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline, _ = parse(f)
+    elif args.baseline:
+        print("no baseline at %s (save one with `make bench-baseline`)" %
+              args.baseline)
+
+    regressions = 0
+    print("%-28s %12s %12s %9s" % ("benchmark", "baseline", "median", "change"))
+    for name, statistics in results.items():
+        median = statistics["median"]
+        if name not in baseline:
+            print("%-28s %12s %12.2f" % (name, "-", median))
+            continue
+        before = baseline[name]["median"]
+        change = (median - before) * 100 / before if before else 0
+        regressed = change > args.threshold
+        regressions += regressed
+        print("%-28s %12.2f %12.2f %+8.1f%%%s" % (
+            name, before, median, change, "  REGRESSION" if regressed else ""))
+    if not complete:
+        sys.exit("benchmarks didn't complete")
+    if regressions:
+        sys.exit("%d benchmark(s) regressed by more than %g%%" %
+                 (regressions, args.threshold))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Decodes a ParaOS trace dump.
+
+Build with `make TRACE=true`, capture the serial console (for example,
+`make qemu TRACE=true | tee serial.log`) and run:
+
+    tools/decode-trace.py serial.log              # text, one event per line
+    tools/decode-trace.py --chrome serial.log > trace.json
+
+Chrome trace JSON can be loaded into chrome://tracing or Perfetto. Events of
+tracepoints named `*.begin` and `*.end` become spans; everything else is an
+instant event.
+"""
+
+import argparse
+import json
+import sys
+
+
+def parse(lines):
+    """Yields (frequency, points, events) for every dump found in `lines`"""
+    frequency, points, events = None, {}, []
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("trace: "):
+            continue
+        kind, *fields = line[len("trace: "):].split()
+        if kind == "begin":
+            frequency, points, events = int(fields[0]), {}, []
+        elif kind == "point":
+            points[int(fields[0])] = (fields[2], int(fields[1]))
+        elif kind == "event":
+            timestamp, cpu, point, *arguments = map(int, fields)
+            events.append((timestamp, cpu, point, arguments))
+        elif kind == "end" and frequency is not None:
+            events.sort()
+            yield frequency, points, events
+            frequency = None
+
+
+def name_of(points, point):
+    return points.get(point, ("0x%08x" % point, 0))[0]
+
+
+def text(frequency, points, events, out):
+    start = events[0][0] if events else 0
+    for timestamp, cpu, point, arguments in events:
+        delta = timestamp - start
+        when = "%14.3f us" % (delta * 1e6 / frequency) if frequency else \
+            "%14d cycles" % delta
+        out.write(("%s  CPU %-3d %-24s %s" % (
+            when, cpu, name_of(points, point),
+            " ".join(str(a) for a in arguments))).rstrip() + "\n")
+
+
+def chrome(frequency, points, events):
+    start = events[0][0] if events else 0
+    trace = []
+    for timestamp, cpu, point, arguments in events:
+        name = name_of(points, point)
+        phase = "i"
+        for suffix, span_phase in ((".begin", "B"), (".end", "E")):
+            if name.endswith(suffix):
+                name, phase = name[:-len(suffix)], span_phase
+        # without a calibrated clock, present cycles as microseconds
+        ts = (timestamp - start) * 1e6 / frequency if frequency else \
+            timestamp - start
+        event = {"name": name, "ph": phase, "ts": ts, "pid": 0, "tid": cpu,
+                 "args": {"arg%d" % i: a for i, a in enumerate(arguments)}}
+        if phase == "i":
+            event["s"] = "t"
+        trace.append(event)
+    return trace
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"),
+                        default=sys.stdin)
+    parser.add_argument("--chrome", action="store_true",
+                        help="output Chrome trace JSON")
+    args = parser.parse_args()
+
+    dumps = list(parse(args.log))
+    if not dumps:
+        sys.exit("no trace dump found")
+    if args.chrome:
+        trace = []
+        for dump in dumps:
+            trace.extend(chrome(*dump))
+        json.dump({"traceEvents": trace}, sys.stdout)
+    else:
+        for dump in dumps:
+            text(*dump, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Folds ParaOS profile samples into stacks for flame graphs.
+
+Build with `make PROFILE=true`, capture the serial console (for example,
+`make qemu PROFILE=true | tee serial.log`) and run:
+
+    tools/fold-profile.py build/paraos serial.log > profile.folded
+    flamegraph.pl profile.folded > profile.svg
+
+To profile the benchmarks instead, use `make bench PROFILE=true`: they run
+once every CPU is up, and the cycles a fixed workload takes with sampling
+paused and on are reported as the sampling overhead.
+
+Addresses are mapped to functions with the kernel's symbol table (read with
+`nm`). Every output line is a call stack, outermost function first, followed
+by the number of samples that had it.
+"""
+
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+def symbols(elf, nm):
+    """Returns (sorted addresses, names) of the functions in `elf`"""
+    output = subprocess.run([nm, "--defined-only", "-C", "-n", elf],
+                            check=True, capture_output=True, text=True).stdout
+    addresses, names = [], []
+    for line in output.splitlines():
+        fields = line.split(None, 2)
+        if len(fields) == 3 and fields[1] in "tTwW":
+            addresses.append(int(fields[0], 16))
+            names.append(fields[2])
+    return addresses, names
+
+
+def parse(lines, overhead):
+    """Yields (cpu, frames, dropped) for every sample in `lines`, innermost
+    frame first. Drop counts come as samples without frames. Overhead
+    measurements are appended to `overhead` as (paused, sampling) cycles."""
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("profile: "):
+            continue
+        kind, *fields = line[len("profile: "):].split()
+        if kind == "stack":
+            yield int(fields[0]), [int(f, 16) for f in fields[1:]], 0
+        elif kind == "dropped":
+            yield int(fields[0]), [], int(fields[1])
+        elif kind == "overhead":
+            overhead.append((int(fields[0]), int(fields[1])))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("elf", help="kernel image the samples were taken of")
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"),
+                        default=sys.stdin)
+    parser.add_argument("--nm", default="nm", help="nm to read symbols with")
+    parser.add_argument("--per-cpu", action="store_true",
+                        help="start every stack with the CPU it was taken on")
+    args = parser.parse_args()
+
+    addresses, names = symbols(args.elf, args.nm)
+
+    def name_of(address):
+        i = bisect.bisect_right(addresses, address) - 1
+        return names[i].replace(";", ":") if i >= 0 else "0x%x" % address
+
+    stacks, samples, dropped, overhead = collections.Counter(), 0, 0, []
+    for cpu, frames, drops in parse(args.log, overhead):
+        dropped += drops
+        if not frames:
+            continue
+        samples += 1
+        # return addresses point past the call, which may be the start of
+        # the next function
+        stack = [name_of(frames[0])] + [name_of(f - 1) for f in frames[1:]]
+        if args.per_cpu:
+            stack.append("CPU %d" % cpu)
+        stacks[";".join(reversed(stack))] += 1
+
+    if not samples:
+        sys.exit("no profile samples found")
+    for stack, count in sorted(stacks.items()):
+        print("%s %d" % (stack, count))
+    if dropped:
+        print("%d samples dropped (buffers were full)" % dropped,
+              file=sys.stderr)
+    for paused, sampling in overhead:
+        print("sampling overhead: %.1f%% (%d cycles paused, %d sampling)" %
+              (100.0 * (sampling - paused) / max(paused, 1), paused, sampling),
+              file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Turns a ParaOS profile dump into a raw profile for llvm-profdata.
+
+`make pgo-profile` runs the benchmarks on a kernel built with
+`PGO=instrument`, which writes its counters to the serial console after
+them, and then:
+
+    tools/pgo-collect.py build/pgo/bench.log build/pgo/paraos.profraw
+    llvm-profdata merge -o paraos.profdata build/pgo/paraos.profraw
+
+The kernel has no profiling runtime, so the raw profile's header is written
+here from the sections it dumped. Raw profile versions 5 to 10 are known
+(Clang 11 to 19), and the profile must be merged by the llvm-profdata of the
+compiler that wrote it.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = (255 << 56 | ord("l") << 48 | ord("p") << 40 | ord("r") << 32 |
+         ord("o") << 24 | ord("f") << 16 | ord("r") << 8 | 129)
+
+# raw version flag for single byte counters (block coverage)
+BYTE_COVERAGE = 1 << 60
+
+# size of a function's data record by raw version
+DATA_SIZES = {5: 48, 6: 48, 7: 48, 8: 48, 9: 64, 10: 64}
+
+MASK = (1 << 64) - 1
+
+
+def parse(lines):
+    """Returns (raw version, {section: (address, contents)}) of the last
+    complete dump in `lines`"""
+    dump, version, sections, current = None, None, {}, None
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("pgo: "):
+            continue
+        kind, *fields = line[len("pgo: "):].split()
+        if kind == "begin":
+            version, sections, current = int(fields[0], 16), {}, None
+        elif kind == "section":
+            current = fields[0]
+            sections[current] = (int(fields[1], 16), bytearray(),
+                                 int(fields[2]))
+        elif kind == "end":
+            if version is not None:
+                dump = (version, sections)
+            version, current = None, None
+        elif current is not None:
+            sections[current][1].extend(bytes.fromhex(kind))
+    if dump is None:
+        sys.exit("pgo-collect: no complete profile dump found")
+    version, sections = dump
+    for name, (_, contents, size) in sections.items():
+        if len(contents) != size:
+            sys.exit(f"pgo-collect: section {name} is truncated")
+    return version, {name: (address, bytes(contents))
+                     for name, (address, contents, _) in sections.items()}
+
+
+def padding(size):
+    """Bytes that align `size` to 8"""
+    return -size % 8
+
+
+def profraw(raw_version, sections):
+    """Returns the raw profile of the dumped sections"""
+    version = raw_version & 0xffffffff
+    if version not in DATA_SIZES:
+        sys.exit(f"pgo-collect: unsupported raw profile version {version}")
+    counter_size = 1 if raw_version & BYTE_COVERAGE else 8
+    data_address, data = sections["data"]
+    counters_address, counters = sections["counters"]
+    bitmap_address, bitmap = sections.get("bitmap", (0, b""))
+    names_address, names = sections["names"]
+
+    header = [MAGIC, raw_version]
+    if version >= 6:
+        header += [0]  # binary IDs
+    header += [len(data) // DATA_SIZES[version],
+               0,  # padding before counters
+               len(counters) // counter_size,
+               padding(len(counters))]
+    if version >= 9:
+        header += [len(bitmap), padding(len(bitmap))]
+    # counter pointers are relative to the data from version 8
+    header += [len(names), (counters_address - data_address) & MASK
+               if version >= 8 else counters_address]
+    if version >= 9:
+        header += [(bitmap_address - data_address) & MASK]
+    header += [names_address]
+    if version >= 10:
+        header += [0, 0]  # virtual tables and their names
+    # last value profiling kind, though values aren't profiled
+    header += [2 if version >= 10 else 1]
+
+    body = [data, counters, bytes(padding(len(counters)))]
+    if version >= 9:
+        body += [bitmap, bytes(padding(len(bitmap)))]
+    body += [names, bytes(padding(len(names)))]
+    return struct.pack(f"<{len(header)}Q", *header) + b"".join(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("log", type=argparse.FileType("r"),
+                        help="serial console output with the dump")
+    parser.add_argument("output", type=argparse.FileType("wb"),
+                        help="raw profile to write")
+    args = parser.parse_args()
+
+    args.output.write(profraw(*parse(args.log)))
+
+
+if __name__ == "__main__":
+    main()